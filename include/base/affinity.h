@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace sylar
+{
+
+/**
+ *  @brief CPU和NUMA拓扑
+ *  @details 从 /sys/devices/system/node 读取每个NUMA节点的CPU，只保留进程允许使用的CPU；
+ *           没有NUMA信息时所有CPU都算在节点0上
+ */
+class CpuTopology
+{
+public:
+    /**
+     *  @brief 获得拓扑单例，第一次调用时读取
+     */
+    static const CpuTopology& Get();
+
+    /**
+     *  @brief 进程允许使用的CPU，升序
+     */
+    const std::vector<int>& getCpus() const { return m_cpus; }
+
+    /**
+     *  @brief NUMA节点数，至少为1
+     */
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /**
+     *  @brief 节点上进程允许使用的CPU，升序
+     */
+    const std::vector<int>& getNodeCpus(size_t node) const { return m_nodes[node]; }
+
+    /**
+     *  @brief 节点在系统中的编号，用于内存绑定
+     */
+    int getNodeId(size_t node) const { return m_nodeIds[node]; }
+
+    /**
+     *  @brief CPU所在的节点下标，未知返回-1
+     */
+    int getNodeOfCpu(int cpu) const;
+
+    /**
+     *  @brief 一组CPU所在的节点编号，跨节点或者未知返回-1
+     */
+    int getNodeIdOfCpus(const std::vector<int>& cpus) const;
+
+private:
+    CpuTopology();
+
+private:
+    std::vector<int> m_cpus;                // 允许使用的CPU
+    std::vector<std::vector<int>> m_nodes;  // 每个节点允许使用的CPU
+    std::vector<int> m_nodeIds;             // 每个节点在系统中的编号
+};
+
+/**
+ *  @brief 按策略为每个调度线程分配CPU
+ *  @param[in] spec 策略：
+ *             none    不绑定
+ *             compact 依次绑定到同一节点上相邻的CPU，用满一个节点再用下一个
+ *             scatter 轮流绑定到各个节点，同一节点内依次使用各个CPU
+ *             numa    每个线程绑定到一个节点的全部CPU，线程在节点之间轮流分配
+ *             CPU列表 如"0-3,8,10"，线程依次绑定到列表中的CPU
+ *  @param[in] workers 调度线程数
+ *  @return 每个线程的CPU集合，空集合表示不绑定；策略非法时全部不绑定
+ */
+std::vector<std::vector<int>> PlanAffinity(const std::string& spec, size_t workers);
+
+/**
+ *  @brief 解析CPU列表，如"0-3,8"，格式错误返回false
+ */
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+
+/**
+ *  @brief 把CPU集合格式化为"0-3,8"的形式
+ */
+std::string FormatCpuList(const std::vector<int>& cpus);
+
+/**
+ *  @brief 把当前线程绑定到cpus，空集合什么都不做
+ *  @details 同时记录当前线程所在的NUMA节点，之后本线程映射的协程栈优先从该节点分配
+ */
+bool SetThreadAffinity(const std::vector<int>& cpus);
+
+/**
+ *  @brief 当前线程实际可以运行的CPU
+ */
+std::vector<int> GetThreadAffinity();
+
+/**
+ *  @brief 当前线程绑定的NUMA节点编号，没有绑定、跨节点或者只有一个节点时返回-1
+ */
+int GetThreadNumaNode();
+
+/**
+ *  @brief 让[addr, addr + len)的物理页优先从编号为node的节点上分配
+ *  @param[in] addr 页对齐的地址
+ *  @param[in] move 是否迁移已经分配的物理页
+ */
+bool BindMemoryToNode(void* addr, size_t len, int node, bool move = false);
+
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar
+{
+
+/**
+ *  @brief 只能移动的 void() 可调用对象
+ *  @details 用于调度任务、定时器和IO事件回调，替代 std::function<void()>：
+ *           不要求可调用对象可拷贝，不超过 kInlineSize 字节且移动构造不抛异常的对象直接存放在内部缓冲区，
+ *           不需要堆分配；更大的对象才会在堆上分配一次，之后在各个队列之间传递都只是移动
+ */
+class Callback
+{
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    /**
+     *  @brief 构造空的回调
+     */
+    Callback() noexcept {}
+
+    Callback(std::nullptr_t) noexcept {}
+
+    /**
+     *  @brief 从任意 void() 可调用对象构造，空的函数指针和空的 std::function 得到空的回调
+     */
+    template<typename F, typename D = std::decay_t<F>,
+             typename = std::enable_if_t<!std::is_same_v<D, Callback> && std::is_invocable_v<D&>>>
+    Callback(F&& f)
+    {
+        if (IsNull(f))
+        {
+            return;
+        }
+        if constexpr (IsInline<D>())
+        {
+            ::new ((void*)m_buf) D(std::forward<F>(f));
+            m_ops = &InlineOps<D>::value;
+        }
+        else
+        {
+            *reinterpret_cast<D**>(m_buf) = new D(std::forward<F>(f));
+            m_ops = &HeapOps<D>::value;
+        }
+    }
+
+    Callback(Callback&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    Callback& operator=(Callback&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Callback& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    Callback(const Callback&) = delete;
+    Callback& operator=(const Callback&) = delete;
+
+    ~Callback()
+    {
+        reset();
+    }
+
+    /**
+     *  @brief 执行回调，回调不能为空
+     */
+    void operator()()
+    {
+        m_ops->invoke(m_buf);
+    }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    bool operator==(std::nullptr_t) const noexcept { return m_ops == nullptr; }
+
+    /**
+     *  @brief 交换两个回调
+     */
+    void swap(Callback& other) noexcept
+    {
+        Callback tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /**
+     *  @brief 获取内部保存的 T 类型对象，类型不符时返回nullptr
+     */
+    template<typename T>
+    T* target() noexcept
+    {
+        if (m_ops == &InlineOps<T>::value)
+        {
+            return reinterpret_cast<T*>(m_buf);
+        }
+        if (m_ops == &HeapOps<T>::value)
+        {
+            return *reinterpret_cast<T**>(m_buf);
+        }
+        return nullptr;
+    }
+
+private:
+    /**
+     *  @brief 类型擦除后的操作表，每种可调用对象类型一份
+     */
+    struct Ops
+    {
+        void (*invoke)(void* buf);
+        void (*move)(void* dst, void* src);     // 移动构造到dst并析构src
+        void (*destroy)(void* buf);
+    };
+
+    template<typename D>
+    static constexpr bool IsInline()
+    {
+        return sizeof(D) <= kInlineSize && alignof(D) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<D>;
+    }
+
+    template<typename D>
+    struct InlineOps
+    {
+        static void Invoke(void* buf) { (*reinterpret_cast<D*>(buf))(); }
+        static void Move(void* dst, void* src)
+        {
+            D* s = reinterpret_cast<D*>(src);
+            ::new (dst) D(std::move(*s));
+            s->~D();
+        }
+        static void Destroy(void* buf) { reinterpret_cast<D*>(buf)->~D(); }
+        static constexpr Ops value = {&Invoke, &Move, &Destroy};
+    };
+
+    template<typename D>
+    struct HeapOps
+    {
+        static void Invoke(void* buf) { (**reinterpret_cast<D**>(buf))(); }
+        static void Move(void* dst, void* src) { *reinterpret_cast<D**>(dst) = *reinterpret_cast<D**>(src); }
+        static void Destroy(void* buf) { delete *reinterpret_cast<D**>(buf); }
+        static constexpr Ops value = {&Invoke, &Move, &Destroy};
+    };
+
+    template<typename F>
+    static bool IsNull(const F& f)
+    {
+        if constexpr (std::is_pointer_v<F> || std::is_member_pointer_v<F>)
+        {
+            return f == nullptr;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    template<typename Sig>
+    static bool IsNull(const std::function<Sig>& f)
+    {
+        return !f;
+    }
+
+    void moveFrom(Callback& other) noexcept
+    {
+        if (other.m_ops)
+        {
+            other.m_ops->move(m_buf, other.m_buf);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (m_ops)
+        {
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_buf[kInlineSize];
+    const Ops* m_ops = nullptr;
+};
+
+}
@@ -0,0 +1,516 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include "fiber_sync.h"
+#include "ring_queue.h"
+#include "util.h"
+#include "macro.h"
+
+namespace sylar
+{
+
+/**
+ *  @brief select 中的一个分支，屏蔽不同元素类型的通道
+ */
+class SelectCase
+{
+public:
+    using ptr = std::unique_ptr<SelectCase>;
+
+    virtual ~SelectCase() {}
+
+    /**
+     *  @brief 不等待地尝试收发，通道已经关闭也算完成
+     */
+    virtual bool tryOp() = 0;
+
+    /**
+     *  @brief 把节点挂到通道的等待队列上
+     *  @return 通道已经就绪时不挂，返回true
+     */
+    virtual bool enqueue(FiberWaitNode* node) = 0;
+
+    /**
+     *  @brief 把节点从通道的等待队列上摘下
+     *  @return 节点已经被通知方摘下返回true
+     */
+    virtual bool dequeue(FiberWaitNode* node) = 0;
+
+    /**
+     *  @brief 通道仍然就绪时，把收到的通知转交给同一队列上的下一个等待者
+     */
+    virtual void forward() = 0;
+};
+
+/**
+ *  @brief 协程之间传递数据的通道
+ *  @details 发送方在通道满时、接收方在通道空时挂起协程，由对方唤醒后重试。
+ *           关闭之后不能再发送，接收方仍然可以取完缓冲区中剩下的数据。
+ *           有界通道可以声明为单生产者单消费者(spsc)，缓冲区换成无锁环形队列，
+ *           收发不需要对方等待时不加锁；此时只能有一个协程发送、一个协程接收
+ */
+template<class T>
+class Channel : Noncopyable
+{
+    friend class Select;
+public:
+    using ptr = std::shared_ptr<Channel>;
+
+    static constexpr size_t kUnbounded = ~(size_t)0;
+
+    /**
+     *  @brief 构造函数
+     *  @param[in] capacity 缓冲区容量，至少为1，kUnbounded表示无界
+     *  @param[in] spsc 是否单生产者单消费者，无界通道忽略该参数
+     */
+    explicit Channel(size_t capacity = kUnbounded, bool spsc = false)
+        : m_capacity(capacity)
+        , m_spsc(spsc && capacity != kUnbounded)
+    {
+        SYLAR_ASSERT2(capacity > 0, "channel capacity must be positive");
+        if (m_spsc)
+        {
+            size_t size = 1;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            m_ring.reset(new Slot[size]);
+            m_mask = size - 1;
+        }
+    }
+
+    ~Channel()
+    {
+        if (m_spsc)
+        {
+            for (size_t i = m_head; i != m_tail; ++i)
+            {
+                m_ring[i & m_mask].get()->~T();
+            }
+        }
+    }
+
+    /**
+     *  @brief 发送，通道满时等待
+     *  @return 通道已经关闭返回false，此时v不会被移走
+     */
+    template<class U>
+    bool send(U&& v)
+    {
+        return sendFor(std::forward<U>(v), ~0ull);
+    }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒发送
+     *  @return 通道关闭或者超时返回false
+     */
+    template<class U>
+    bool sendFor(U&& v, uint64_t timeout_ms)
+    {
+        return waitFor(false, timeout_ms, [this, &v](bool& closed) {
+            return tryPush(std::forward<U>(v), closed);
+        });
+    }
+
+    /**
+     *  @brief 不等待地发送，通道满或者已经关闭返回false
+     */
+    template<class U>
+    bool trySend(U&& v)
+    {
+        bool closed = false;
+        return tryPush(std::forward<U>(v), closed);
+    }
+
+    /**
+     *  @brief 接收，通道空时等待
+     *  @return 通道已经关闭并且取空了返回false
+     */
+    bool recv(T& v)
+    {
+        return recvFor(v, ~0ull);
+    }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒接收
+     *  @return 通道关闭并且取空了或者超时返回false
+     */
+    bool recvFor(T& v, uint64_t timeout_ms)
+    {
+        return waitFor(true, timeout_ms, [this, &v](bool& closed) {
+            return tryPop(v, closed);
+        });
+    }
+
+    /**
+     *  @brief 不等待地接收，通道空返回false
+     */
+    bool tryRecv(T& v)
+    {
+        bool closed = false;
+        return tryPop(v, closed);
+    }
+
+    /**
+     *  @brief 关闭通道，唤醒所有等待的发送方和接收方
+     */
+    void close()
+    {
+        Mutex::Lock lock(m_mutex);
+        m_closed = true;
+        notifyWaiters(true, true);
+        notifyWaiters(false, true);
+    }
+
+    bool isClosed() const { return m_closed; }
+
+    /**
+     *  @brief 缓冲区中的元素个数
+     */
+    size_t size()
+    {
+        if (m_spsc)
+        {
+            return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+        }
+        Mutex::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    /**
+     *  @brief 无锁环形队列的槽位，元素在入队时才构造
+     */
+    struct Slot
+    {
+        alignas(T) unsigned char buf[sizeof(T)];
+        T* get() { return reinterpret_cast<T*>(buf); }
+    };
+
+    template<class U>
+    bool tryPush(U&& v, bool& closed)
+    {
+        if (m_closed)
+        {
+            closed = true;
+            return false;
+        }
+        if (m_spsc)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) >= m_capacity)
+            {
+                return false;
+            }
+            ::new (m_ring[tail & m_mask].buf) T(std::forward<U>(v));
+            // 用读改写代替单独的屏障，和接收方登记等待之后再检查队列的顺序配对，两边至少有一方能看到对方
+            m_tail.fetch_add(1, std::memory_order_seq_cst);
+            if (m_recvWaiting.load(std::memory_order_seq_cst))
+            {
+                Mutex::Lock lock(m_mutex);
+                notifyWaiters(true);
+            }
+            return true;
+        }
+
+        Mutex::Lock lock(m_mutex);
+        if (m_closed)
+        {
+            closed = true;
+            return false;
+        }
+        if (m_queue.size() >= m_capacity)
+        {
+            return false;
+        }
+        m_queue.push_back(T(std::forward<U>(v)));
+        notifyWaiters(true);
+        return true;
+    }
+
+    bool tryPop(T& v, bool& closed)
+    {
+        if (m_spsc)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+            {
+                // 关闭之前发送的数据一定能看到
+                if (!m_closed || head == m_tail.load(std::memory_order_acquire))
+                {
+                    closed = m_closed;
+                    return false;
+                }
+            }
+            T* p = m_ring[head & m_mask].get();
+            v = std::move(*p);
+            p->~T();
+            m_head.fetch_add(1, std::memory_order_seq_cst);
+            if (m_sendWaiting.load(std::memory_order_seq_cst))
+            {
+                Mutex::Lock lock(m_mutex);
+                notifyWaiters(false);
+            }
+            return true;
+        }
+
+        Mutex::Lock lock(m_mutex);
+        if (m_queue.empty())
+        {
+            closed = m_closed;
+            return false;
+        }
+        v = std::move(m_queue[0]);
+        m_queue.pop_front();
+        notifyWaiters(false);
+        return true;
+    }
+
+    /**
+     *  @brief 接收方是否可以不等待地完成
+     */
+    bool recvReady()
+    {
+        if (m_spsc)
+        {
+            return m_head.load() != m_tail.load() || m_closed;
+        }
+        return !m_queue.empty() || m_closed;
+    }
+
+    /**
+     *  @brief 发送方是否可以不等待地完成
+     */
+    bool sendReady()
+    {
+        if (m_spsc)
+        {
+            return m_tail.load() - m_head.load() < m_capacity || m_closed;
+        }
+        return m_queue.size() < m_capacity || m_closed;
+    }
+
+    /**
+     *  @brief 唤醒接收方或者发送方，调用者持有 m_mutex
+     *  @details 等待标记只在队列中还有等待者时为true，被唤醒、还没来得及取消登记的等待者不算，
+     *           否则spsc的对方在这段时间内每次收发都要加锁
+     */
+    void notifyWaiters(bool recv, bool all = false)
+    {
+        FiberWaitQueue& q = recv ? m_recvq : m_sendq;
+        if (q.empty())
+        {
+            return;
+        }
+        while (q.notifyOne() && all);
+        (recv ? m_recvWaiting : m_sendWaiting) = !q.empty();
+    }
+
+    /**
+     *  @brief 登记等待，登记之后再检查一次是否就绪，避免错过对方的通知
+     */
+    bool enqueueWaiter(FiberWaitNode* node, bool recv)
+    {
+        Mutex::Lock lock(m_mutex);
+        FiberWaitQueue& q = recv ? m_recvq : m_sendq;
+        std::atomic<bool>& waiting = recv ? m_recvWaiting : m_sendWaiting;
+        q.push(node);
+        waiting = true;
+        if (recv ? recvReady() : sendReady())
+        {
+            q.remove(node);
+            waiting = !q.empty();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     *  @brief 取消登记
+     *  @return 节点已经被通知方摘下返回true
+     */
+    bool dequeueWaiter(FiberWaitNode* node, bool recv)
+    {
+        Mutex::Lock lock(m_mutex);
+        FiberWaitQueue& q = recv ? m_recvq : m_sendq;
+        bool removed = q.remove(node);
+        (recv ? m_recvWaiting : m_sendWaiting) = !q.empty();
+        return !removed;
+    }
+
+    /**
+     *  @brief 通道仍然就绪时唤醒下一个等待者
+     */
+    void forward(bool recv)
+    {
+        Mutex::Lock lock(m_mutex);
+        if (recv ? recvReady() : sendReady())
+        {
+            notifyWaiters(recv);
+        }
+    }
+
+    /**
+     *  @brief 反复尝试op，不能完成时挂起等待对方唤醒
+     */
+    template<class Op>
+    bool waitFor(bool recv, uint64_t timeout_ms, Op op)
+    {
+        uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+        while (true)
+        {
+            bool closed = false;
+            if (op(closed))
+            {
+                return true;
+            }
+            if (closed)
+            {
+                return false;
+            }
+            uint64_t now = deadline == ~0ull ? 0 : GetCurrentMS();
+            if (now >= deadline)
+            {
+                return false;
+            }
+            FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+            if (enqueueWaiter(w->node(), recv))
+            {
+                continue;
+            }
+            bool notified = w->park(deadline == ~0ull ? ~0ull : deadline - now);
+            dequeueWaiter(w->node(), recv);
+            if (!notified)
+            {
+                return op(closed);
+            }
+        }
+    }
+
+    template<class U>
+    class SendCase : public SelectCase
+    {
+    public:
+        SendCase(Channel& ch, U&& v, bool* ok)
+            : m_ch(ch), m_value(std::forward<U>(v)), m_ok(ok) {}
+
+        bool tryOp() override
+        {
+            bool closed = false;
+            bool rt = m_ch.tryPush(std::move(m_value), closed);
+            if (m_ok)
+            {
+                *m_ok = rt;
+            }
+            return rt || closed;
+        }
+        bool enqueue(FiberWaitNode* node) override { return m_ch.enqueueWaiter(node, false); }
+        bool dequeue(FiberWaitNode* node) override { return m_ch.dequeueWaiter(node, false); }
+        void forward() override { m_ch.forward(false); }
+
+    private:
+        Channel& m_ch;
+        T m_value;
+        bool* m_ok;
+    };
+
+    class RecvCase : public SelectCase
+    {
+    public:
+        RecvCase(Channel& ch, T& out, bool* ok)
+            : m_ch(ch), m_out(out), m_ok(ok) {}
+
+        bool tryOp() override
+        {
+            bool closed = false;
+            bool rt = m_ch.tryPop(m_out, closed);
+            if (m_ok)
+            {
+                *m_ok = rt;
+            }
+            return rt || closed;
+        }
+        bool enqueue(FiberWaitNode* node) override { return m_ch.enqueueWaiter(node, true); }
+        bool dequeue(FiberWaitNode* node) override { return m_ch.dequeueWaiter(node, true); }
+        void forward() override { m_ch.forward(true); }
+
+    private:
+        Channel& m_ch;
+        T& m_out;
+        bool* m_ok;
+    };
+
+private:
+    size_t m_capacity;                          // 缓冲区容量
+    bool m_spsc;                                // 是否单生产者单消费者
+    std::atomic<bool> m_closed = {false};       // 是否已经关闭
+    Mutex m_mutex;                              // 保护缓冲区(非spsc)和等待队列
+    RingQueue<T> m_queue;                       // 缓冲区(非spsc)
+    std::unique_ptr<Slot[]> m_ring;             // 无锁环形队列(spsc)
+    size_t m_mask = 0;                          // 环形队列下标掩码
+    alignas(64) std::atomic<size_t> m_head = {0};   // 接收方的位置(spsc)
+    alignas(64) std::atomic<size_t> m_tail = {0};   // 发送方的位置(spsc)
+    alignas(64) std::atomic<bool> m_recvWaiting = {false};  // 是否有接收方在等待
+    std::atomic<bool> m_sendWaiting = {false};  // 是否有发送方在等待
+    FiberWaitQueue m_recvq;                     // 等待数据的接收方
+    FiberWaitQueue m_sendq;                     // 等待空位的发送方
+};
+
+/**
+ *  @brief 同时等待多个通道的收发，完成其中一个
+ *  @details 用法：
+ *           Select sel;
+ *           sel.recv(ch1, a).recv(ch2, b, &ok).send(ch3, x);
+ *           int idx = sel.wait();
+ *           每次从不同的分支开始检查，避免排在前面的通道一直优先。
+ *           通道关闭也会让对应的分支完成，此时ok为false
+ */
+class Select : Noncopyable
+{
+public:
+    /**
+     *  @brief 添加接收分支
+     *  @param[out] out 接收到的数据
+     *  @param[out] ok 是否真的收到了数据，通道关闭时为false
+     */
+    template<class T>
+    Select& recv(Channel<T>& ch, T& out, bool* ok = nullptr)
+    {
+        m_cases.emplace_back(new typename Channel<T>::RecvCase(ch, out, ok));
+        return *this;
+    }
+
+    /**
+     *  @brief 添加发送分支，值保存在分支中，只有发送成功时才被移走
+     *  @param[out] ok 是否真的发送了，通道关闭时为false
+     */
+    template<class T, class U>
+    Select& send(Channel<T>& ch, U&& v, bool* ok = nullptr)
+    {
+        m_cases.emplace_back(new typename Channel<T>::template SendCase<U>(ch, std::forward<U>(v), ok));
+        return *this;
+    }
+
+    /**
+     *  @brief 等待任意一个分支完成
+     *  @param[in] timeout_ms 超时时间，0表示不等待，~0ull表示不超时
+     *  @return 完成的分支下标，按添加的顺序从0开始；超时返回-1
+     */
+    int wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     *  @brief 不等待，没有分支能完成时返回-1
+     */
+    int tryWait() { return wait(0); }
+
+private:
+    std::vector<SelectCase::ptr> m_cases;       // 各个分支
+};
+
+}
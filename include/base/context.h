@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <ucontext.h>
+
+/**
+ *  @brief 协程上下文切换
+ *  @details 定义 SYLAR_ASM_CONTEXT 时(由 CMake 在 x86_64/aarch64 上开启)使用手写汇编实现，
+ *           只保存被调用者保存寄存器和栈指针，不像 swapcontext 那样每次切换都要通过
+ *           rt_sigprocmask 系统调用保存/恢复信号掩码；其余平台回退到 ucontext
+ */
+
+#ifdef SYLAR_ASM_CONTEXT
+extern "C"
+{
+/**
+ *  @brief 保存当前寄存器到当前栈上，把栈指针写入 *from_sp，然后切换到 to_sp 所指的栈
+ */
+void sylar_asm_swap_context(void** from_sp, void* to_sp);
+}
+#endif
+
+namespace sylar
+{
+
+#ifdef SYLAR_ASM_CONTEXT
+/**
+ *  @brief 协程上下文，汇编实现下只需要保存栈指针
+ */
+struct Context
+{
+    void* sp = nullptr;
+};
+#else
+/**
+ *  @brief 协程上下文，ucontext实现
+ */
+struct Context
+{
+    ucontext_t uc;
+};
+#endif
+
+/**
+ *  @brief 初始化上下文，使其在第一次被切换到时在 stack 上执行 fn
+ *  @param[out] ctx 上下文
+ *  @param[in] stack 栈的低地址
+ *  @param[in] size 栈大小
+ *  @param[in] fn 入口函数，不允许返回
+ */
+void MakeContext(Context* ctx, void* stack, size_t size, void (*fn)());
+
+/**
+ *  @brief 保存当前上下文到 from，并切换到 to
+ */
+inline void SwapContext(Context* from, Context* to)
+{
+#ifdef SYLAR_ASM_CONTEXT
+    sylar_asm_swap_context(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+/**
+ *  @brief 返回当前使用的上下文切换后端名称
+ */
+const char* ContextBackendName();
+
+}
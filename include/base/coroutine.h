@@ -0,0 +1,375 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "future.h"
+#include "iomanager.h"
+#include "scheduler.h"
+
+/**
+ *  @brief C++20 无栈协程
+ *  @details Task<T> 是惰性启动的无栈协程，挂起时只保留堆上的协程帧，不占用协程栈。
+ *           co_spawn 把它交给调度器执行，之后每次恢复都是调度器的一个普通回调任务，在调度线程缓存的协程上运行，
+ *           挂起后那个协程立刻被复用，所以大量同时挂起的 Task 不需要各自的栈。
+ *           Task 里可以 co_await 另一个 Task，也可以 co_await 下面的 ScheduleOn / SleepFor / WaitEvent，
+ *           以及 AsyncRead / AsyncWrite / AsyncAccept / AsyncConnect；同时仍然可以调用被hook的阻塞接口，
+ *           那会挂起承载它的有栈协程，和普通任务一样
+ */
+
+namespace sylar
+{
+
+template<class T>
+class Task;
+
+/**
+ *  @brief Task 的 promise 中与结果类型无关的部分
+ */
+class TaskPromiseBase
+{
+public:
+    /**
+     *  @brief 结束时如果等待者已经挂起，把执行权交给等待者；否则回到等待者的 await_suspend，由它直接继续执行
+     */
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            TaskPromiseBase& promise = h.promise();
+            if (promise.m_continuation && promise.m_ready.exchange(true, std::memory_order_acq_rel))
+            {
+                return promise.m_continuation;
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { m_error = std::current_exception(); }
+
+    /**
+     *  @brief 以h为等待者启动协程
+     *  @return h是否需要挂起，协程同步执行完时返回false，h直接继续执行
+     *  @details 协程同步完成时不经过恢复等待者的调用，一个循环里连续 co_await 大量同步完成的 Task 也不会增长调用栈，
+     *           这不依赖编译器把对称转移优化成尾调用
+     */
+    bool start(std::coroutine_handle<> self, std::coroutine_handle<> h)
+    {
+        m_continuation = h;
+        self.resume();
+        return !m_ready.exchange(true, std::memory_order_acq_rel);
+    }
+
+protected:
+    void rethrowIfFailed()
+    {
+        if (m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+protected:
+    std::coroutine_handle<> m_continuation;     // co_await 这个 Task 的协程
+    std::atomic<bool> m_ready = {false};        // 等待者和结束的协程谁后到达谁负责继续执行等待者
+    std::exception_ptr m_error;                 // 协程体抛出的异常
+};
+
+template<class T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<class U>
+    void return_value(U&& value)
+    {
+        m_value.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        rethrowIfFailed();
+        return std::move(*m_value);
+    }
+
+private:
+    std::optional<T> m_value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result()
+    {
+        rethrowIfFailed();
+    }
+};
+
+/**
+ *  @brief 惰性启动的无栈协程，只能移动
+ *  @details 被 co_await 时才开始执行，结束后把结果交给等待者；异常在 co_await 处重新抛出。
+ *           析构时销毁协程帧，所以 Task 必须活到协程结束，通常直接 co_await 一个临时的 Task，
+ *           或者用 co_spawn 交给调度器
+ */
+template<class T = void>
+class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() noexcept = default;
+
+    explicit Task(handle_type h) noexcept
+        : m_handle(h)
+    {
+    }
+
+    Task(Task&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    bool valid() const { return (bool)m_handle; }
+    bool done() const { return m_handle && m_handle.done(); }
+
+    struct Awaiter
+    {
+        handle_type handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+
+        bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            return handle.promise().start(handle, awaiting);
+        }
+
+        T await_resume()
+        {
+            return handle.promise().result();
+        }
+    };
+
+    /**
+     *  @brief 启动并等待这个 Task
+     */
+    Awaiter operator co_await() && noexcept { return Awaiter{m_handle}; }
+    Awaiter operator co_await() & noexcept { return Awaiter{m_handle}; }
+
+private:
+    void destroy()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+private:
+    handle_type m_handle;
+};
+
+template<class T>
+Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ *  @brief 交给调度器后自己管理生命周期的协程，结束时自动销毁协程帧
+ */
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() noexcept
+        {
+            return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ *  @brief 执行task，把结果或者异常交给promise
+ */
+template<class T>
+DetachedTask RunDetached(Task<T> task, Promise<T> promise)
+{
+    try
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            co_await std::move(task);
+            promise.setValue();
+        }
+        else
+        {
+            promise.setValue(co_await std::move(task));
+        }
+    }
+    catch (...)
+    {
+        promise.setException(std::current_exception());
+    }
+}
+
+/**
+ *  @brief 在调度器上执行task
+ *  @return task的结果，task抛出的异常在 Future::get() 中重新抛出
+ */
+template<class T>
+Future<T> co_spawn(Scheduler* sc, Task<T> task, Scheduler::Priority prio = Scheduler::NORMAL)
+{
+    Promise<T> promise;
+    Future<T> future = promise.getFuture();
+    std::coroutine_handle<> h = RunDetached(std::move(task), std::move(promise)).handle;
+    sc->schedule([h]() { h.resume(); }, prio);
+    return future;
+}
+
+/**
+ *  @brief 挂起当前协程，作为sc上的一个新任务恢复
+ *  @details sc是当前调度器时相当于让出执行权，排在已经就绪的任务后面；也可以用来切换到另一个调度器
+ */
+class ScheduleOn
+{
+public:
+    explicit ScheduleOn(Scheduler* sc, Scheduler::Priority prio = Scheduler::NORMAL)
+        : m_scheduler(sc)
+        , m_priority(prio)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+
+private:
+    Scheduler* m_scheduler;
+    Scheduler::Priority m_priority;
+};
+
+/**
+ *  @brief 挂起当前协程ms毫秒，使用当前IOManager的定时器
+ */
+class SleepFor
+{
+public:
+    explicit SleepFor(uint64_t ms)
+        : m_ms(ms)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+
+private:
+    uint64_t m_ms;
+};
+
+/**
+ *  @brief 挂起当前协程直到fd上的事件就绪，使用当前IOManager
+ *  @details co_await 的结果为0表示就绪；-1表示失败，errno为ETIMEDOUT(超时)或者注册事件失败的原因。
+ *           事件是一次性的，就绪后需要重新等待
+ */
+class WaitEvent
+{
+public:
+    WaitEvent(int fd, IOManager::Event event, uint64_t timeout_ms = ~0ull);
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h);
+    int await_resume();
+
+private:
+    /**
+     *  @brief 超时定时器和等待者共享的状态，定时器只持有弱引用
+     */
+    struct State
+    {
+        int cancelled = 0;
+    };
+
+    int m_fd;
+    IOManager::Event m_event;
+    uint64_t m_timeoutMs;
+    int m_error = 0;                    // 注册事件失败时的errno
+    std::shared_ptr<State> m_state;
+    Timer::ptr m_timer;
+};
+
+/**
+ *  @brief 从socket读取，数据未就绪时挂起当前协程而不是线程
+ *  @return 同 recv，超时返回-1且errno为ETIMEDOUT
+ */
+Task<ssize_t> AsyncRead(int fd, void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+
+/**
+ *  @brief 向socket写入，发送缓冲区满时挂起当前协程
+ *  @return 同 send，不会产生SIGPIPE
+ */
+Task<ssize_t> AsyncWrite(int fd, const void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+
+/**
+ *  @brief 接受连接，没有连接时挂起当前协程
+ *  @return 新连接的fd，已经设为非阻塞并登记到 FdMgr；失败返回-1
+ */
+Task<int> AsyncAccept(int fd, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr, uint64_t timeout_ms = ~0ull);
+
+/**
+ *  @brief 发起连接，连接建立之前挂起当前协程
+ *  @return 成功返回0，失败返回-1，errno为连接失败的原因
+ */
+Task<int> AsyncConnect(int fd, const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms = ~0ull);
+
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <memory>
 #include <vector>
 #include "thread.h"
@@ -7,6 +8,8 @@
 namespace sylar
 {
 
+class IOManager;
+
 /**
  *  @brief 文件句柄上下文类
  *  @details 管理文件句柄的类型 |---> 是否socket、是否阻塞、是否关闭、读写超时时间 
@@ -75,6 +78,17 @@ public:
      * @return 超时时间毫秒
      */
     uint64_t getTimeout(int type);
+
+    /**
+     *  @brief 获取fd持久注册到的IOManager，见 IOManager::armEvents
+     *  @details FdCtx随fd的创建而重建，fd号复用时新句柄总是从未注册开始
+     */
+    IOManager* getArmedIn() const { return m_armedIn.load(std::memory_order_relaxed); }
+
+    /**
+     *  @brief 设置fd持久注册到的IOManager
+     */
+    void setArmedIn(IOManager* v) { m_armedIn.store(v, std::memory_order_relaxed); }
 private: 
     /**
      *  @brief 初始化 
@@ -90,6 +104,7 @@ private:
     int m_fd;                   // 文件句柄
     uint64_t m_recvTimeout;     // 读超时时间毫秒
     uint64_t m_sendTimeout;     // 写超时时间毫秒 
+    std::atomic<IOManager*> m_armedIn = {nullptr};  // 持久注册到的IOManager
 };
 
 
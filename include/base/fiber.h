@@ -1,16 +1,29 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
-#include <ucontext.h>
+#include <vector>
+#include "callback.h"
+#include "context.h"
+#include "intrusive_ptr.h"
 #include "thread.h"
 
 namespace sylar
 {
-class Fiber : public std::enable_shared_from_this<Fiber>
+
+class StackAllocator;
+struct SharedStack;
+
+/**
+ *  @brief 协程
+ *  @details 引用计数在协程对象内部，Fiber::ptr 是侵入式指针。调度队列、IO事件和定时器这些要跨越调度保存协程的地方
+ *           持有 Fiber::ptr；恢复和让出只借用裸指针，见 GetThisRaw()
+ */
+class Fiber : public RefCounted
 {
 public:
-    using ptr = std::shared_ptr<Fiber>;
+    using ptr = IntrusivePtr<Fiber>;
 
     /**
      *  @brief 协程的状态（用于切换时来表示） 
@@ -35,8 +48,9 @@ public:
     /**
      *  @brief 有参构造函数
      *  @details 该构造函数主要用于创建子协程，该协程为线程的主协程的子协程
+     *  @param[in] shared_stack 是否使用共享栈模式，此时stacksize被忽略
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    Fiber(Callback cb, size_t stacksize = 0, bool run_in_scheduler = true, bool shared_stack = false);
 
     /**
      *  @brief 析构函数 
@@ -46,7 +60,7 @@ public:
     /**
      *  @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈 
      */
-    void reset(std::function<void()>);
+    void reset(Callback cb);
 
     /**
      *  @brief 将当前协程切到执行状态
@@ -57,6 +71,7 @@ public:
     /**
      *  @brief 当前协程让出执行权
      *  @details 当前协程与上次resume时退到后台的协程进行交换，前者状态变为READY，后者状态变为RUNNING
+     *           状态在切换完成后才由resume的一方改为READY，在此之前其他线程看到的仍是RUNNING，不会提前恢复它
      */
     void yield();
 
@@ -71,6 +86,44 @@ public:
      */
     uint64_t getState() const { return m_state; }
 
+    /**
+     *  @brief 是否参与调度器调度，即yield之后回到调度协程
+     */
+    bool isRunInScheduler() const { return m_runInScheduler; }
+
+    /**
+     *  @brief 是否运行在共享栈上
+     *  @details 共享栈协程运行在创建线程的若干个共享运行栈之一上，切出时不拷贝，
+     *           直到同一运行栈上的另一个协程要运行时，才把栈的活跃部分拷贝到按需分配的保存缓冲区。
+     *           因此共享栈协程只能在创建它的线程上恢复执行，也不能把栈上变量的地址交给其他协程使用
+     */
+    bool isSharedStack() const { return m_sharedStack != nullptr; }
+
+    /**
+     *  @brief 共享栈协程所属的线程id，非共享栈协程返回-1
+     */
+    pid_t getOwnerThread() const { return m_ownerThread; }
+
+    /**
+     *  @brief 取协程局部存储槽位上的值，没有设置过返回nullptr
+     *  @details 只能由协程自己访问，见 FiberLocal
+     */
+    void* getLocal(size_t slot) const
+    {
+        return slot < m_locals.size() ? m_locals[slot].value : nullptr;
+    }
+
+    /**
+     *  @brief 设置协程局部存储槽位上的值，原来的值用它自己的destroy析构
+     *  @param[in] destroy 协程结束、被reset或析构时用来析构value
+     */
+    void setLocal(size_t slot, void* value, void (*destroy)(void*));
+
+    /**
+     *  @brief 析构所有协程局部存储的值，槽位数组保留给复用的协程
+     */
+    void clearLocals();
+
     /**
      *  @brief 设置当前正在执行的协程，即设置线程局部变量 t_fiber 
      */
@@ -83,6 +136,13 @@ public:
      *  @attention 线程如果要创建协程，那么应该首先执行一下Fiber::GetThis()操作，以初始化主函数协程
      */
     static Fiber::ptr GetThis();
+
+    /**
+     *  @brief 借用正在执行的协程，不增加引用计数
+     *  @details 与 GetThis() 一样在需要时创建线程的主协程。协程运行期间它的入口函数一直持有自己，
+     *           所以在协程内部让出、比较或者读取状态时借用即可；要保存到别处时再用 Fiber::ptr(GetThisRaw()) 持有
+     */
+    static Fiber* GetThisRaw();
     
     /**
      *  @brief 获得总的协程数 
@@ -99,14 +159,53 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     *  @brief 获得所有共享栈协程保存缓冲区的总字节数 
+     */
+    static uint64_t GetSharedStackSaveBytes();
+
+    /**
+     *  @brief 分配一个新的协程局部存储槽位，槽位不回收
+     */
+    static size_t AllocLocalSlot();
+
+private:
+    /**
+     *  @brief 共享栈协程切入前的准备：保存运行栈上原占用者的栈，再恢复自己的栈
+     */
+    void switchInSharedStack();
+
+    /**
+     *  @brief 把共享栈上的活跃部分拷贝到保存缓冲区 
+     */
+    void saveSharedStack();
+
 private:
     uint64_t m_id = 0;                  //  协程id
     uint64_t m_stacksize = 0;           //  协程栈的大小
-    ucontext_t m_ctx;                   //  协程栈
+    Context m_ctx;                      //  协程上下文
     void* m_stack = nullptr;            //  协程栈地址  
-    std::function<void()> m_cb;         //  协程入口函数
-    State m_state = READY;              //  协程的状态
-    bool m_runInScheduler;              // 本协程是否参与调度器调度
+    StackAllocator* m_allocator = nullptr;  //  分配协程栈的分配器
+    Callback m_cb;                      //  协程入口函数
+    std::atomic<State> m_state = {READY};   //  协程的状态，其他调度线程会读取它来判断协程是否已经切换出去
+    bool m_runInScheduler = false;      // 本协程是否参与调度器调度
+    std::shared_ptr<SharedStack> m_sharedStack; // 共享运行栈，非共享栈模式为空
+    char* m_saveBuf = nullptr;          // 共享栈模式下的栈保存缓冲区
+    size_t m_saveSize = 0;              // 保存缓冲区中有效的字节数
+    size_t m_saveCap = 0;               // 保存缓冲区的容量
+    void* m_sharedSp = nullptr;         // 切出时的栈顶，用于计算需要保存的范围
+    bool m_needMake = false;            // 共享栈协程的上下文需要在切入时才能初始化
+    pid_t m_ownerThread = -1;           // 共享栈协程所属的线程
+
+    /**
+     *  @brief 协程局部存储的一个槽位
+     */
+    struct LocalSlot
+    {
+        void* value = nullptr;
+        void (*destroy)(void*) = nullptr;
+    };
+    std::vector<LocalSlot> m_locals;    // 协程局部存储，按 FiberLocal 的槽位下标访问
 };
 
 } 
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <utility>
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace sylar
+{
+
+/**
+ *  @brief 协程局部存储
+ *  @details 每个 FiberLocal 对象在构造时分配一个槽位下标，值保存在当前协程内部的槽位数组中，
+ *           访问只是取当前协程再按下标取值。协程在调度线程之间迁移时值跟着协程走，这是 thread_local 做不到的。
+ *           值在协程结束、被 reset 复用或析构时析构；不在协程中访问时用的是线程主协程的槽位。
+ *           槽位不回收，FiberLocal 应当是全局或静态对象
+ *  @tparam T 值的类型，第一次通过 operator* / operator-> 访问时默认构造
+ */
+template<typename T>
+class FiberLocal : Noncopyable
+{
+public:
+    FiberLocal()
+        : m_slot(Fiber::AllocLocalSlot())
+    {
+    }
+
+    /**
+     *  @brief 当前协程的值，没有设置过返回nullptr
+     */
+    T* get() const
+    {
+        return static_cast<T*>(Fiber::GetThisRaw()->getLocal(m_slot));
+    }
+
+    /**
+     *  @brief 设置当前协程的值，替换并析构原来的值
+     */
+    T& set(T value)
+    {
+        T* p = new T(std::move(value));
+        Fiber::GetThisRaw()->setLocal(m_slot, p, &Destroy);
+        return *p;
+    }
+
+    /**
+     *  @brief 当前协程是否设置过值
+     */
+    bool has() const { return get() != nullptr; }
+
+    /**
+     *  @brief 析构当前协程的值
+     */
+    void reset()
+    {
+        Fiber::GetThisRaw()->setLocal(m_slot, nullptr, nullptr);
+    }
+
+    /**
+     *  @brief 当前协程的值，没有设置过时默认构造一个
+     */
+    T& operator*()
+    {
+        T* p = get();
+        return p ? *p : set(T());
+    }
+
+    T* operator->() { return &**this; }
+
+    /**
+     *  @brief 槽位下标
+     */
+    size_t getSlot() const { return m_slot; }
+
+private:
+    static void Destroy(void* p)
+    {
+        delete static_cast<T*>(p);
+    }
+
+private:
+    size_t m_slot;
+};
+
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "mutex.h"
+#include "fiber.h"
+#include "timer.h"
+
+namespace sylar
+{
+
+class Scheduler;
+class FiberWaiter;
+
+/**
+ *  @brief 等待队列中的节点
+ *  @details 一般嵌在等待者中；select 时一个等待者同时挂在多个队列上，每个队列各用一个节点
+ */
+struct FiberWaitNode
+{
+    FiberWaiter* waiter = nullptr;      // 节点所属的等待者
+    FiberWaitNode* prev = nullptr;      // 等待队列的前一个
+    FiberWaitNode* next = nullptr;      // 等待队列的后一个
+    bool linked = false;                // 是否在等待队列中
+};
+
+/**
+ *  @brief 协程同步原语的等待者
+ *  @details 在调度器的协程中等待时，记录当前协程和它的调度器，让出执行权；唤醒时把协程重新交给调度器。
+ *           不在协程中(比如普通线程、调度器的主协程)等待时退化为阻塞线程的信号量。
+ *           通知方和超时定时器通过 m_state 的CAS竞争唤醒权，只有一方能唤醒等待者
+ */
+class FiberWaiter : public std::enable_shared_from_this<FiberWaiter>
+{
+public:
+    using ptr = std::shared_ptr<FiberWaiter>;
+
+    /**
+     *  @brief 等待状态
+     */
+    enum State
+    {
+        WAITING,        // 等待中
+        NOTIFIED,       // 被通知方唤醒
+        TIMEOUT,        // 超时
+    };
+
+    /**
+     *  @brief 为当前执行流创建等待者
+     */
+    FiberWaiter();
+
+    /**
+     *  @brief 挂起当前执行流直到被通知或超时
+     *  @details 调用前等待者必须已经加入等待队列，并且释放了保护队列的锁
+     *  @param[in] timeout_ms 超时时间，~0ull表示不超时。协程中的超时依赖当前线程的IOManager定时器
+     *  @return 被通知返回true，超时返回false，此时调用者需要自己把等待者从队列中移除
+     */
+    bool park(uint64_t timeout_ms = ~0ull);
+
+    /**
+     *  @brief 唤醒等待者
+     *  @details 调用者已经把等待者从队列中摘下；等待者已经超时时返回false，调用者应该继续通知下一个
+     */
+    bool notify();
+
+    /**
+     *  @brief 等待者自己放弃等待
+     *  @details 挂到等待队列上之后，不挂起就要离开时使用。返回false说明已经被通知了，
+     *           通知方一定会把执行流交还回来，必须调用一次park()消耗掉这次唤醒
+     */
+    bool cancel();
+
+    /**
+     *  @brief 等待者是否是写者，只有读写锁使用
+     */
+    bool isWriter() const { return m_writer; }
+    void setWriter(bool v) { m_writer = v; }
+
+    /**
+     *  @brief 内嵌的等待队列节点
+     */
+    FiberWaitNode* node() { return &m_node; }
+
+private:
+    /**
+     *  @brief 把挂起的执行流交还给调度器或者释放信号量
+     */
+    void wakeup();
+
+private:
+    Fiber::ptr m_fiber;                     // 等待的协程，线程等待时为空
+    Scheduler* m_scheduler = nullptr;       // 协程所属的调度器
+    Semaphore m_sem;                        // 线程等待时使用
+    std::atomic<int> m_state = {WAITING};   // 等待状态
+    Timer::ptr m_timer;                     // 超时定时器
+    bool m_writer = false;                  // 是否是写者
+    FiberWaitNode m_node;                   // 内嵌的等待队列节点
+};
+
+/**
+ *  @brief 侵入式的等待队列，先进先出
+ *  @details 不是线程安全的，由同步原语内部的锁保护；队列中的等待者由挂起的一方持有
+ */
+class FiberWaitQueue
+{
+public:
+    bool empty() const { return m_head == nullptr; }
+    FiberWaitNode* front() const { return m_head; }
+
+    void push(FiberWaitNode* node);
+    void push(FiberWaiter* w) { push(w->node()); }
+
+    /**
+     *  @brief 移除节点
+     *  @return 节点不在队列中返回false
+     */
+    bool remove(FiberWaitNode* node);
+    bool remove(FiberWaiter* w) { return remove(w->node()); }
+
+    /**
+     *  @brief 取出队头并唤醒它，跳过已经超时的等待者
+     *  @return 唤醒了一个等待者返回true
+     */
+    bool notifyOne();
+
+private:
+    FiberWaitNode* m_head = nullptr;
+    FiberWaitNode* m_tail = nullptr;
+};
+
+/**
+ *  @brief 协程互斥量
+ *  @details 加锁失败时挂起的是协程而不是线程，调度线程可以继续执行其他协程。
+ *           解锁时锁的所有权直接交给队头的等待者，不会被后来者抢走
+ */
+class FiberMutex : Noncopyable
+{
+public:
+    using Lock = ScopeLockImpl<FiberMutex>;
+
+    /**
+     *  @brief 加锁
+     */
+    void lock() { lockFor(~0ull); }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒加锁
+     *  @return 超时返回false
+     */
+    bool lockFor(uint64_t timeout_ms);
+
+    /**
+     *  @brief 尝试加锁，不等待
+     */
+    bool tryLock();
+
+    /**
+     *  @brief 解锁
+     */
+    void unlock();
+
+private:
+    Mutex m_mutex;                  // 保护内部状态
+    bool m_locked = false;          // 是否被锁
+    FiberWaitQueue m_waiters;       // 等待加锁的队列
+};
+
+/**
+ *  @brief 协程读写锁
+ *  @details 写者优先：有写者在等待时新的读者也要排队，避免写者饿死。
+ *           写锁释放后唤醒队头的写者，或者队头连续的所有读者
+ */
+class FiberRWMutex : Noncopyable
+{
+public:
+    using ReadLock = ReadScopedLockImpl<FiberRWMutex>;
+    using WriteLock = WriteScopedLockImpl<FiberRWMutex>;
+
+    /**
+     *  @brief 加读锁
+     */
+    void rdlock() { rdlockFor(~0ull); }
+
+    /**
+     *  @brief 加写锁
+     */
+    void wrlock() { wrlockFor(~0ull); }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒加读锁，超时返回false
+     */
+    bool rdlockFor(uint64_t timeout_ms);
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒加写锁，超时返回false
+     */
+    bool wrlockFor(uint64_t timeout_ms);
+
+    /**
+     *  @brief 释放读锁或者写锁
+     */
+    void unlock();
+
+private:
+    /**
+     *  @brief 锁空闲时把它交给等待队列的队头
+     */
+    void grant();
+
+private:
+    Mutex m_mutex;                  // 保护内部状态
+    uint32_t m_readers = 0;         // 持有读锁的数量
+    uint32_t m_waitingWriters = 0;  // 排队的写者数量
+    bool m_writer = false;          // 是否有写者持有锁
+    FiberWaitQueue m_waiters;       // 读者和写者共用一个队列，保持先后顺序
+};
+
+/**
+ *  @brief 协程条件变量
+ *  @details 可以配合任何提供lock/unlock的锁使用，包括 FiberMutex::Lock 和 Mutex::Lock
+ */
+class FiberCondition : Noncopyable
+{
+public:
+    /**
+     *  @brief 释放锁并等待通知，返回前重新加锁
+     */
+    template<class L>
+    void wait(L& lock)
+    {
+        waitFor(lock, ~0ull);
+    }
+
+    /**
+     *  @brief 释放锁并等待通知，最多等待timeout_ms毫秒，返回前重新加锁
+     *  @return 超时返回false
+     */
+    template<class L>
+    bool waitFor(L& lock, uint64_t timeout_ms)
+    {
+        FiberWaiter::ptr w = enqueue();
+        lock.unlock();
+        bool rt = park(w, timeout_ms);
+        lock.lock();
+        return rt;
+    }
+
+    /**
+     *  @brief 唤醒一个等待者
+     */
+    void notify();
+
+    /**
+     *  @brief 唤醒所有等待者
+     */
+    void notifyAll();
+
+private:
+    /**
+     *  @brief 在释放用户锁之前加入等待队列，保证不会错过通知
+     */
+    FiberWaiter::ptr enqueue();
+
+    bool park(const FiberWaiter::ptr& w, uint64_t timeout_ms);
+
+private:
+    Mutex m_mutex;                  // 保护等待队列
+    FiberWaitQueue m_waiters;       // 等待队列
+};
+
+/**
+ *  @brief 协程信号量
+ *  @details 计数为0时挂起协程；释放时有等待者就直接把计数交给它
+ */
+class FiberSemaphore : Noncopyable
+{
+public:
+    FiberSemaphore(uint32_t count = 0);
+
+    /**
+     *  @brief 获取信号量
+     */
+    void wait() { waitFor(~0ull); }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒获取信号量，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    /**
+     *  @brief 尝试获取信号量，不等待
+     */
+    bool tryWait();
+
+    /**
+     *  @brief 释放n个信号量
+     */
+    void notify(uint32_t n = 1);
+
+    /**
+     *  @brief 当前的计数
+     */
+    uint32_t getCount();
+
+private:
+    Mutex m_mutex;                  // 保护内部状态
+    uint32_t m_count;               // 计数
+    FiberWaitQueue m_waiters;       // 等待队列
+};
+
+}
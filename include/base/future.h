@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "fiber_sync.h"
+#include "macro.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace sylar
+{
+
+/**
+ *  @brief Future 和 Promise 共享的结果
+ *  @details 等待结果时挂起的是协程，不在协程中时阻塞线程
+ */
+template<class T>
+class FutureState : Noncopyable
+{
+public:
+    using ptr = std::shared_ptr<FutureState>;
+    using Value = std::conditional_t<std::is_void_v<T>, char, T>;
+
+    /**
+     *  @brief 设置结果，只能设置一次
+     */
+    template<class... Args>
+    void setValue(Args&&... args)
+    {
+        Mutex::Lock lock(m_mutex);
+        SYLAR_ASSERT2(!m_ready, "future result already set");
+        m_value.emplace(std::forward<Args>(args)...);
+        m_ready = true;
+        m_cond.notifyAll();
+    }
+
+    /**
+     *  @brief 设置异常，get()时重新抛出
+     */
+    void setException(std::exception_ptr e)
+    {
+        Mutex::Lock lock(m_mutex);
+        SYLAR_ASSERT2(!m_ready, "future result already set");
+        m_error = e;
+        m_ready = true;
+        m_cond.notifyAll();
+    }
+
+    bool isReady()
+    {
+        Mutex::Lock lock(m_mutex);
+        return m_ready;
+    }
+
+    void wait()
+    {
+        Mutex::Lock lock(m_mutex);
+        while (!m_ready)
+        {
+            m_cond.wait(lock);
+        }
+    }
+
+    bool waitFor(uint64_t timeout_ms)
+    {
+        uint64_t deadline = GetCurrentMS() + timeout_ms;
+        Mutex::Lock lock(m_mutex);
+        while (!m_ready)
+        {
+            uint64_t now = GetCurrentMS();
+            if (now >= deadline)
+            {
+                return false;
+            }
+            m_cond.waitFor(lock, deadline - now);
+        }
+        return true;
+    }
+
+    /**
+     *  @brief 等待并取走结果，有异常时重新抛出
+     */
+    Value take()
+    {
+        wait();
+        if (m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+        return std::move(*m_value);
+    }
+
+private:
+    Mutex m_mutex;                      // 保护结果
+    FiberCondition m_cond;              // 等待结果的协程或线程
+    bool m_ready = false;               // 结果是否已经设置
+    std::optional<Value> m_value;       // 结果，void时不使用
+    std::exception_ptr m_error;         // 异常
+};
+
+/**
+ *  @brief 异步结果
+ *  @details get()只能调用一次，结果被移走
+ */
+template<class T>
+class Future
+{
+public:
+    Future() = default;
+    explicit Future(typename FutureState<T>::ptr state)
+        : m_state(std::move(state)) {}
+
+    /**
+     *  @brief 是否关联了结果
+     */
+    bool valid() const { return m_state != nullptr; }
+
+    /**
+     *  @brief 结果是否已经就绪
+     */
+    bool isReady() const { return m_state->isReady(); }
+
+    /**
+     *  @brief 等待结果就绪
+     */
+    void wait() const { m_state->wait(); }
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms) const { return m_state->waitFor(timeout_ms); }
+
+    /**
+     *  @brief 等待并取走结果，任务抛出的异常在这里重新抛出
+     */
+    T get()
+    {
+        typename FutureState<T>::ptr state = std::move(m_state);
+        if constexpr (std::is_void_v<T>)
+        {
+            state->take();
+        }
+        else
+        {
+            return state->take();
+        }
+    }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ *  @brief 设置异步结果的一方
+ *  @details 没有设置结果就析构时，Future 得到 std::runtime_error("broken promise")
+ */
+template<class T>
+class Promise
+{
+public:
+    Promise()
+        : m_state(std::make_shared<FutureState<T>>()) {}
+
+    Promise(Promise&& other) noexcept
+        : m_state(std::move(other.m_state)), m_set(other.m_set) {}
+
+    Promise& operator=(Promise&& other) noexcept
+    {
+        if (this != &other)
+        {
+            abandon();
+            m_state = std::move(other.m_state);
+            m_set = other.m_set;
+        }
+        return *this;
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    ~Promise()
+    {
+        abandon();
+    }
+
+    Future<T> getFuture() { return Future<T>(m_state); }
+
+    template<class... Args>
+    void setValue(Args&&... args)
+    {
+        m_set = true;
+        m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    void setException(std::exception_ptr e)
+    {
+        m_set = true;
+        m_state->setException(e);
+    }
+
+    /**
+     *  @brief 执行fn，把返回值或者抛出的异常设置为结果
+     */
+    template<class F>
+    void run(F& fn)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                fn();
+                setValue();
+            }
+            else
+            {
+                setValue(fn());
+            }
+        }
+        catch (...)
+        {
+            setException(std::current_exception());
+        }
+    }
+
+private:
+    void abandon()
+    {
+        if (m_state && !m_set)
+        {
+            m_state->setException(std::make_exception_ptr(std::runtime_error("broken promise")));
+        }
+    }
+
+private:
+    typename FutureState<T>::ptr m_state;
+    bool m_set = false;
+};
+
+/**
+ *  @brief 在调度器上异步执行fn
+ *  @return fn的结果，fn抛出的异常在 Future::get() 中重新抛出
+ */
+template<class F, class R = std::invoke_result_t<std::decay_t<F>&>>
+Future<R> async(Scheduler* sc, F&& fn)
+{
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    sc->schedule([promise = std::move(promise), fn = std::forward<F>(fn)]() mutable {
+        promise.run(fn);
+    });
+    return future;
+}
+
+/**
+ *  @brief 等待一组任务完成
+ *  @details add()登记任务数，每个任务完成时done()，wait()等到计数归零。等待时挂起协程
+ */
+class WaitGroup : Noncopyable
+{
+public:
+    explicit WaitGroup(int64_t count = 0);
+
+    /**
+     *  @brief 增加计数，需要在任务开始之前调用
+     */
+    void add(int64_t n = 1);
+
+    /**
+     *  @brief 一个任务完成
+     */
+    void done();
+
+    /**
+     *  @brief 等待计数归零
+     */
+    void wait();
+
+    /**
+     *  @brief 最多等待timeout_ms毫秒，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    int64_t getCount() const { return m_count; }
+
+private:
+    std::atomic<int64_t> m_count;       // 未完成的任务数
+    Mutex m_mutex;                      // 和条件变量配合
+    FiberCondition m_cond;              // 等待计数归零
+};
+
+/**
+ *  @brief 把[begin, end)切成若干块分给调度器的所有线程，调用者执行最后一块并等待其他块完成
+ *  @details 块数不超过max_chunks，每块至少grain个元素。一块抛出异常后，还没开始的块不再执行，
+ *           第一个异常在等待结束后重新抛出
+ *  @param[in] max_chunks 最多的块数，由调用者确定，块下标不会超过它
+ *  @param[in] chunk 每块执行 chunk(块下标, 块开始, 块结束)
+ *  @return 块数
+ */
+template<class Chunk>
+size_t parallel_chunks(Scheduler* sc, size_t begin, size_t end, size_t grain, size_t max_chunks, Chunk& chunk)
+{
+    if (begin >= end)
+    {
+        return 0;
+    }
+    size_t n = end - begin;
+    size_t chunks = std::max<size_t>(1, std::min(max_chunks, n / std::max<size_t>(grain, 1)));
+    size_t step = (n + chunks - 1) / chunks;
+    chunks = (n + step - 1) / step;
+
+    struct Join
+    {
+        WaitGroup wg;
+        Mutex mutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed = {false};
+    } join;
+
+    auto run = [&join, &chunk](size_t c, size_t b, size_t e) {
+        try
+        {
+            if (!join.failed)
+            {
+                chunk(c, b, e);
+            }
+        }
+        catch (...)
+        {
+            Mutex::Lock lock(join.mutex);
+            if (!join.error)
+            {
+                join.error = std::current_exception();
+            }
+            join.failed = true;
+        }
+    };
+
+    join.wg.add(chunks - 1);
+    static thread_local std::vector<Callback> tasks;
+    for (size_t c = 0; c + 1 < chunks; ++c)
+    {
+        size_t b = begin + c * step;
+        tasks.push_back([&join, &run, c, b, e = b + step]() {
+            run(c, b, e);
+            join.wg.done();
+        });
+    }
+    sc->scheduleBatch(tasks.begin(), tasks.end());
+    tasks.clear();
+
+    run(chunks - 1, begin + (chunks - 1) * step, end);
+    join.wg.wait();
+    if (join.error)
+    {
+        std::rethrow_exception(join.error);
+    }
+    return chunks;
+}
+
+/**
+ *  @brief 默认的最多块数：线程数的4倍
+ *  @details 线程数会随伸缩变化，一次并行调用只读取一次
+ */
+inline size_t parallel_max_chunks(Scheduler* sc)
+{
+    return std::max<size_t>(1, sc->getWorkerCount() * 4);
+}
+
+/**
+ *  @brief 并行地对[begin, end)中的每个下标执行fn(i)
+ *  @param[in] grain 每块至少多少个元素，元素的计算量很小时调大它
+ */
+template<class F>
+void parallel_for(Scheduler* sc, size_t begin, size_t end, F&& fn, size_t grain = 1)
+{
+    auto chunk = [&fn](size_t, size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i)
+        {
+            fn(i);
+        }
+    };
+    parallel_chunks(sc, begin, end, grain, parallel_max_chunks(sc), chunk);
+}
+
+/**
+ *  @brief 并行归约：每块从identity开始依次 acc = reduce(acc, map(i))，再按块的顺序归约各块的结果
+ *  @details reduce需要满足结合律，identity需要是reduce的单位元
+ */
+template<class T, class Map, class Reduce>
+T parallel_reduce(Scheduler* sc, size_t begin, size_t end, T identity, Map&& map, Reduce&& reduce, size_t grain = 1)
+{
+    // 块数只确定一次，线程池在此期间扩容也不会写出partial的范围
+    size_t max_chunks = parallel_max_chunks(sc);
+    std::vector<T> partial(max_chunks, identity);
+    auto chunk = [&](size_t c, size_t b, size_t e) {
+        T acc = identity;
+        for (size_t i = b; i < e; ++i)
+        {
+            acc = reduce(std::move(acc), map(i));
+        }
+        partial[c] = std::move(acc);
+    };
+    size_t chunks = parallel_chunks(sc, begin, end, grain, max_chunks, chunk);
+    T result = identity;
+    for (size_t c = 0; c < chunks; ++c)
+    {
+        result = reduce(std::move(result), std::move(partial[c]));
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace sylar
+{
+
+template<typename T>
+class IntrusivePtr;
+
+/**
+ *  @brief 引用计数放在对象内部的基类，配合 IntrusivePtr 使用
+ *  @details 计数和对象在同一块内存上，没有单独的控制块；从裸指针重新得到持有者只需要一次原子加，
+ *           不像 shared_from_this 那样要先锁 weak_ptr。持有者只在对象需要跨越调度保存时才创建，
+ *           同一线程上短暂使用对象时直接借用裸指针，不改动计数
+ */
+class RefCounted
+{
+public:
+    /**
+     *  @brief 当前的引用计数，只用于判断是否还有其他持有者
+     */
+    uint32_t refCount() const { return m_refs.load(std::memory_order_acquire); }
+
+protected:
+    RefCounted() = default;
+    ~RefCounted() = default;
+
+    // 拷贝出来的对象从0开始计数
+    RefCounted(const RefCounted&) {}
+    RefCounted& operator=(const RefCounted&) { return *this; }
+
+private:
+    template<typename T>
+    friend class IntrusivePtr;
+
+    void addRef() const
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     *  @brief 减少引用计数
+     *  @return 是否是最后一个持有者，此时由调用者析构对象
+     */
+    bool release() const
+    {
+        return m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+private:
+    mutable std::atomic<uint32_t> m_refs = {0};
+};
+
+/**
+ *  @brief 侵入式引用计数智能指针，T 需要继承 RefCounted
+ *  @details 接口与 std::shared_ptr 常用的部分一致；可以随时从裸指针构造新的持有者，
+ *           计数归零时以 T 类型 delete 对象，T 不需要虚析构
+ */
+template<typename T>
+class IntrusivePtr
+{
+public:
+    IntrusivePtr() noexcept = default;
+
+    IntrusivePtr(std::nullptr_t) noexcept {}
+
+    /**
+     *  @brief 持有p，计数加1
+     */
+    explicit IntrusivePtr(T* p) noexcept
+        : m_ptr(p)
+    {
+        if (m_ptr)
+        {
+            m_ptr->addRef();
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr& other) noexcept
+        : IntrusivePtr(other.m_ptr)
+    {
+    }
+
+    IntrusivePtr(IntrusivePtr&& other) noexcept
+        : m_ptr(other.m_ptr)
+    {
+        other.m_ptr = nullptr;
+    }
+
+    ~IntrusivePtr()
+    {
+        if (m_ptr && m_ptr->release())
+        {
+            delete m_ptr;
+        }
+    }
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) noexcept
+    {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept
+    {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    void reset() noexcept
+    {
+        IntrusivePtr().swap(*this);
+    }
+
+    void reset(T* p) noexcept
+    {
+        IntrusivePtr(p).swap(*this);
+    }
+
+    void swap(IntrusivePtr& other) noexcept
+    {
+        std::swap(m_ptr, other.m_ptr);
+    }
+
+    T* get() const noexcept { return m_ptr; }
+    T& operator*() const noexcept { return *m_ptr; }
+    T* operator->() const noexcept { return m_ptr; }
+    explicit operator bool() const noexcept { return m_ptr != nullptr; }
+
+    /**
+     *  @brief 持有者的数量，空指针返回0
+     */
+    long use_count() const noexcept { return m_ptr ? m_ptr->refCount() : 0; }
+
+    friend bool operator==(const IntrusivePtr& a, const IntrusivePtr& b) noexcept { return a.m_ptr == b.m_ptr; }
+    friend bool operator==(const IntrusivePtr& a, std::nullptr_t) noexcept { return !a.m_ptr; }
+
+private:
+    T* m_ptr = nullptr;
+};
+
+}
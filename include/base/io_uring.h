@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "mutex.h"
+#include "noncopyable.h"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SYLAR_HAS_IO_URING 1
+#else
+struct io_uring_sqe;
+#endif
+
+namespace sylar
+{
+
+/**
+ *  @brief io_uring 提交队列和完成队列的最小封装，直接使用系统调用，不依赖 liburing
+ *  @details 多个线程可以同时提交，提交只是写入提交队列，由 flush() 一次性交给内核；
+ *           完成事件通过注册的 eventfd 通知，收割由 reap() 完成，同一时间只有一个线程收割
+ */
+class IoUring : Noncopyable
+{
+public:
+    using ptr = std::unique_ptr<IoUring>;
+
+    /**
+     *  @brief 一个完成事件
+     */
+    struct Completion
+    {
+        uint64_t userData;
+        int32_t res;
+    };
+
+    /**
+     *  @brief 创建 io_uring
+     *  @param[in] entries 提交队列的大小
+     *  @return 内核不支持、被禁用或者编译时没有头文件时返回nullptr
+     */
+    static IoUring::ptr Create(uint32_t entries);
+
+    ~IoUring();
+
+    /**
+     *  @brief 把sqe加入提交队列，link不为空时作为sqe的链接请求一起加入(通常是 IORING_OP_LINK_TIMEOUT)
+     *  @details 队列放不下时先把已经排队的请求提交给内核
+     *  @return 加入之前队列中是否没有待提交的请求，调用者据此决定是否需要唤醒空闲线程来提交
+     */
+    bool push(const io_uring_sqe& sqe, const io_uring_sqe* link = nullptr);
+
+    /**
+     *  @brief 把排队的请求提交给内核，不等待完成
+     *  @return 提交的请求数
+     */
+    int flush();
+
+    /**
+     *  @brief 收割已经完成的事件，追加到out
+     *  @return 其他线程正在收割时返回false
+     */
+    bool reap(std::vector<Completion>& out);
+
+    /**
+     *  @brief 有完成事件时可读的eventfd，非阻塞
+     */
+    int getEventFd() const { return m_eventFd; }
+
+    /**
+     *  @brief 读空eventfd的计数
+     */
+    void drainEventFd();
+
+    /**
+     *  @brief 等待提交的请求数
+     */
+    uint32_t getPending() const { return m_pending.load(std::memory_order_relaxed); }
+
+private:
+    IoUring() = default;
+
+    /**
+     *  @brief 提交队列中空闲的位置数，持有m_sqMutex时调用
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     *  @brief 提交排队的请求，持有m_sqMutex时调用
+     */
+    int submitLocked();
+
+private:
+    int m_fd = -1;                      // io_uring 实例
+    int m_eventFd = -1;                 // 注册的完成通知
+    void* m_sqRing = nullptr;           // 提交队列映射
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;           // 完成队列映射，内核支持时与提交队列是同一块
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;     // 提交队列项数组
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqArray = nullptr;
+    uint32_t* m_sqFlags = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    void* m_cqes = nullptr;
+
+    Mutex m_sqMutex;                    // 保护提交队列的尾部
+    std::atomic<bool> m_reaping = {false};  // 是否有线程正在收割，同一时间只有一个线程收割
+    std::atomic<uint32_t> m_pending = {0};  // 已经写入队列还没有提交的请求数
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "io_uring.h"
 
 namespace sylar
 {
@@ -26,8 +27,9 @@ private:
 
     /**
      *  @brief 封装句柄（文件描述符） 
+     *  @details 按缓存行对齐，相邻fd的上下文被不同线程使用时不会互相干扰
      */
-    struct FdContext
+    struct alignas(64) FdContext
     {
         using MutexType = Mutex;
 
@@ -37,8 +39,9 @@ private:
         struct EventContext
         {
             Scheduler* scheduler = nullptr;
-            std::function<void()> cb;
+            Callback cb;
             Fiber::ptr fiber;           
+            int threadid = -1;          // 每线程反应器模式下恢复到fd所属的调度线程，-1表示任意线程
         };
 
         /**
@@ -58,21 +61,38 @@ private:
          * @brief 触发事件
          * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
          * @param[in] event 事件类型
+         * @param[out] batch 不为空且事件属于当前线程的调度器时，任务追加到batch，由调用者批量调度
          */
-        void triggerEvent(Event event);
+        void triggerEvent(Event event, std::vector<ScheduleTask>* batch = nullptr);
         
         int fd = 0;                     // 对应的文件描述符
         EventContext read;              // 读事件
         EventContext write;             // 写事件
         Event m_events = NONE;          // 事件集（每一位对应读写事件）
         MutexType m_mutex;              // 互斥锁
+        bool persistent = false;        // 是否持久注册，持久注册时fd一直以边缘触发挂在epoll上，m_events只表示有没有等待者
+        int ready = NONE;               // 持久注册时没有等待者期间到达的就绪事件，由下一个等待者消费
+        std::atomic<uint32_t> uringPending = {0};   // 挂起在 io_uring 上的请求数
+        int owner = -1;                 // 每线程反应器模式下fd注册到的调度线程下标，第一次等待它的线程，-1表示还没有注册
+    };
+
+    /**
+     *  @brief 一个调度线程等待IO事件的状态，按缓存行对齐避免不同线程互相干扰
+     */
+    struct alignas(64) Poller
+    {
+        int epfd = -1;                  // 这个线程等待的内核事件表，每线程反应器模式下只由它等待
+        int tickleFd = -1;              // 每线程反应器模式下唤醒这个线程的eventfd，共享epoll时为-1
+        std::atomic<uint32_t> sleeping = {0};   // 1表示阻塞在epoll_wait上或即将阻塞，唤醒方交换为0后才发出唤醒
     };
 
 public:
     /**
      *  @brief 构造函数 
+     *  @param[in] max_threads 最多的线程数，不大于threads时线程数固定，见 Scheduler::Scheduler
      */
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler",
+              size_t max_threads = 0);
 
     /**
      *  @brief 析构函数 
@@ -83,8 +103,55 @@ public:
      *  @brief 往句柄上添加事件
      *  @param[in] fd   
      *  @param[in] Event
+     *  @param[in] cb 事件触发时调度的回调，为空时调度当前协程
+     *  @return 0表示注册成功，-1表示失败
+     *  @details fd号上留有持久注册标记时不信任它(旧句柄可能没有经过cancelAll就关闭了)，按持久注册的方式重新注册一次
+     */
+    int addEvent(int fd, Event event, Callback cb = nullptr);
+
+    /**
+     *  @brief 在调用者确认已经由 armEvents 持久注册的fd上添加事件
+     *  @details 调用者(hook)用FdCtx记录fd注册到了哪个IOManager，FdCtx随句柄重建，复用的fd号会重新注册。
+     *           持久注册时不调用epoll_ctl，否则与addEvent相同
+     *  @return 0表示注册成功，-1表示失败；事件在没有等待者期间已经就绪时返回1，不注册等待，调用者直接重试
+     */
+    int addArmedEvent(int fd, Event event, Callback cb = nullptr);
+
+    /**
+     *  @brief 把fd持久注册到epoll上
+     *  @details 以EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET注册一次，之后 addEvent / 事件触发 / delEvent / cancelEvent
+     *           都不再调用epoll_ctl，没有等待者时到达的事件记在就绪标记里。cancelAll(通常来自被hook的close)解除持久注册。
+     *           只有 addArmedEvent 信任持久注册标记，fd没有经过cancelAll就关闭时，复用同一个fd号的新句柄
+     *           通过addEvent等待仍然会重新注册
+     *  @return 0表示成功
+     */
+    int armEvents(int fd);
+
+    /**
+     *  @brief 被hook的socket是否使用持久注册，由构造时的配置 iomanager.persistent_events 决定
      */
-    int addEvent(int fd, Event event, std::function<void()> cb  = nullptr);
+    bool isPersistentEvents() const { return m_persistentEvents; }
+
+    /**
+     *  @brief 是否每个调度线程使用自己的epoll实例，由构造时的配置 iomanager.reactor_per_thread 决定
+     *  @details 打开时fd注册到第一个在它上面等待的调度线程的epoll，之后它的事件只由该线程处理，等待的协程也在该线程上恢复；
+     *           非调度线程添加的任务轮流投递到各调度线程的信箱，唤醒时只写目标线程的eventfd。
+     *           fd一直留在注册它的线程上，所以这种模式下多出来的线程不会因空闲而退出
+     */
+    bool isReactorPerThread() const { return m_reactorPerThread; }
+
+    /**
+     *  @brief 空闲线程忙轮询的时间，由构造时的配置 iomanager.busy_poll.spin_us 决定，0表示不轮询
+     *  @details 调度线程上次取到任务之后的这段时间内，idle协程用不阻塞的epoll_wait轮询而不休眠，
+     *           紧接着到来的请求省掉一次休眠和唤醒，代价是这段时间一直占着CPU。轮询期间只检查无锁的任务计数和定时器，
+     *           有事件、任务或者到期的定时器时才回到调度协程
+     */
+    uint64_t getBusyPollUs() const { return m_busyPollUs; }
+
+    /**
+     *  @brief 被hook的socket设置的SO_BUSY_POLL，由构造时的配置 iomanager.busy_poll.socket_us 决定，0表示不设置
+     */
+    uint32_t getSocketBusyPollUs() const { return m_socketBusyPollUs; }
 
     /**
      *  @brief 往句柄上删除事件
@@ -103,9 +170,26 @@ public:
     /**
      *  @brief 取消句柄上的所有事件
      *  @param[in] fd   
+     *  @details 同时取消fd上挂起的 io_uring 请求，等待的协程以-ECANCELED恢复；持久注册的fd解除持久注册
      */
     bool cancelAll(int fd);
 
+    /**
+     *  @brief 是否使用 io_uring 后端
+     *  @details 由构造时的配置 iomanager.backend 决定，内核不支持时退回epoll
+     */
+    bool hasUring() const { return m_uring != nullptr; }
+
+    /**
+     *  @brief 通过 io_uring 提交一个IO请求，挂起当前协程直到完成
+     *  @param[in] sqe 填好操作码、fd和参数的请求，user_data由这里设置
+     *  @param[in] timeout_ms 超时时间，~0ull表示不超时
+     *  @return 请求的结果，失败时为负的errno，超时为-ETIMEDOUT
+     *  @details 请求先放进提交队列，由空闲线程在下一次epoll_wait之前批量提交，没有空闲线程时由调用者直接提交。
+     *           只能在 hasUring() 时调用，并且不能在共享栈协程中调用：内核在协程挂起期间读写请求里的缓冲区
+     */
+    int submitIo(io_uring_sqe& sqe, uint64_t timeout_ms = ~0ull);
+
     /**
      *  @brief 获得当前的IOManager 
      */
@@ -114,10 +198,33 @@ public:
 protected: 
     /**
      *  @brief 通知协程调度器有任务了 
-     *  @details 写pipe让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
+     *  @details 轮流找一个正阻塞在epoll_wait上的线程唤醒，待idle协程yield之后Scheduler::run就可以调度其他任务。
+     *           没有线程在休眠时什么也不做，正在运行的线程阻塞之前会再检查一次任务
      */
     void tickle() override;
 
+    /**
+     *  @brief 唤醒指定的调度线程，它没有阻塞在epoll_wait上或者已经有唤醒在途时什么也不做
+     */
+    void tickleWorker(size_t idx) override;
+
+    /**
+     *  @brief 轮流找一个休眠中的调度线程唤醒
+     *  @return 是否唤醒了一个线程，没有线程在休眠时返回false
+     */
+    bool wakeOne();
+
+    /**
+     *  @brief 把休眠中的调度线程唤醒
+     *  @details 每线程反应器模式下写它的eventfd。共享epoll时所有线程等待同一个epoll，eventfd的就绪会被任意一个线程取走，
+     *           这里给目标线程发送SIGURG，idle协程用epoll_pwait只在等待期间放开该信号，因此只会打断目标线程的epoll_pwait。
+     *           SIGURG的处理函数在第一个共享epoll的IOManager构造时安装，本进程用tgkill发出的SIGURG当作唤醒，
+     *           其他来源的(比如socket带外数据的通知)交给安装之前的处理函数；应用在这之后替换处理函数的话，
+     *           唤醒仍然能打断epoll_pwait，但应用的处理函数也会收到这些唤醒
+     *  @return 是否真正发出了唤醒
+     */
+    bool wakeWorker(size_t idx);
+
      /**
      * @brief 判断是否可以停止
      * @details 判断条件是Scheduler::stopping()外加IOManager的m_pendingEventCount为0，表示没有IO事件可调度了
@@ -142,18 +249,54 @@ protected:
      */
     void onTimerInsertAtFront() override;
 
-     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+    /**
+     *  @brief 获取fd对应的句柄上下文，不加锁
+     *  @param[in] auto_create 不存在时是否创建
+     *  @return 不存在并且不创建，或者fd超出句柄表的范围时返回nullptr
      */
-    void contextResize(size_t size);
+    FdContext* getFdContext(int fd, bool auto_create);
+
+    /**
+     *  @brief 添加事件的实现
+     *  @param[in] armed 调用者是否确认fd已经持久注册，见 addArmedEvent
+     */
+    int addEvent(int fd, Event event, Callback cb, bool armed);
+
+    /**
+     *  @brief 收割 io_uring 的完成事件，把等待的协程加入batch
+     *  @param[in, out] completions 收割用的缓冲区，由调用者在循环之间保留容量
+     *  @return 完成的请求数
+     */
+    size_t reapUring(std::vector<IoUring::Completion>& completions, std::vector<ScheduleTask>& batch);
+
+    /**
+     *  @brief 取消fd上所有挂起的 io_uring 请求
+     *  @details 按fd匹配请求需要fd仍然有效，所以立即提交，不等到下一次epoll_wait之前
+     */
+    void cancelUring(int fd);
+
+    /**
+     *  @brief fd所在的epoll实例，调用者需持有fd_ctx->m_mutex
+     *  @details 每线程反应器模式下fd第一次注册时绑定到当前调度线程，非调度线程注册的轮流分给各调度线程
+     */
+    int bindEpfd(FdContext* fd_ctx);
 
 private:
+    static constexpr size_t kFdSegmentBits = 12;                        // 句柄表每段 2^12 个fd
+    static constexpr size_t kFdSegmentSize = (size_t)1 << kFdSegmentBits;
+    static constexpr size_t kFdSegmentCount = 1024;                     // 最多1024段，覆盖 [0, 4M) 的fd
+    using FdSlot = std::atomic<FdContext*>;
+
     int m_epfd = 0;                                     // 内核事件表
-    int m_tickleFds[2];                             // 管道通信--> 用于通知陷入epoll_wait的线程 --> [0]读端，[1]写端
     std::atomic<size_t> m_pendingEventCount = {0};  // 当前等待执行的IO事件数量
-    RWMutexType m_mutex;                            // 读写锁
-    std::vector<FdContext*> m_fdcontexts;           // 句柄数组（保存封装好的句柄）
+    std::atomic<FdSlot*> m_fdSegments[kFdSegmentCount] = {};   // 分段的句柄表，段和句柄上下文都按需分配，分配之后不再移动也不释放
+    IoUring::ptr m_uring;                           // io_uring 后端，使用epoll后端时为空
+    bool m_persistentEvents = false;                // 被hook的socket是否持久注册
+    bool m_reactorPerThread = false;                // 是否每个调度线程使用自己的epoll实例
+    uint64_t m_busyPollUs = 0;                      // 空闲线程忙轮询的时间
+    uint32_t m_socketBusyPollUs = 0;                // 被hook的socket设置的SO_BUSY_POLL
+    std::vector<std::unique_ptr<Poller>> m_pollers; // 按调度线程下标排列，槽位按最多的线程数一次性创建
+    std::atomic<size_t> m_nextTickle = {0};         // tickle()轮转的位置
 };
 
 
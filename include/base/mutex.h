@@ -30,6 +30,12 @@ public:
      */
     void wait();
 
+    /**
+     * @brief 最多等待ms毫秒获取信号量
+     * @return 超时返回false
+     */
+    bool waitFor(uint64_t ms);
+
     /**
      * @brief 释放信号量 
      */
@@ -62,7 +68,7 @@ public:
      */
     ~ScopeLockImpl()
     {
-        m_mutex.unlock();
+        unlock();
     }
 
     /**
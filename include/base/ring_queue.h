@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace sylar
+{
+
+/**
+ *  @brief 容量按2的幂增长的环形队列
+ *  @details 用于调度器的任务队列：容量只增不减，稳定运行后入队出队不再分配内存，
+ *           std::deque/std::list 则会不断地分配和释放节点。不是线程安全的，由调用者加锁
+ */
+template<typename T>
+class RingQueue
+{
+public:
+    RingQueue() = default;
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    ~RingQueue()
+    {
+        clear();
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t capacity() const { return m_cap; }
+
+    /**
+     *  @brief 第i个元素，0为队头
+     */
+    T& operator[](size_t i) { return m_buf[(m_head + i) & (m_cap - 1)]; }
+
+    void push_back(T&& v)
+    {
+        if (m_size == m_cap)
+        {
+            grow();
+        }
+        ::new (&m_buf[(m_head + m_size) & (m_cap - 1)]) T(std::move(v));
+        ++m_size;
+    }
+
+    /**
+     *  @brief 删除第i个元素，之后的元素依次前移
+     */
+    void erase(size_t i)
+    {
+        for (; i + 1 < m_size; ++i)
+        {
+            (*this)[i] = std::move((*this)[i + 1]);
+        }
+        (*this)[m_size - 1].~T();
+        --m_size;
+    }
+
+    /**
+     *  @brief 删除队头元素
+     */
+    void pop_front()
+    {
+        m_buf[m_head].~T();
+        m_head = (m_head + 1) & (m_cap - 1);
+        --m_size;
+    }
+
+    void clear()
+    {
+        while (m_size)
+        {
+            pop_front();
+        }
+    }
+
+private:
+    void grow()
+    {
+        size_t cap = m_cap ? m_cap * 2 : 16;
+        T* buf = std::allocator<T>().allocate(cap);
+        for (size_t i = 0; i < m_size; ++i)
+        {
+            ::new (&buf[i]) T(std::move((*this)[i]));
+            (*this)[i].~T();
+        }
+        if (m_buf)
+        {
+            std::allocator<T>().deallocate(m_buf, m_cap);
+        }
+        m_buf = buf;
+        m_cap = cap;
+        m_head = 0;
+    }
+
+private:
+    T* m_buf = nullptr;
+    size_t m_cap = 0;       // 容量，总是2的幂
+    size_t m_head = 0;      // 队头下标
+    size_t m_size = 0;      // 元素个数
+};
+
+}
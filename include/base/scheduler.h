@@ -1,11 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
-#include <list>
 #include <memory>
 #include <string>
+#include <vector>
+#include "callback.h"
 #include "fiber.h"
 #include "log.h"
+#include "ring_queue.h"
 #include "thread.h"
 
 namespace sylar
@@ -16,6 +19,12 @@ namespace sylar
  *  @brief 协程调度器
  *  @details 封装的是N-M的协程调度器
  *           里面有一个线程池，支持协程在线程池中进行切换 
+ *           每个调度线程有自己的任务队列，调度线程添加的任务放入自己的队列，自己的队列为空时
+ *           先取全局注入队列，再从其他线程的队列尾部窃取一半任务；非调度线程添加的任务放入全局注入队列，
+ *           打开 setInboxRouting 时则轮流投递到各调度线程的信箱
+ *           指定了调度线程的任务投递到目标线程的信箱，只有目标线程会取，也只唤醒目标线程
+ *           每个队列按优先级分为几条通道，取任务时按权重轮流选择通道，等待太久的低优先级任务会被提前执行
+ *           线程数可以在[threads, max_threads]之间伸缩：任务排队太久时增加线程，多出来的线程空闲太久后退出
  */
 class Scheduler
 {
@@ -24,13 +33,49 @@ public:
     using MutexType = Mutex;
     using Tid = size_t;
 
+    /**
+     *  @brief 任务的优先级
+     */
+    enum Priority
+    {
+        IO_RESUME = 0,      // IO就绪后恢复的协程，对延迟敏感
+        NORMAL = 1,         // 普通任务
+        BACKGROUND = 2,     // 后台批处理任务
+        PRIORITY_COUNT = 3
+    };
+
+    /**
+     *  @brief 调度线程上正在运行的任务，供看门狗采样
+     */
+    struct RunningSlice
+    {
+        size_t index = 0;           // 调度线程的下标
+        pid_t tid = -1;             // 线程id
+        uint64_t fiberId = 0;       // 正在运行的协程id
+        uint64_t startUs = 0;       // 这次开始运行的时间，0表示线程空闲
+    };
+
+    /**
+     *  @brief 一个优先级的统计
+     */
+    struct PriorityStats
+    {
+        size_t depth = 0;           // 正在排队的任务数
+        uint64_t dequeued = 0;      // 已经取出执行的任务数
+        uint64_t totalWaitUs = 0;   // 取出的任务在队列中等待的总时间
+        uint64_t maxWaitUs = 0;     // 取出的任务在队列中等待的最长时间
+        uint64_t promoted = 0;      // 因等待太久而被提前执行的任务数
+    };
+
     /**
      *  @brief 构造函数
-     *  @param[in] threads 线程数
+     *  @param[in] threads 线程数，线程数可以伸缩时为最少的线程数
      *  @param[in] usr_caller 是否将当前线程也作为调度线程
      *  @param[in] name 调度器的名称
+     *  @param[in] max_threads 最多的线程数，不大于threads时线程数固定。和threads一样包括caller线程
      */
-    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler");
+    Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "Scheduler",
+              size_t max_threads = 0);
 
     /**
      *  @brief 析构函数 
@@ -42,6 +87,103 @@ public:
      */
     const std::string& getName() const { return m_name; }
 
+    /**
+     *  @brief 设置调度器为函数任务创建的协程是否使用共享栈
+     *  @details 共享栈协程只能在创建它的线程上恢复，调度时会自动绑定到该线程
+     */
+    void setSharedStack(bool v) { m_sharedStack = v; }
+
+    /**
+     *  @brief 设置调度线程的CPU亲和性策略，需要在start()之前调用
+     *  @details 取值见 PlanAffinity：none / compact / scatter / numa / CPU列表。
+     *           默认取配置 scheduler.affinity_by_name 中本调度器名称对应的策略，没有则取 scheduler.affinity
+     */
+    void setAffinity(const std::string& spec) { m_affinity = spec; }
+
+    /**
+     *  @brief 调度线程的CPU亲和性策略
+     */
+    const std::string& getAffinity() const { return m_affinity; }
+
+    /**
+     *  @brief 调度器是否为函数任务使用共享栈协程
+     */
+    bool isSharedStack() const { return m_sharedStack; }
+
+    /**
+     *  @brief 函数任务复用缓存协程的次数
+     */
+    uint64_t getFiberCacheHits() const { return m_fiberCacheHits; }
+
+    /**
+     *  @brief 函数任务需要新建协程的次数
+     */
+    uint64_t getFiberCacheMisses() const { return m_fiberCacheMisses; }
+
+    /**
+     *  @brief 扫描全局注入队列时跳过的指定了其他线程的任务数
+     *  @details 目标线程是本调度器的调度线程时任务会进入信箱，不会被扫描；这个值增长说明有任务指定了非调度线程
+     */
+    uint64_t getPinnedSkipped() const { return m_pinnedSkipped; }
+
+    /**
+     *  @brief 空闲线程在futex上休眠的次数
+     */
+    uint64_t getParkCount() const { return m_parkCount; }
+
+    /**
+     *  @brief 需要唤醒空闲线程的次数，即 tickle / tickleWorker 被调用的次数
+     */
+    uint64_t getWakeupsNeeded() const { return m_wakeupsNeeded; }
+
+    /**
+     *  @brief 真正发出的唤醒次数，其余的因为没有线程在休眠或者唤醒已经在途而被合并
+     */
+    uint64_t getWakeupsSent() const { return m_wakeupsSent; }
+
+    /**
+     *  @brief 获取一个优先级的排队深度和等待时间统计
+     */
+    PriorityStats getPriorityStats(Priority prio) const;
+
+    /**
+     *  @brief 设置优先级的调度权重，需要在start()之前调用
+     *  @details 每个优先级都有任务时，各优先级被选中的次数与权重成正比，权重至少为1。
+     *           默认取配置 scheduler.priority.weights
+     */
+    void setPriorityWeight(Priority prio, uint32_t weight);
+
+    /**
+     *  @brief 设置任务最长等待时间，需要在start()之前调用，超过后不论优先级都先执行，0表示不提前
+     *  @details 默认取配置 scheduler.priority.max_wait_ms
+     */
+    void setMaxWaitMs(uint64_t ms) { m_maxWaitUs = ms * 1000; }
+
+    /**
+     *  @brief 当前调度线程的数量，包括caller线程
+     */
+    size_t getWorkerCount() const { return m_workerCount; }
+
+    /**
+     *  @brief 最多的调度线程数量，包括caller线程
+     */
+    size_t getMaxWorkerCount() const { return m_workers.size(); }
+
+    /**
+     *  @brief 采样每个调度线程上正在运行的任务，空闲的线程startUs为0，已经退出的线程不输出
+     */
+    void getRunningSlices(std::vector<RunningSlice>& slices) const;
+
+    /**
+     *  @brief 因任务排队太久而增加线程的次数
+     */
+    uint64_t getGrowCount() const { return m_growCount; }
+
+    /**
+     *  @brief 空闲太久的线程退出的次数
+     */
+    uint64_t getRetireCount() const { return m_retireCount; }
+
     /**
      *  @brief 获得当前线程调度器的指针 
      */
@@ -54,24 +196,57 @@ public:
 
     /**
      *  @brief 调价调度任务
-     *  @tparam FiberOrcb 调度任务类型，可以是 Fiber 以及 function函数
-     *  @param fc FiberOrcb类型
+     *  @tparam FiberOrcb 调度任务类型，可以是 Fiber 以及任意 void() 可调用对象
+     *  @param fc FiberOrcb类型，可调用对象会被完美转发进 Callback，不超过 Callback::kInlineSize 的不会分配内存
      *  @param threadid 指定运行该任务的线程号，-1 表示任意线程
+     *  @details 指定的线程不是本调度器当前的调度线程时(比如弹性扩容的线程已经空闲退出)，
+     *           任务按不指定线程处理，由任意线程执行；共享栈协程除外，它总是回到所属线程
+     */
+    template<typename FiberOrcb>
+    void schedule(FiberOrcb&& ft, size_t threadid = -1)
+    {
+        schedule(std::forward<FiberOrcb>(ft), NORMAL, threadid);
+    }
+
+    /**
+     *  @brief 按指定的优先级添加调度任务
+     *  @param prio 任务的优先级
+     *  @param threadid 指定运行该任务的线程号，-1 表示任意线程，指定的线程已退出时同上
      */
     template<typename FiberOrcb>
-    void schedule(FiberOrcb ft, size_t threadid = -1)
+    void schedule(FiberOrcb&& ft, Priority prio, size_t threadid = -1)
     {
-        bool need_tickle = false;
+        ScheduleTask task(std::forward<FiberOrcb>(ft), threadid, prio);
+        if (!task.fiber && !task.cb)
         {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(ft, threadid);
+            return;
         }
 
-        if (need_tickle)    // 这说明现在任务队列中有任务，需要唤醒idle协程
+        if (enqueue(task))  // 这说明有空闲的调度线程，需要唤醒idle协程
         {
             tickle();       // 唤醒idle协程
         }
-        
+    }
+
+    /**
+     *  @brief 批量添加调度任务
+     *  @tparam InputIt 迭代器，元素可以是 Fiber::ptr 或任意 void() 可调用对象
+     *  @details 元素会被移走。相比逐个schedule，每个队列只加一次锁，
+     *           并且只唤醒和任务数相当的空闲线程，而不是每个任务tickle一次
+     */
+    template<typename InputIt>
+    void scheduleBatch(InputIt begin, InputIt end, Priority prio = NORMAL)
+    {
+        static thread_local std::vector<ScheduleTask> tasks;
+        for (; begin != end; ++begin)
+        {
+            ScheduleTask task(std::move(*begin), -1, prio);
+            if (task.fiber || task.cb)
+            {
+                tasks.push_back(std::move(task));
+            }
+        }
+        scheduleBatch(tasks);
     }
 
     /**
@@ -87,9 +262,71 @@ public:
 protected:
     /**
      *  @brief 通知协程调度器有任务了 
+     *  @details 默认实现：没有正在自旋的空闲线程时，唤醒一个在futex上休眠的线程
      */
     virtual void tickle();
 
+    /**
+     *  @brief 唤醒指定的调度线程，用于信箱中有新任务时
+     *  @param[in] idx 调度线程的下标，use_caller时caller线程为0
+     *  @details 默认实现唤醒在futex上休眠的该线程
+     */
+    virtual void tickleWorker(size_t idx);
+
+    /**
+     *  @brief 唤醒所有处于idle的调度线程(当前线程除外)，用于停止调度器时
+     */
+    void wakeIdleWorkers();
+
+    /**
+     *  @brief 获取调度线程的pthread句柄，线程还没进入run()时为0
+     */
+    pthread_t getWorkerThread(size_t idx) const { return m_workers[idx]->thread; }
+
+    /**
+     *  @brief 获取调度线程的线程id，槽位上没有线程时为-1
+     */
+    pid_t getWorkerTid(size_t idx) const { return m_workers[idx]->tid; }
+
+    /**
+     *  @brief 调度线程是否处于idle协程中
+     */
+    bool isWorkerIdle(size_t idx) const { return m_workers[idx]->idle; }
+
+    /**
+     *  @brief 当前调度线程是否有可以执行的任务
+     *  @details 空闲线程发布休眠状态之后、阻塞之前再检查一次，与唤醒方先入队再检查休眠状态配对，不会丢失唤醒
+     */
+    bool hasReadyTasks();
+
+    /**
+     *  @brief 记录一次唤醒请求
+     *  @param[in] sent 是否真正发出了唤醒
+     */
+    void countWakeup(bool sent);
+
+    /**
+     *  @brief 当前调度线程上次取到任务的时间，不是本调度器的调度线程时返回0
+     */
+    uint64_t getLastActiveUs() const;
+
+    /**
+     *  @brief 当前线程在本调度器中的下标，不是本调度器的调度线程时返回-1
+     */
+    int getWorkerIndex() const;
+
+    /**
+     *  @brief 轮流选出一个已经进入run()的调度线程
+     *  @return 调度线程的下标，没有时返回-1
+     */
+    int pickWorker();
+
+    /**
+     *  @brief 设置非调度线程添加的任务是否投递到调度线程的信箱，需要在start()之前调用
+     *  @details 打开后这些任务由 pickWorker() 轮流选出目标线程，不进入全局注入队列，只唤醒目标线程
+     */
+    void setInboxRouting(bool v) { m_inboxRouting = v; }
+
     /**
      *  @brief 协程调度函数 
      */
@@ -97,6 +334,7 @@ protected:
 
     /**
      *  @brief 无任务调度执行idle协程 
+     *  @details 默认实现先自旋 scheduler.idle_spin_count 轮，仍没有任务就在futex上休眠，直到被tickle唤醒
      */
     virtual void idle();
 
@@ -106,32 +344,32 @@ protected:
     virtual bool stopping();
 
     /**
-     *  @brief 设置当前的协程调度器 
+     *  @brief 在idle中没有事情可做时调用，当前线程是多出来的线程并且空闲超过 scheduler.elastic.retire_idle_ms 时让它退出
+     *  @return 当前线程是否已经退出调度，返回true时idle()应该立即返回
      */
-    void setThis();
+    bool retireIfIdle();
 
     /**
-     *  @brief 返回是否有空闲线程 
+     *  @brief 当前线程是否可能因为空闲而退出，空闲等待的超时时间不应超过 getRetireIdleMs()
      */
-    bool hasIdleThreads() { return m_threadCount > 0; }
+    bool isRetirable() const;
 
-private:
+    /**
+     *  @brief 空闲多久的线程会退出
+     */
+    uint64_t getRetireIdleMs() const { return m_retireIdleUs / 1000; }
 
     /**
-     *  @brief 该函数用于标记是否需要唤醒调度器进行任务调度
+     *  @brief 设置当前的协程调度器 
      */
-    template<typename FiberOrcb>
-    bool scheduleNoLock(FiberOrcb ft, size_t threadid)
-    {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(ft, threadid);
-        if (task.fiber || task.cb)
-        {
-            m_tasks.push_back(task);
-        } 
-        return need_tickle;     
-    }
+    void setThis();
+
+    /**
+     *  @brief 返回是否有空闲线程 
+     */
+    bool hasIdleThreads() { return m_threadCount > 0; }
 
+protected:
      /**
      * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
      */
@@ -151,22 +389,32 @@ private:
         /**
          *  @brief 构造函数 
          */
-        ScheduleTask(Fiber::ptr f, int thr)
+        ScheduleTask(const Fiber::ptr& f, int thr, Priority prio = NORMAL)
         {
             fiber = f;
             threadid = thr;
+            priority = prio;
         }
 
-        ScheduleTask(Fiber::ptr* f, int thr)
+        ScheduleTask(Fiber::ptr&& f, int thr, Priority prio = NORMAL)
+        {
+            fiber = std::move(f);
+            threadid = thr;
+            priority = prio;
+        }
+
+        ScheduleTask(Fiber::ptr* f, int thr, Priority prio = NORMAL)
         {
             fiber.swap(*f);
             threadid = thr;
+            priority = prio;
         }
 
-        ScheduleTask(std::function<void()> c, int thr)
+        ScheduleTask(Callback&& c, int thr, Priority prio = NORMAL)
         {
-            cb = c;
+            cb = std::move(c);
             threadid = thr;
+            priority = prio;
         }
         
         void reset()
@@ -174,27 +422,230 @@ private:
             fiber = nullptr;
             cb = nullptr;
             threadid = -1;
+            priority = NORMAL;
         }
         
     private:
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Callback cb;
         int threadid;
+        Priority priority = NORMAL;
+        uint64_t enqueueUs = 0;     // 入队时间，用于统计等待时间和防止饥饿
     };
 
+    /**
+     *  @brief 批量添加调度任务，会清空tasks
+     *  @details 每个目标队列只加一次锁，按需要唤醒的任务数唤醒相应数量的空闲线程
+     */
+    void scheduleBatch(std::vector<ScheduleTask>& tasks);
+
+private:
+    /**
+     *  @brief 按优先级分通道的任务队列，每条通道内先进先出
+     */
+    struct TaskQueue
+    {
+        RingQueue<ScheduleTask> lanes[PRIORITY_COUNT];
+
+        void push(ScheduleTask&& task) { lanes[task.priority].push_back(std::move(task)); }
+    };
+
+    /**
+     *  @brief 一次取任务时各通道的尝试顺序
+     */
+    struct DequeueOrder
+    {
+        Priority lanes[PRIORITY_COUNT];     // 按权重选中的通道在前，其余按优先级排列
+        uint64_t now = 0;                   // 取任务时的时间
+    };
+
+    /**
+     *  @brief 一个优先级的排队任务数，按缓存行对齐避免不同优先级互相干扰
+     */
+    struct alignas(64) LaneDepth
+    {
+        std::atomic<size_t> value = {0};
+    };
+
+    /**
+     *  @brief 一个调度线程取出的某个优先级任务的统计，只有该线程写入，读取时累加所有线程
+     */
+    struct LaneStats
+    {
+        std::atomic<uint64_t> dequeued = {0};
+        std::atomic<uint64_t> totalWaitUs = {0};
+        std::atomic<uint64_t> maxWaitUs = {0};
+        std::atomic<uint64_t> promoted = {0};
+    };
+
+    /**
+     *  @brief 调度线程的私有数据
+     *  @details 按页对齐，既避免不同线程的队列锁互相干扰，也能整页迁移到线程所在的NUMA节点
+     */
+    struct alignas(4096) Worker
+    {
+        MutexType mutex;                        // 保护tasks
+        TaskQueue tasks;                        // 本线程的任务队列，本线程从头部取，其他线程从尾部窃取
+        MutexType mailboxMutex;                 // 保护mailbox
+        TaskQueue mailbox;                      // 指定由本线程执行的任务，不会被窃取
+        int64_t credit[PRIORITY_COUNT] = {0};   // 加权轮询中各优先级当前的积分，只有本线程访问
+        uint64_t lastGlobalUs = 0;              // 上次检查全局注入队列的时间
+        uint64_t lastActiveUs = 0;              // 上次取到任务的时间
+        bool growHint = false;                  // 取到的任务排队太久，需要考虑增加线程
+        std::atomic<bool> running = {false};    // 线程是否还在run()中，退出后槽位可以复用
+        std::atomic<uint64_t> sliceFiberId = {0};   // 正在运行的协程id
+        std::atomic<uint64_t> sliceStartUs = {0};   // 正在运行的协程这次开始运行的时间，0表示没有在运行
+        LaneStats stats[PRIORITY_COUNT];        // 本线程取出的各优先级任务的统计
+        std::atomic<pid_t> tid = {-1};          // 线程id
+        std::atomic<bool> idle = {false};       // 是否处于idle协程中
+        std::atomic<size_t> mailboxSize = {0};  // 信箱中的任务数，用于不加锁地判断是否有任务
+        std::atomic<uint32_t> parked = {0};     // futex字，1表示在futex上休眠或即将休眠
+        pthread_t thread = 0;                   // 线程句柄
+        size_t index = 0;                       // 在m_workers中的下标
+        int numaNode = -1;                      // 线程绑定的NUMA节点编号，-1表示未绑定到单个节点
+    };
+
+    /**
+     *  @brief 当前调度线程是否有可以执行的任务
+     */
+    bool hasWork(Worker* worker);
+
+    /**
+     *  @brief 自旋等待新任务，仍然没有就在futex上休眠，直到被unpark
+     */
+    void park(Worker* worker);
+
+    /**
+     *  @brief 唤醒在futex上休眠的线程
+     *  @return 线程是否处于休眠状态
+     */
+    bool unpark(Worker* worker);
+
+    /**
+     *  @brief 停止过程中所有任务都执行完时，唤醒空闲线程让它们退出
+     */
+    void notifyIfStopped();
+
+    /**
+     *  @brief 任务排队太久并且没有空闲线程时，启动一个新的调度线程
+     */
+    void grow();
+
+    /**
+     *  @brief 为槽位idx启动调度线程，调用者需持有m_mutex
+     */
+    void spawnWorker(size_t idx);
+
+    /**
+     *  @brief 绑定到单个NUMA节点的线程，把它的私有数据迁移到该节点上
+     */
+    void bindWorker(Worker* worker, const std::vector<int>& cpus);
+
+    /**
+     *  @brief 恢复任务协程，记录运行的开始时间供看门狗和 maybe_yield 使用
+     */
+    void resumeTask(Worker* worker, Fiber* fiber);
+
+    /**
+     *  @brief 根据线程id查找调度线程，不是本调度器的调度线程时返回nullptr
+     */
+    Worker* findWorker(int tid);
+
+    /**
+     *  @brief 将任务放入合适的队列
+     *  @return 是否需要tickle唤醒空闲线程
+     */
+    bool enqueue(ScheduleTask& task);
+
+    /**
+     *  @brief 依次从信箱、自己的队列、全局注入队列中取任务，都没有时从其他线程窃取
+     *  @details 距上次检查全局注入队列超过最长等待时间的一半时先检查它，自己的队列一直有任务时全局注入队列也不会饿死
+     *  @param[out] retry 是否遇到了还没切换出去的协程，需要稍后重试
+     */
+    bool popTask(Worker* worker, ScheduleTask& task, bool& retry);
+
+    /**
+     *  @brief 加权轮询选出这次优先尝试的通道
+     *  @details 只在有任务排队的优先级之间轮询，各优先级被选中的次数与权重成正比
+     */
+    void makeOrder(Worker* worker, DequeueOrder& order);
+
+    /**
+     *  @brief 按order从队列里取一个当前线程可以执行的任务，调用者需持有队列的锁
+     *  @details 先检查低优先级通道的队头，等待超过 m_maxWaitUs 的直接取走
+     *  @param[in] global 是否为全局注入队列，需要跳过指定了其他线程的任务
+     */
+    bool popFrom(TaskQueue& queue, const DequeueOrder& order, ScheduleTask& task, bool& retry, bool global);
+
+    /**
+     *  @brief 从一条通道里取一个当前线程可以执行的任务
+     *  @param[in] head_only 只检查队头
+     */
+    bool popLane(RingQueue<ScheduleTask>& lane, const DequeueOrder& order, ScheduleTask& task,
+                 bool& retry, bool global, bool head_only);
+
+    /**
+     *  @brief 记录取出的任务的等待时间
+     */
+    void onDequeue(const ScheduleTask& task, uint64_t now, bool promoted);
+
+    /**
+     *  @brief 任务入队时打上时间戳并计数
+     */
+    void onEnqueue(ScheduleTask& task, uint64_t now);
+
+    /**
+     *  @brief 从其他线程的队列尾部窃取一半任务到自己的队列
+     *  @return 是否窃取到了任务
+     */
+    bool steal(Worker* worker);
+
 private:
     std::string m_name;                         // 调度器的名称
-    MutexType m_mutex;                          // 互斥量
-    std::vector<Thread::ptr> m_threads;         // 线程池
-    std::list<ScheduleTask> m_tasks;            // 任务队列
+    MutexType m_mutex;                          // 互斥量，保护全局注入队列和线程池
+    std::vector<Thread::ptr> m_threads;         // 线程池，下标为槽位下标减去caller线程占用的一个，空表示槽位没有启动过线程
+    TaskQueue m_tasks;                          // 全局注入队列
+    std::vector<std::unique_ptr<Worker>> m_workers; // 每个调度线程的私有数据
+    std::atomic<size_t> m_pendingCount = {0};   // 所有队列中等待执行的任务数
+    std::atomic<size_t> m_mailboxCount = {0};   // 所有信箱中等待执行的任务数
+    std::atomic<uint64_t> m_pinnedSkipped = {0};    // 扫描全局注入队列时跳过的指定线程任务数
+    std::atomic<size_t> m_spinningCount = {0};  // 正在自旋等待任务的空闲线程数
+    std::atomic<uint64_t> m_parkCount = {0};    // 空闲线程在futex上休眠的次数
+    std::atomic<uint64_t> m_wakeupsNeeded = {0};    // 需要唤醒空闲线程的次数
+    std::atomic<uint64_t> m_wakeupsSent = {0};      // 真正发出的唤醒次数
     std::vector<Tid> m_tids;                    // 线程池中包含的线程id
-    size_t m_threadCount = 0;                   // 线程数量
+    size_t m_threadCount = 0;                   // 最多的线程数量，不包括caller线程
+    size_t m_minWorkers = 0;                    // 最少的调度线程数量，包括caller线程，下标不小于它的槽位可以伸缩
+    std::atomic<size_t> m_workerCount = {0};    // 当前的调度线程数量，包括caller线程
+    std::vector<std::vector<int>> m_plan;       // 每个槽位的CPU亲和性
+    uint64_t m_growWaitUs = 0;                  // 任务排队超过这个时间时增加线程
+    uint64_t m_retireIdleUs = 0;                // 多出来的线程空闲超过这个时间时退出
+    std::atomic<uint64_t> m_lastGrowUs = {0};   // 上次增加线程的时间
+    std::atomic<uint64_t> m_growCount = {0};    // 增加线程的次数
+    std::atomic<uint64_t> m_retireCount = {0};  // 线程退出的次数
     std::atomic<size_t> m_activeCount = {0};   // 活跃线程数量
     std::atomic<size_t> m_idleCount = {0};     // 不活跃线程数量
     bool m_useCaller;                          // 判断是否执行Scheduler构造函数的线程
     Fiber::ptr m_rootFiber;                     // 当 m_userCaller = true 时，主协程以后的第一个协程（）
     uint64_t m_rootThread = 0;                  // 当 m_userCaller = true 时，调度器所在线程的线程id
-    bool m_stopping = false;                    // 是否正在停止
+    std::atomic<bool> m_stopping = {false};     // 是否正在停止
+    bool m_sharedStack = false;                 // 函数任务是否使用共享栈协程
+    std::string m_affinity;                     // 调度线程的CPU亲和性策略
+    std::atomic<uint64_t> m_fiberCacheHits = {0};   // 函数任务命中协程缓存的次数
+    std::atomic<uint64_t> m_fiberCacheMisses = {0}; // 函数任务新建协程的次数
+    uint32_t m_weights[PRIORITY_COUNT];         // 各优先级的调度权重
+    uint64_t m_maxWaitUs = 0;                   // 任务最长等待时间，超过后提前执行
+    LaneDepth m_depth[PRIORITY_COUNT];          // 各优先级正在排队的任务数
+    bool m_inboxRouting = false;                // 非调度线程添加的任务是否投递到调度线程的信箱
+    std::atomic<size_t> m_nextInbox = {0};      // pickWorker() 轮转的位置
 };
 
-}
\ No newline at end of file
+/**
+ *  @brief 协作式的让出检查点，在长时间计算的循环中调用
+ *  @details 当前任务这次开始运行以来超过了 scheduler.yield_budget_us 时，把当前协程重新放入调度队列后让出，
+ *           同一线程上排队的其他任务得以先执行。不在调度器的任务中或者预算没有用完时直接返回，只多取一次时间
+ *  @return 是否让出过
+ */
+bool maybe_yield();
+
+}
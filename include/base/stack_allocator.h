@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace sylar
+{
+
+/**
+ *  @brief 协程栈分配器接口
+ *  @details Fiber 创建时通过 StackAllocator::GetDefault() 取得分配器，并记录下来，
+ *           析构时归还给同一个分配器，因此运行期切换默认分配器是安全的
+ */
+class StackAllocator
+{
+public:
+    /**
+     *  @brief 析构函数
+     */
+    virtual ~StackAllocator() {}
+
+    /**
+     *  @brief 分配一块协程栈
+     *  @param[in] size 栈大小(字节)
+     *  @return 栈的低地址，失败返回nullptr
+     */
+    virtual void* alloc(size_t size) = 0;
+
+    /**
+     *  @brief 归还协程栈
+     *  @param[in] p alloc 返回的地址
+     *  @param[in] size alloc 时传入的大小
+     */
+    virtual void dealloc(void* p, size_t size) = 0;
+
+    /**
+     *  @brief 获得默认的栈分配器
+     *  @details 未调用 SetDefault 时由配置 fiber.stack_allocator 决定: "pool"(默认) 或 "malloc"
+     */
+    static StackAllocator* GetDefault();
+
+    /**
+     *  @brief 设置默认的栈分配器，传入nullptr则恢复为配置决定的分配器
+     *  @attention 分配器对象的生命周期由调用者保证，必须长于所有用它分配栈的协程
+     */
+    static void SetDefault(StackAllocator* allocator);
+};
+
+/**
+ *  @brief malloc栈内存分配器
+ */
+class MallocStackAllocator : public StackAllocator
+{
+public:
+    void* alloc(size_t size) override;
+    void dealloc(void* p, size_t size) override;
+};
+
+/**
+ *  @brief mmap 栈池分配器
+ *  @details 1. 栈按页数向上取整到2的幂，形成若干尺寸档位，每个线程每个档位维护一条空闲链表
+ *           2. 每个栈的低地址端有一个 PROT_NONE 的保护页，栈溢出会直接触发段错误，而不是踩坏相邻内存
+ *           3. 归还时如果空闲链表已满(fiber.stack_pool.max_cached)则直接 munmap
+ *           4. 开启 fiber.stack_pool.trim 时，超出 fiber.stack_pool.trim_keep 个的冷栈在归还时
+ *              通过 MADV_DONTNEED 释放物理页，只保留虚拟地址空间
+ */
+class PooledStackAllocator : public StackAllocator
+{
+public:
+    /**
+     *  @brief 栈池统计信息
+     */
+    struct Stats
+    {
+        uint64_t mapped = 0;        // 当前已 mmap 的栈数量(包括使用中和缓存中的)
+        uint64_t cached = 0;        // 当前缓存在空闲链表中的栈数量
+        uint64_t hits = 0;          // 从空闲链表命中的分配次数
+        uint64_t misses = 0;        // 需要新 mmap 的分配次数
+        uint64_t trimmed = 0;       // 被 MADV_DONTNEED 释放物理页的次数
+    };
+
+    void* alloc(size_t size) override;
+    void dealloc(void* p, size_t size) override;
+
+    /**
+     *  @brief 获得栈池全局单例
+     */
+    static PooledStackAllocator* GetInstance();
+
+    /**
+     *  @brief 获得栈池统计信息
+     */
+    static Stats GetStats();
+
+    /**
+     *  @brief 释放当前线程缓存的全部空闲栈
+     */
+    static void ReleaseThreadCache();
+};
+
+}
@@ -5,11 +5,20 @@
 #include "config.h"
 #include "util.h"
 #include "mutex.h"
+#include "affinity.h"
 #include "thread.h"
+#include "callback.h"
 #include "fiber.h"
+#include "fiber_local.h"
+#include "stack_allocator.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "watchdog.h"
 #include "iomanager.h"
+#include "fiber_sync.h"
+#include "channel.h"
+#include "future.h"
+#include "coroutine.h"
 #include "hook.h"
 #include "endian.hpp"
 #include "address.hpp"
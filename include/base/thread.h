@@ -7,6 +7,7 @@
 #include <functional>
 #include <pthread.h>
 #include <string>
+#include <vector>
 #include <sys/types.h>
 
 namespace sylar
@@ -20,8 +21,9 @@ public:
      *  @brief 构造函数
      *  @param[in] cb 线程执行函数
      *  @param[in] name 线程名称
+     *  @param[in] cpus 线程绑定的CPU，为空表示不绑定
       */
-    Thread(std::function<void()> cb, const std::string& name);
+    Thread(std::function<void()> cb, const std::string& name, const std::vector<int>& cpus = {});
 
     /**
      * @brief 析构函数 
@@ -38,6 +40,11 @@ public:
      */
     std::string getName() const { return m_name; }
 
+    /**
+     *  @brief 获得线程实际可以运行的CPU，在线程启动时读取
+     */
+    const std::vector<int>& getCpus() const { return m_cpus; }
+
     /**
      *  @brief 等待线程执行结束 
      */
@@ -68,6 +75,7 @@ private:
     pthread_t m_thread = 0;         // 当前线程结构
     std::function<void()> m_cb;     // 当前线程可执行的回调函数
     Semaphore m_semaphore;          // 当前线程的信号量
+    std::vector<int> m_cpus;        // 启动前为要绑定的CPU，启动后为实际可以运行的CPU
 };
 
 } // namespace sylarclass Thread : Noncopyable
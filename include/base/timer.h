@@ -4,6 +4,7 @@
 #include <memory>
 #include <vector>
 #include <set>
+#include "callback.h"
 #include "mutex.h"
 
 namespace sylar
@@ -42,7 +43,7 @@ private:
      *  @param[in] cb
      *  @param[in] TimerManager
      */
-    Timer(bool recurring, uint64_t ms, std::function<void()> cb, TimerManager* manager);
+    Timer(bool recurring, uint64_t ms, Callback cb, TimerManager* manager);
 
     /**
      *  @brief 构造函数
@@ -63,7 +64,7 @@ private:
     bool recurring = false;             // 判断是否是循环计时器
     uint64_t m_ms = 0;                  // 执行周期
     uint64_t m_next = 0;                // 精确的执行时间
-    std::function<void()> m_cb;         // 定时器绑定的回调任务
+    Callback m_cb;                      // 定时器绑定的回调任务，循环定时器保存的是可拷贝的共享包装
     TimerManager* m_manager = nullptr;  // 定时器管理类
 };
 
@@ -90,7 +91,7 @@ public:
      *  @param[in]  recurring   是否是循环定时器
      *  @param[in]  cb   定时器绑定的回调函数
      */
-    Timer::ptr addTimer(uint64_t ms, bool recurring, std::function<void()> cb);
+    Timer::ptr addTimer(uint64_t ms, bool recurring, Callback cb);
 
     /**
      *  @brief 添加条件定时器到定时器列表中
@@ -99,7 +100,7 @@ public:
      *  @param[in]  cb   定时器绑定的回调函数
      *  @param[in]  weak_cond 执行条件
      */
-    Timer::ptr addTimerCondition(uint64_t ms, bool recurring, std::function<void()> cb, std::weak_ptr<void> weak_cond); 
+    Timer::ptr addTimerCondition(uint64_t ms, bool recurring, Callback cb, std::weak_ptr<void> weak_cond); 
 
     /**
      *  @brief 得到最近的定时器的时间间隔 
@@ -108,9 +109,9 @@ public:
 
     /**
      *  @brief 获得需要执行的定时器的回调函数列表
-     *  @param[in]  cbs 
+     *  @param[out]  cbs 单次定时器的回调直接移出，循环定时器得到一份共享同一个可调用对象的回调
      */
-    void listExpireCb(std::vector<std::function<void()>>& cbs);
+    void listExpireCb(std::vector<Callback>& cbs);
 
     /**
      *  @brief 判断是否有定时器 
@@ -69,6 +69,15 @@ void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
  */
 std::string BacktraceToString(int size, int skip, const std::string prefix="");
 
+/**
+ * @brief 把已经采集到的栈地址转换成字符串，用于在别处(比如信号处理函数中)采集的调用栈
+ * @param[in] frames 栈地址
+ * @param[in] size 栈的层数
+ * @param[in] skip 跳过栈顶的层数
+ * @param[in] prefix 栈信息前输出的内容
+ */
+std::string BacktraceToString(void* const* frames, int size, int skip, const std::string prefix="");
+
 
 
 /*---------------------  timer.h  ------------------------*/
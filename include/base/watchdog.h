@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+#include "thread.h"
+
+namespace sylar
+{
+
+/**
+ *  @brief 协程饥饿看门狗
+ *  @details 一个后台线程每隔 scheduler.watchdog.interval_ms 采样所有已启动调度器的调度线程，
+ *           同一个协程连续运行超过 scheduler.watchdog.slice_ms 时报告一次它的协程id、运行时间和调用栈。
+ *           slice_ms默认为0，不启动看门狗线程。调用栈由看门狗向调度线程发送 scheduler.watchdog.signal
+ *           (默认SIGRTMIN)，在信号处理函数中采集；处理函数在第一次采集时才安装，其他来源的这个信号交给原来的处理函数。
+ *           被采集的线程如果正阻塞在没有hook的sleep/poll等调用上，这些调用会提前返回EINTR
+ */
+class Watchdog : Noncopyable
+{
+public:
+    /**
+     *  @brief 获得看门狗单例，进程退出时不析构
+     */
+    static Watchdog* GetInstance();
+
+    /**
+     *  @brief 开始监视调度器，第一次调用时启动看门狗线程
+     */
+    void add(Scheduler* sc);
+
+    /**
+     *  @brief 停止监视调度器，返回后看门狗不会再访问它
+     */
+    void remove(Scheduler* sc);
+
+    /**
+     *  @brief 报告过的运行超时的次数
+     */
+    uint64_t getReportCount() const { return m_reportCount; }
+
+    /**
+     *  @brief 保留着报告记录的线程数
+     */
+    size_t getReportedThreads()
+    {
+        Mutex::Lock lock(m_mutex);
+        return m_reported.size();
+    }
+
+private:
+    Watchdog();
+
+    /**
+     *  @brief 看门狗线程的主循环
+     */
+    void run();
+
+    /**
+     *  @brief 采样一次所有调度器，报告运行超时的协程
+     */
+    void check();
+
+    /**
+     *  @brief 采集线程tid当前的调用栈
+     *  @return 是否在超时之前采集到
+     */
+    bool capture(pid_t tid, std::string& bt);
+
+    /**
+     *  @brief 安装采集调用栈的信号处理函数，只在看门狗线程上调用
+     *  @return 是否已经安装
+     */
+    bool installSignal();
+
+private:
+    /**
+     *  @brief 一个线程已经报告过的运行
+     */
+    struct Reported
+    {
+        uint64_t startUs = 0;   // 已经报告过的那次运行的开始时间，同一次运行只报告一次
+        uint64_t round = 0;     // 最后一次采样到这个线程的轮次
+    };
+
+
+    Mutex m_mutex;                              // 保护m_schedulers和m_reported
+    std::vector<Scheduler*> m_schedulers;       // 监视的调度器
+    std::map<pid_t, Reported> m_reported;       // 报告过的线程，采样不到的线程在当轮移除
+    uint64_t m_round = 0;                       // 采样的轮次
+    int m_signal = 0;                           // 已经安装了处理函数的信号，0表示还没有安装
+    std::vector<Scheduler::RunningSlice> m_slices;  // 采样缓冲区，反复使用，采样时不分配内存
+    Thread::ptr m_thread;                       // 看门狗线程
+    std::atomic<uint64_t> m_reportCount = {0};  // 报告的次数
+};
+
+}
@@ -0,0 +1,312 @@
+#include "affinity.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 当前线程绑定的NUMA节点
+static thread_local int t_numa_node = -1;
+
+bool ParseCpuList(const std::string& str, std::vector<int>& cpus)
+{
+    cpus.clear();
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if (item.empty())
+        {
+            continue;
+        }
+        int first = 0, last = 0;
+        char* end = nullptr;
+        first = strtol(item.c_str(), &end, 10);
+        if (end == item.c_str() || first < 0)
+        {
+            return false;
+        }
+        last = first;
+        if (*end == '-')
+        {
+            const char* p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+            {
+                return false;
+            }
+        }
+        if (*end != '\0')
+        {
+            return false;
+        }
+        for (int i = first; i <= last; ++i)
+        {
+            cpus.push_back(i);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus)
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < cpus.size(); )
+    {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+        {
+            ++j;
+        }
+        if (i)
+        {
+            ss << ",";
+        }
+        ss << cpus[i];
+        if (j > i)
+        {
+            ss << "-" << cpus[j];
+        }
+        i = j + 1;
+    }
+    return ss.str();
+}
+
+/*---------------------  CpuTopology  ------------------------*/
+
+CpuTopology::CpuTopology()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+        {
+            if (CPU_ISSET(i, &set))
+            {
+                m_cpus.push_back(i);
+            }
+        }
+    }
+    if (m_cpus.empty())
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long i = 0; i < n; ++i)
+        {
+            m_cpus.push_back(i);
+        }
+    }
+
+    // 节点编号可能不连续，按编号排序后用下标访问，编号另外保存
+    std::vector<std::pair<int, std::vector<int>>> nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir)
+    {
+        while (dirent* ent = readdir(dir))
+        {
+            int id = -1;
+            if (sscanf(ent->d_name, "node%d", &id) != 1)
+            {
+                continue;
+            }
+            std::ifstream ifs(std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist");
+            std::string line;
+            std::vector<int> cpus, allowed;
+            if (!std::getline(ifs, line) || !ParseCpuList(line, cpus))
+            {
+                continue;
+            }
+            std::set_intersection(cpus.begin(), cpus.end(), m_cpus.begin(), m_cpus.end(),
+                                  std::back_inserter(allowed));
+            if (!allowed.empty())
+            {
+                nodes.emplace_back(id, std::move(allowed));
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (auto& i : nodes)
+    {
+        m_nodeIds.push_back(i.first);
+        m_nodes.push_back(std::move(i.second));
+    }
+    if (m_nodes.empty())
+    {
+        m_nodeIds.push_back(0);
+        m_nodes.push_back(m_cpus);
+    }
+}
+
+const CpuTopology& CpuTopology::Get()
+{
+    static CpuTopology s_topology;
+    return s_topology;
+}
+
+int CpuTopology::getNodeOfCpu(int cpu) const
+{
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+    {
+        if (std::binary_search(m_nodes[i].begin(), m_nodes[i].end(), cpu))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int CpuTopology::getNodeIdOfCpus(const std::vector<int>& cpus) const
+{
+    if (cpus.empty())
+    {
+        return -1;
+    }
+    int node = getNodeOfCpu(cpus[0]);
+    for (int cpu : cpus)
+    {
+        if (getNodeOfCpu(cpu) != node)
+        {
+            return -1;
+        }
+    }
+    return node < 0 ? -1 : m_nodeIds[node];
+}
+
+/*---------------------  placement  ------------------------*/
+
+std::vector<std::vector<int>> PlanAffinity(const std::string& spec, size_t workers)
+{
+    std::vector<std::vector<int>> plan(workers);
+    const CpuTopology& topo = CpuTopology::Get();
+    size_t nodes = topo.getNodeCount();
+    if (spec.empty() || spec == "none")
+    {
+        return plan;
+    }
+    if (spec == "compact")
+    {
+        std::vector<int> order;
+        for (size_t n = 0; n < nodes; ++n)
+        {
+            order.insert(order.end(), topo.getNodeCpus(n).begin(), topo.getNodeCpus(n).end());
+        }
+        for (size_t i = 0; i < workers; ++i)
+        {
+            plan[i].push_back(order[i % order.size()]);
+        }
+    }
+    else if (spec == "scatter")
+    {
+        for (size_t i = 0; i < workers; ++i)
+        {
+            const std::vector<int>& cpus = topo.getNodeCpus(i % nodes);
+            plan[i].push_back(cpus[(i / nodes) % cpus.size()]);
+        }
+    }
+    else if (spec == "numa")
+    {
+        for (size_t i = 0; i < workers; ++i)
+        {
+            plan[i] = topo.getNodeCpus(i % nodes);
+        }
+    }
+    else
+    {
+        std::vector<int> cpus;
+        if (!ParseCpuList(spec, cpus))
+        {
+            SYLAR_LOG_ERROR(g_logger) << "invalid affinity policy: " << spec;
+            return std::vector<std::vector<int>>(workers);
+        }
+        for (size_t i = 0; i < workers; ++i)
+        {
+            plan[i].push_back(cpus[i % cpus.size()]);
+        }
+    }
+    return plan;
+}
+
+bool SetThreadAffinity(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+    {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "pthread_setaffinity_np fail, cpus=" << FormatCpuList(cpus)
+                                  << " rt=" << rt << " " << strerror(rt);
+        return false;
+    }
+
+    // 只有一个节点时不需要绑定内存
+    const CpuTopology& topo = CpuTopology::Get();
+    t_numa_node = topo.getNodeCount() > 1 ? topo.getNodeIdOfCpus(cpus) : -1;
+    return true;
+}
+
+std::vector<int> GetThreadAffinity()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+        {
+            if (CPU_ISSET(i, &set))
+            {
+                cpus.push_back(i);
+            }
+        }
+    }
+    return cpus;
+}
+
+int GetThreadNumaNode()
+{
+    return t_numa_node;
+}
+
+bool BindMemoryToNode(void* addr, size_t len, int node, bool move)
+{
+    if (node < 0 || node >= 64)
+    {
+        return false;
+    }
+    unsigned long mask = 1ul << node;
+    long rt = syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8,
+                      move ? MPOL_MF_MOVE : 0);
+    if (rt)
+    {
+        SYLAR_LOG_DEBUG(g_logger) << "mbind fail, node=" << node << " len=" << len
+                                  << " errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,88 @@
+#include "channel.h"
+
+namespace sylar
+{
+
+static thread_local uint32_t t_select_start = 0;
+
+/**
+ *  @brief 等待任意一个分支完成
+ *  @details 先不等待地检查一遍所有分支；都不能完成时把同一个等待者挂到所有通道上再挂起，
+ *           被任意一个通道唤醒后摘下所有节点重新检查。被通知但最后没有用上的通道，
+ *           要把通知转交给该通道上的其他等待者，否则它们会错过这次唤醒
+ */
+int Select::wait(uint64_t timeout_ms)
+{
+    size_t n = m_cases.size();
+    SYLAR_ASSERT2(n > 0, "select without any case");
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    std::vector<FiberWaitNode> nodes(n);
+    std::vector<char> notified(n);
+    while (true)
+    {
+        size_t start = t_select_start++;
+        for (size_t k = 0; k < n; ++k)
+        {
+            size_t i = (start + k) % n;
+            if (m_cases[i]->tryOp())
+            {
+                for (size_t j = 0; j < n; ++j)
+                {
+                    if (notified[j] && j != i)
+                    {
+                        m_cases[j]->forward();
+                    }
+                }
+                return i;
+            }
+        }
+        for (size_t j = 0; j < n; ++j)
+        {
+            if (notified[j])
+            {
+                m_cases[j]->forward();
+                notified[j] = 0;
+            }
+        }
+
+        uint64_t now = deadline == ~0ull ? 0 : GetCurrentMS();
+        if (now >= deadline)
+        {
+            return -1;
+        }
+
+        FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+        size_t registered = 0;
+        bool ready = false;
+        for (; registered < n; ++registered)
+        {
+            nodes[registered] = FiberWaitNode();
+            nodes[registered].waiter = w.get();
+            if (m_cases[registered]->enqueue(&nodes[registered]))
+            {
+                ready = true;
+                break;
+            }
+        }
+
+        if (ready)
+        {
+            // 已经挂上的节点可能被通知了，这时执行流一定会被交还回来，要挂起一次消耗掉
+            if (!w->cancel())
+            {
+                w->park();
+            }
+        }
+        else
+        {
+            w->park(deadline == ~0ull ? ~0ull : deadline - now);
+        }
+
+        for (size_t j = 0; j < registered; ++j)
+        {
+            notified[j] = m_cases[j]->dequeue(&nodes[j]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,153 @@
+#include "context.h"
+#include "log.h"
+#include "macro.h"
+
+#include <cstdint>
+
+namespace sylar
+{
+
+#ifdef SYLAR_ASM_CONTEXT
+
+#if defined(__x86_64__)
+
+/**
+ *  栈布局(从高地址到低地址)，切换出去时由 push 形成，切换回来时按相反顺序弹出:
+ *      返回地址 | rbp | rbx | r12 | r13 | r14 | r15 | mxcsr | x87控制字  <- sp
+ */
+__asm__(
+    ".pushsection .text\n"
+    ".globl sylar_asm_swap_context\n"
+    ".type sylar_asm_swap_context,@function\n"
+    ".align 16\n"
+    "sylar_asm_swap_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    fnstcw (%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    fldcw (%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size sylar_asm_swap_context,.-sylar_asm_swap_context\n"
+    ".popsection\n"
+);
+
+void MakeContext(Context* ctx, void* stack, size_t size, void (*fn)())
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)top;
+    *--sp = 0;                  // fn 的假返回地址，fn 不允许返回
+    *--sp = (uint64_t)fn;       // ret 弹出后跳转到 fn，此时 rsp % 16 == 8，符合函数入口的对齐要求
+    for (int i = 0; i < 6; ++i)
+    {
+        *--sp = 0;              // rbp rbx r12 r13 r14 r15
+    }
+    sp -= 2;
+    ((uint32_t*)sp)[2] = 0x1F80;    // mxcsr 默认值
+    ((uint16_t*)sp)[0] = 0x037F;    // x87 控制字默认值
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+/**
+ *  栈布局(从低地址到高地址):
+ *      x19-x28 | x29 x30 | d8-d15 | fpcr | 填充
+ */
+__asm__(
+    ".pushsection .text\n"
+    ".globl sylar_asm_swap_context\n"
+    ".type sylar_asm_swap_context,%function\n"
+    ".align 4\n"
+    "sylar_asm_swap_context:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mrs x9, fpcr\n"
+    "    str x9, [sp, #160]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldr x9, [sp, #160]\n"
+    "    msr fpcr, x9\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".size sylar_asm_swap_context,.-sylar_asm_swap_context\n"
+    ".popsection\n"
+);
+
+void MakeContext(Context* ctx, void* stack, size_t size, void (*fn)())
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 176);
+    for (int i = 0; i < 22; ++i)
+    {
+        sp[i] = 0;
+    }
+    sp[11] = (uint64_t)fn;      // x30，ret 之后跳转到 fn
+    ctx->sp = sp;
+}
+
+#else
+#error "SYLAR_ASM_CONTEXT is only supported on x86_64 and aarch64"
+#endif
+
+const char* ContextBackendName()
+{
+    return "asm";
+}
+
+#else
+
+void MakeContext(Context* ctx, void* stack, size_t size, void (*fn)())
+{
+    if (getcontext(&ctx->uc))
+    {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+    ctx->uc.uc_link = nullptr;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, fn, 0);
+}
+
+const char* ContextBackendName()
+{
+    return "ucontext";
+}
+
+#endif
+
+}
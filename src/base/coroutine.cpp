@@ -0,0 +1,184 @@
+#include "coroutine.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+namespace sylar
+{
+
+/**
+ *  @brief 把fd设为非阻塞，使用原始的fcntl，不影响hook记录的用户设置
+ */
+static void SetNonblock(int fd)
+{
+    int flags = fcntl_f(fd, F_GETFL, 0);
+    if (flags != -1 && !(flags & O_NONBLOCK))
+    {
+        fcntl_f(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+void ScheduleOn::await_suspend(std::coroutine_handle<> h)
+{
+    m_scheduler->schedule([h]() { h.resume(); }, m_priority);
+}
+
+void SleepFor::await_suspend(std::coroutine_handle<> h)
+{
+    IOManager* iom = IOManager::GetThis();
+    SYLAR_ASSERT2(iom, "SleepFor needs an IOManager");
+    iom->addTimer(m_ms, false, [h]() { h.resume(); });
+}
+
+WaitEvent::WaitEvent(int fd, IOManager::Event event, uint64_t timeout_ms)
+    : m_fd(fd)
+    , m_event(event)
+    , m_timeoutMs(timeout_ms)
+{
+}
+
+bool WaitEvent::await_suspend(std::coroutine_handle<> h)
+{
+    IOManager* iom = IOManager::GetThis();
+    SYLAR_ASSERT2(iom, "WaitEvent needs an IOManager");
+    // 和hook一样，超时定时器只持有弱引用，协程恢复并销毁等待者之后定时器不会再访问它
+    m_state = std::make_shared<State>();
+    if (m_timeoutMs != ~0ull)
+    {
+        std::weak_ptr<State> weak(m_state);
+        int fd = m_fd;
+        IOManager::Event event = m_event;
+        m_timer = iom->addTimerCondition(m_timeoutMs, false, [weak, fd, event, iom]() {
+            auto state = weak.lock();
+            if (!state || state->cancelled)
+            {
+                return;
+            }
+            state->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, event);
+        }, weak);
+    }
+    // 注册成功后事件随时可能在其他线程上就绪并恢复协程，之后不能再访问成员
+    Timer::ptr timer = m_timer;
+    int rt = iom->addEvent(m_fd, m_event, [h]() { h.resume(); });
+    if (rt)
+    {
+        // 大于0表示持久注册的fd已经就绪，不需要挂起
+        if (rt < 0)
+        {
+            m_error = errno ? errno : EINVAL;
+        }
+        if (timer)
+        {
+            timer->cancel();
+        }
+        return false;
+    }
+    return true;
+}
+
+int WaitEvent::await_resume()
+{
+    if (m_timer)
+    {
+        m_timer->cancel();
+        m_timer.reset();
+    }
+    if (m_error)
+    {
+        errno = m_error;
+        return -1;
+    }
+    if (m_state && m_state->cancelled)
+    {
+        errno = m_state->cancelled;
+        return -1;
+    }
+    return 0;
+}
+
+Task<ssize_t> AsyncRead(int fd, void* buf, size_t len, uint64_t timeout_ms)
+{
+    while (true)
+    {
+        ssize_t n = recv_f(fd, buf, len, MSG_DONTWAIT);
+        if (n >= 0 || (errno != EAGAIN && errno != EINTR))
+        {
+            co_return n;
+        }
+        if (errno == EAGAIN && co_await WaitEvent(fd, IOManager::READ, timeout_ms))
+        {
+            co_return -1;
+        }
+    }
+}
+
+Task<ssize_t> AsyncWrite(int fd, const void* buf, size_t len, uint64_t timeout_ms)
+{
+    while (true)
+    {
+        ssize_t n = send_f(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n >= 0 || (errno != EAGAIN && errno != EINTR))
+        {
+            co_return n;
+        }
+        if (errno == EAGAIN && co_await WaitEvent(fd, IOManager::WRITE, timeout_ms))
+        {
+            co_return -1;
+        }
+    }
+}
+
+Task<int> AsyncAccept(int fd, sockaddr* addr, socklen_t* addrlen, uint64_t timeout_ms)
+{
+    // 监听socket阻塞的话，就绪之后被别人抢先accept会阻塞整个线程
+    SetNonblock(fd);
+    while (true)
+    {
+        int client = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client >= 0)
+        {
+            FdMgr::GetInstance()->get(client, true);
+            co_return client;
+        }
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            co_return -1;
+        }
+        if (errno == EAGAIN && co_await WaitEvent(fd, IOManager::READ, timeout_ms))
+        {
+            co_return -1;
+        }
+    }
+}
+
+Task<int> AsyncConnect(int fd, const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms)
+{
+    SetNonblock(fd);
+    int rt = connect_f(fd, addr, addrlen);
+    if (rt == 0 || errno != EINPROGRESS)
+    {
+        co_return rt;
+    }
+    if (co_await WaitEvent(fd, IOManager::WRITE, timeout_ms))
+    {
+        co_return -1;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt_f(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+    {
+        co_return -1;
+    }
+    if (error)
+    {
+        errno = error;
+        co_return -1;
+    }
+    co_return 0;
+}
+
+}
@@ -2,9 +2,13 @@
 #include "log.h"
 #include "atomic"
 #include "config.h"
-#include "ucontext.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
 
 namespace sylar
 {
@@ -25,17 +29,71 @@ static thread_local Fiber::ptr t_thread_fiber;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", "fiber.stack_size", 128 * 1024);
 
+// 每个线程的共享运行栈数量
+static ConfigVar<uint32_t>::ptr g_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", "shared run stacks per thread", 4);
+
+// 每个共享运行栈的大小
+static ConfigVar<uint32_t>::ptr g_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", "shared run stack size", 1024 * 1024);
+
+// 全局静态变量，所有共享栈协程保存缓冲区的总字节数
+static std::atomic<uint64_t> s_shared_save_bytes{0};
+
+// 全局静态变量，已分配的协程局部存储槽位数
+static std::atomic<size_t> s_local_slots{0};
+
 /**
- * @brief malloc栈内存分配器
+ *  @brief 共享运行栈
+ *  @details occupant 是当前栈上保存着活跃数据的协程，其他协程要在这个栈上运行前必须先把它的栈拷贝出去
  */
-class MallocStackAllocator
+struct SharedStack
 {
-public:
-    static void* Alloc(size_t size) { return malloc(size); }
-    static void DeAlloc(void* p ,size_t size) { return free(p); }
+    void* stack = nullptr;                  // 栈的低地址
+    size_t size = 0;                        // 栈大小
+    StackAllocator* allocator = nullptr;    // 分配这个栈的分配器
+    std::atomic<Fiber*> occupant{nullptr};  // 当前占用栈的协程
+
+    ~SharedStack()
+    {
+        allocator->dealloc(stack, size);
+    }
 };
 
-using StackAllocator = MallocStackAllocator;
+// 线程局部变量，当前线程的共享运行栈，按协程创建顺序轮流分配
+static thread_local std::vector<std::shared_ptr<SharedStack>> t_shared_stacks;
+static thread_local size_t t_shared_stack_next = 0;
+
+/**
+ *  @brief 为新的共享栈协程挑选一个当前线程的运行栈，第一次调用时创建
+ */
+static std::shared_ptr<SharedStack> GetSharedStack()
+{
+    if (t_shared_stacks.empty())
+    {
+        uint32_t count = std::max<uint32_t>(1, g_shared_stack_count->getValue());
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto ss = std::make_shared<SharedStack>();
+            ss->size = g_shared_stack_size->getValue();
+            ss->allocator = StackAllocator::GetDefault();
+            ss->stack = ss->allocator->alloc(ss->size);
+            SYLAR_ASSERT2(ss->stack, "alloc shared stack fail");
+            t_shared_stacks.push_back(ss);
+        }
+    }
+    return t_shared_stacks[t_shared_stack_next++ % t_shared_stacks.size()];
+}
+
+#ifndef SYLAR_ASM_CONTEXT
+/**
+ *  @brief 返回调用者栈帧之下的地址，ucontext实现下用来估计切出时的栈顶
+ */
+static __attribute__((noinline)) void* CurrentStackPointer()
+{
+    return __builtin_frame_address(0);
+}
+#endif
 
 /**
  *  @brief 无参构造函数
@@ -46,10 +104,6 @@ Fiber::Fiber()
 {
     SetThis(this);
     m_state = RUNNING;
-    if (getcontext(&m_ctx))
-    {
-        SYLAR_ASSERT2(false,"getcontent");
-    }
     ++s_fiber_count;
     m_id = s_fiber_id++;
 
@@ -60,23 +114,29 @@ Fiber::Fiber()
  *  @brief 有参构造函数
  *  @details 该构造函数主要用于创建子协程，该协程为线程的主协程的子协程
  */
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(Callback cb, size_t stacksize, bool run_in_scheduler, bool shared_stack)
     : m_id(s_fiber_id++)
-    , m_cb(cb)
+    , m_cb(std::move(cb))
     , m_runInScheduler(run_in_scheduler) 
 {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if (getcontext(&m_ctx))
+    if (shared_stack)
     {
-        SYLAR_ASSERT2(false, "getcontext");
+        // 运行栈上可能还保存着其他协程的数据，上下文要等切入时才能初始化
+        m_sharedStack = GetSharedStack();
+        m_stack = m_sharedStack->stack;
+        m_stacksize = m_sharedStack->size;
+        m_ownerThread = GetThreadId();
+        m_needMake = true;
+    }
+    else
+    {
+        m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+        m_allocator = StackAllocator::GetDefault();
+        m_stack = m_allocator->alloc(m_stacksize);
+        SYLAR_ASSERT2(m_stack, "alloc fiber stack fail");
+        MakeContext(&m_ctx, m_stack, m_stacksize, Fiber::MainFunc);
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, Fiber::MainFunc,0);
 
     SYLAR_LOG_INFO(g_logger) << "Fiber::Fiber() id=" << m_id;
 }
@@ -87,12 +147,23 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
 Fiber::~Fiber()
 {
     SYLAR_LOG_INFO(g_logger) << "Fiber::~Fiber() id = " << m_id;
+    clearLocals();
     --s_fiber_count;
     if (m_stack)    // 这说明有栈，这是个子协程
     {
         SYLAR_ASSERT(m_state == TERM);
-        StackAllocator::DeAlloc(m_stack, m_stacksize);
-        SYLAR_LOG_DEBUG(g_logger) << "dealloc stack, id = " << m_id;
+        if (m_sharedStack)
+        {
+            Fiber* self = this;
+            m_sharedStack->occupant.compare_exchange_strong(self, nullptr);
+            s_shared_save_bytes -= m_saveCap;
+            free(m_saveBuf);
+        }
+        else
+        {
+            m_allocator->dealloc(m_stack, m_stacksize);
+            SYLAR_LOG_DEBUG(g_logger) << "dealloc stack, id = " << m_id;
+        }
     }
     else            // 这说明没栈，这是个主协程
     {
@@ -111,23 +182,82 @@ Fiber::~Fiber()
 /**
  *  @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈
  */
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(Callback cb)
 {
     SYLAR_ASSERT(m_stack);
     SYLAR_ASSERT(m_state == TERM);
-    m_cb = cb;
-    if (getcontext(&m_ctx))
+    clearLocals();
+    m_cb = std::move(cb);
+    if (m_sharedStack)
     {
-        SYLAR_ASSERT2(false,"getcontext");
+        m_needMake = true;
+        m_saveSize = 0;
+    }
+    else
+    {
+        MakeContext(&m_ctx, m_stack, m_stacksize, Fiber::MainFunc);
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    m_ctx.uc_stack.ss_sp = m_stack;
-
-    makecontext(&m_ctx,Fiber::MainFunc,0);
     m_state = READY;
 }
 
+/**
+ *  @brief 把共享栈上的活跃部分拷贝到保存缓冲区
+ */
+void Fiber::saveSharedStack()
+{
+#ifdef SYLAR_ASM_CONTEXT
+    char* sp = (char*)m_ctx.sp;
+#else
+    char* sp = (char*)m_sharedSp;
+#endif
+    char* top = (char*)m_stack + m_stacksize;
+    SYLAR_ASSERT(sp >= (char*)m_stack && sp <= top);
+    size_t size = top - sp;
+
+    // 保存缓冲区按实际使用量分配，明显偏大时收缩
+    if (m_saveCap < size || m_saveCap > size * 2)
+    {
+        size_t cap = (size + 63) & ~(size_t)63;
+        m_saveBuf = (char*)realloc(m_saveBuf, cap);
+        SYLAR_ASSERT2(m_saveBuf || !cap, "alloc shared stack save buffer fail");
+        s_shared_save_bytes += cap;
+        s_shared_save_bytes -= m_saveCap;
+        m_saveCap = cap;
+    }
+    memcpy(m_saveBuf, sp, size);
+    m_saveSize = size;
+}
+
+/**
+ *  @brief 共享栈协程切入前的准备：保存运行栈上原占用者的栈，再恢复自己的栈
+ */
+void Fiber::switchInSharedStack()
+{
+    SYLAR_ASSERT2(m_ownerThread == GetThreadId(), "shared stack fiber resumed on another thread");
+    // 调用resume的协程自己不能运行在同一个共享栈上
+    SYLAR_ASSERT(!t_fiber || t_fiber->m_sharedStack != m_sharedStack);
+
+    Fiber* occupant = m_sharedStack->occupant.load();
+    if (occupant != this)
+    {
+        // 结束的协程在最后一次切出时已经释放了占用，这里的占用者一定处于READY状态
+        if (occupant)
+        {
+            occupant->saveSharedStack();
+        }
+        m_sharedStack->occupant.store(this);
+        if (!m_needMake && m_saveSize)
+        {
+            memcpy((char*)m_stack + m_stacksize - m_saveSize, m_saveBuf, m_saveSize);
+        }
+    }
+    if (m_needMake)
+    {
+        MakeContext(&m_ctx, m_stack, m_stacksize, Fiber::MainFunc);
+        m_needMake = false;
+    }
+}
+
 
 /**
  *  @brief 将当前协程切到执行状态
@@ -136,25 +266,28 @@ void Fiber::reset(std::function<void()> cb)
 void Fiber::resume()
 {
     SYLAR_ASSERT(m_state != TERM && m_state != RUNNING);
+    if (m_sharedStack)
+    {
+        switchInSharedStack();
+    }
     SetThis(this);
     m_state = RUNNING;
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) 
     {
-        if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx))
-         {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
     } 
     else 
     {
-        if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) 
-        {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(&(t_thread_fiber->m_ctx), &m_ctx);
     }
 
+    // 协程已经完整地切换出来了，此时才能被其他线程恢复
+    if (m_state == RUNNING)
+    {
+        m_state = READY;
+    }
 }
 
 /**
@@ -165,30 +298,76 @@ void Fiber::yield()
 {
     // 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
     SYLAR_ASSERT(m_state == RUNNING || m_state == TERM);
-    if (m_state != TERM) 
+    // 这里不改为READY：切换完成前协程仍在使用本线程的栈，状态由resume返回后修改
+    if (m_sharedStack)
     {
-        m_state = READY;
+        if (m_state == TERM)
+        {
+            // 结束后栈上的数据不再需要保存，直接让出运行栈
+            m_sharedStack->occupant.store(nullptr);
+        }
+#ifndef SYLAR_ASM_CONTEXT
+        else
+        {
+            m_sharedSp = std::max((char*)CurrentStackPointer() - 64, (char*)m_stack);
+        }
+#endif
     }
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) 
     {
         SetThis(Scheduler::GetMainFiber());
-        if (swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) 
-        {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
     } 
     else 
     {
         SetThis(t_thread_fiber.get());
-        if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) 
+        SwapContext(&m_ctx, &(t_thread_fiber->m_ctx));
+    }
+}
+
+
+/**
+ *  @brief 设置协程局部存储槽位上的值，原来的值用它自己的destroy析构
+ */
+void Fiber::setLocal(size_t slot, void* value, void (*destroy)(void*))
+{
+    if (slot >= m_locals.size())
+    {
+        m_locals.resize(std::max(slot + 1, (size_t)s_local_slots));
+    }
+    LocalSlot old = m_locals[slot];
+    m_locals[slot].value = value;
+    m_locals[slot].destroy = destroy;
+    if (old.value)
+    {
+        old.destroy(old.value);
+    }
+}
+
+/**
+ *  @brief 析构所有协程局部存储的值
+ *  @details 析构函数可能再设置其他槽位，所以先清空槽位再析构，直到一遍扫描下来都是空的
+ */
+void Fiber::clearLocals()
+{
+    bool found = true;
+    while (found)
+    {
+        found = false;
+        for (size_t i = 0; i < m_locals.size(); ++i)
         {
-            SYLAR_ASSERT2(false, "swapcontext");
+            LocalSlot slot = m_locals[i];
+            if (slot.value)
+            {
+                m_locals[i] = LocalSlot();
+                slot.destroy(slot.value);
+                found = true;
+            }
         }
     }
 }
 
-
 /**
  *  @brief 设置当前正在执行的协程，即设置线程局部变量 t_fiber
  */
@@ -204,16 +383,24 @@ void Fiber::SetThis(Fiber *f)
  *  @attention 线程如果要创建协程，那么应该首先执行一下Fiber::GetThis()操作，以初始化主函数协程
  */
 Fiber::ptr Fiber::GetThis()
+{
+    return Fiber::ptr(GetThisRaw());
+}
+
+/**
+ *  @brief 借用正在执行的协程，不增加引用计数
+ */
+Fiber* Fiber::GetThisRaw()
 {
     if (t_fiber)
     {
-        return t_fiber->shared_from_this();
+        return t_fiber;
     }
 
     Fiber::ptr main_fiber(new Fiber);
     SYLAR_ASSERT(main_fiber.get() == t_fiber);
-    t_thread_fiber = main_fiber;
-    return t_fiber->shared_from_this();
+    t_thread_fiber = std::move(main_fiber);
+    return t_fiber;
 }
 
 /**
@@ -233,6 +420,8 @@ void Fiber::MainFunc()
     SYLAR_ASSERT(cur);
     cur->m_cb();
     cur->m_cb    = nullptr;
+    // 局部存储的值在协程自己的栈上析构，析构函数还可以访问其他协程局部存储
+    cur->clearLocals();
     cur->m_state = TERM;
 
     auto raw_ptr = cur.get(); // 手动让t_fiber的引用计数减1
@@ -254,4 +443,20 @@ uint64_t Fiber::GetFiberId()
     return 0;
 }
 
+/**
+ *  @brief 获得所有共享栈协程保存缓冲区的总字节数
+ */
+uint64_t Fiber::GetSharedStackSaveBytes()
+{
+    return s_shared_save_bytes;
+}
+
+/**
+ *  @brief 分配一个新的协程局部存储槽位
+ */
+size_t Fiber::AllocLocalSlot()
+{
+    return s_local_slots++;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,425 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "iomanager.h"
+#include "macro.h"
+
+namespace sylar
+{
+
+/**
+ *  @brief 为当前执行流创建等待者
+ *  @details 只有调度器调度的协程才能挂起让出执行权，其他情况只能阻塞线程
+ */
+FiberWaiter::FiberWaiter()
+{
+    m_node.waiter = this;
+    Scheduler* sc = Scheduler::GetThis();
+    if (sc)
+    {
+        Fiber* cur = Fiber::GetThisRaw();
+        if (cur != Scheduler::GetMainFiber() && cur->isRunInScheduler())
+        {
+            m_fiber.reset(cur);
+            m_scheduler = sc;
+        }
+    }
+}
+
+/**
+ *  @brief 挂起当前执行流直到被通知或超时
+ */
+bool FiberWaiter::park(uint64_t timeout_ms)
+{
+    if (!m_fiber)
+    {
+        if (timeout_ms == ~0ull)
+        {
+            m_sem.wait();
+            return true;
+        }
+        if (m_sem.waitFor(timeout_ms))
+        {
+            return true;
+        }
+        int expect = WAITING;
+        if (m_state.compare_exchange_strong(expect, TIMEOUT))
+        {
+            return false;
+        }
+        // 超时的同时被通知了，通知方一定会释放信号量
+        m_sem.wait();
+        return true;
+    }
+
+    // 定时器持有等待者，超时回调执行时等待者一定还活着
+    FiberWaiter::ptr self;
+    if (timeout_ms != ~0ull)
+    {
+        IOManager* iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "fiber sync timeout needs an IOManager");
+        self = shared_from_this();
+        m_timer = iom->addTimer(timeout_ms, false, [self]() {
+            int expect = WAITING;
+            if (self->m_state.compare_exchange_strong(expect, TIMEOUT))
+            {
+                self->wakeup();
+            }
+        });
+    }
+
+    // 加入等待队列后才让出，通知方可能在让出之前就调度了本协程，
+    // 调度器会等它真正切出去(不再是RUNNING)之后才恢复它
+    // m_fiber在被恢复之前不会被清空，借用即可
+    m_fiber->yield();
+    m_fiber.reset();
+
+    if (m_state == NOTIFIED)
+    {
+        if (m_timer)
+        {
+            m_timer->cancel();
+            m_timer.reset();
+        }
+        return true;
+    }
+    m_timer.reset();
+    return false;
+}
+
+/**
+ *  @brief 唤醒等待者
+ */
+bool FiberWaiter::notify()
+{
+    int expect = WAITING;
+    if (!m_state.compare_exchange_strong(expect, NOTIFIED))
+    {
+        return false;
+    }
+    wakeup();
+    return true;
+}
+
+/**
+ *  @brief 等待者自己放弃等待
+ */
+bool FiberWaiter::cancel()
+{
+    int expect = WAITING;
+    return m_state.compare_exchange_strong(expect, TIMEOUT);
+}
+
+/**
+ *  @brief 把挂起的执行流交还给调度器或者释放信号量
+ *  @details 交还之后等待者随时可能被销毁，之后不能再访问成员
+ */
+void FiberWaiter::wakeup()
+{
+    if (m_fiber)
+    {
+        Scheduler* sc = m_scheduler;
+        Fiber::ptr fiber = m_fiber;
+        sc->schedule(std::move(fiber));
+    }
+    else
+    {
+        m_sem.notify();
+    }
+}
+
+void FiberWaitQueue::push(FiberWaitNode* node)
+{
+    node->prev = m_tail;
+    node->next = nullptr;
+    if (m_tail)
+    {
+        m_tail->next = node;
+    }
+    else
+    {
+        m_head = node;
+    }
+    m_tail = node;
+    node->linked = true;
+}
+
+bool FiberWaitQueue::remove(FiberWaitNode* node)
+{
+    if (!node->linked)
+    {
+        return false;
+    }
+    if (node->prev)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        m_head = node->next;
+    }
+    if (node->next)
+    {
+        node->next->prev = node->prev;
+    }
+    else
+    {
+        m_tail = node->prev;
+    }
+    node->prev = node->next = nullptr;
+    node->linked = false;
+    return true;
+}
+
+bool FiberWaitQueue::notifyOne()
+{
+    while (m_head)
+    {
+        FiberWaitNode* node = m_head;
+        remove(node);
+        if (node->waiter->notify())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FiberMutex::lockFor(uint64_t timeout_ms)
+{
+    Mutex::Lock lock(m_mutex);
+    if (!m_locked)
+    {
+        m_locked = true;
+        return true;
+    }
+    if (timeout_ms == 0)
+    {
+        return false;
+    }
+    FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+    m_waiters.push(w.get());
+    lock.unlock();
+
+    // 被唤醒时锁已经交给了自己
+    if (w->park(timeout_ms))
+    {
+        return true;
+    }
+    lock.lock();
+    m_waiters.remove(w.get());
+    return false;
+}
+
+bool FiberMutex::tryLock()
+{
+    return lockFor(0);
+}
+
+void FiberMutex::unlock()
+{
+    Mutex::Lock lock(m_mutex);
+    SYLAR_ASSERT2(m_locked, "unlock a FiberMutex which is not locked");
+    if (!m_waiters.notifyOne())
+    {
+        m_locked = false;
+    }
+}
+
+bool FiberRWMutex::rdlockFor(uint64_t timeout_ms)
+{
+    Mutex::Lock lock(m_mutex);
+    if (!m_writer && m_waitingWriters == 0)
+    {
+        ++m_readers;
+        return true;
+    }
+    if (timeout_ms == 0)
+    {
+        return false;
+    }
+    FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+    m_waiters.push(w.get());
+    lock.unlock();
+
+    if (w->park(timeout_ms))
+    {
+        return true;
+    }
+    lock.lock();
+    m_waiters.remove(w.get());
+    return false;
+}
+
+bool FiberRWMutex::wrlockFor(uint64_t timeout_ms)
+{
+    Mutex::Lock lock(m_mutex);
+    if (!m_writer && m_readers == 0)
+    {
+        m_writer = true;
+        return true;
+    }
+    if (timeout_ms == 0)
+    {
+        return false;
+    }
+    FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+    w->setWriter(true);
+    m_waiters.push(w.get());
+    ++m_waitingWriters;
+    lock.unlock();
+
+    if (w->park(timeout_ms))
+    {
+        return true;
+    }
+    lock.lock();
+    // 超时之后grant()可能已经把自己摘下并减过计数了
+    if (m_waiters.remove(w.get()))
+    {
+        --m_waitingWriters;
+    }
+    // 超时的写者可能挡住了后面的读者
+    grant();
+    return false;
+}
+
+void FiberRWMutex::unlock()
+{
+    Mutex::Lock lock(m_mutex);
+    if (m_writer)
+    {
+        m_writer = false;
+    }
+    else
+    {
+        SYLAR_ASSERT2(m_readers > 0, "unlock a FiberRWMutex which is not locked");
+        --m_readers;
+    }
+    grant();
+}
+
+/**
+ *  @brief 锁空闲时把它交给等待队列的队头
+ *  @details 调用者持有 m_mutex。交给写者时由这里置 m_writer，交给读者时由这里增加 m_readers，
+ *           被唤醒的一方直接持有锁返回
+ */
+void FiberRWMutex::grant()
+{
+    if (m_writer)
+    {
+        return;
+    }
+    while (!m_waiters.empty())
+    {
+        FiberWaiter* w = m_waiters.front()->waiter;
+        if (w->isWriter())
+        {
+            if (m_readers > 0)
+            {
+                return;
+            }
+            m_waiters.remove(w);
+            --m_waitingWriters;
+            if (w->notify())
+            {
+                m_writer = true;
+                return;
+            }
+        }
+        else
+        {
+            m_waiters.remove(w);
+            if (w->notify())
+            {
+                ++m_readers;
+            }
+        }
+    }
+}
+
+FiberWaiter::ptr FiberCondition::enqueue()
+{
+    FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+    Mutex::Lock lock(m_mutex);
+    m_waiters.push(w.get());
+    return w;
+}
+
+bool FiberCondition::park(const FiberWaiter::ptr& w, uint64_t timeout_ms)
+{
+    if (w->park(timeout_ms))
+    {
+        return true;
+    }
+    Mutex::Lock lock(m_mutex);
+    m_waiters.remove(w.get());
+    return false;
+}
+
+void FiberCondition::notify()
+{
+    Mutex::Lock lock(m_mutex);
+    m_waiters.notifyOne();
+}
+
+void FiberCondition::notifyAll()
+{
+    Mutex::Lock lock(m_mutex);
+    while (m_waiters.notifyOne());
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count)
+    : m_count(count)
+{
+}
+
+bool FiberSemaphore::waitFor(uint64_t timeout_ms)
+{
+    Mutex::Lock lock(m_mutex);
+    if (m_count > 0)
+    {
+        --m_count;
+        return true;
+    }
+    if (timeout_ms == 0)
+    {
+        return false;
+    }
+    FiberWaiter::ptr w = std::make_shared<FiberWaiter>();
+    m_waiters.push(w.get());
+    lock.unlock();
+
+    if (w->park(timeout_ms))
+    {
+        return true;
+    }
+    lock.lock();
+    m_waiters.remove(w.get());
+    return false;
+}
+
+bool FiberSemaphore::tryWait()
+{
+    return waitFor(0);
+}
+
+void FiberSemaphore::notify(uint32_t n)
+{
+    Mutex::Lock lock(m_mutex);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        // 有等待者时计数直接交给它
+        if (!m_waiters.notifyOne())
+        {
+            ++m_count;
+        }
+    }
+}
+
+uint32_t FiberSemaphore::getCount()
+{
+    Mutex::Lock lock(m_mutex);
+    return m_count;
+}
+
+}
@@ -0,0 +1,57 @@
+#include "future.h"
+
+namespace sylar
+{
+
+WaitGroup::WaitGroup(int64_t count)
+    : m_count(count)
+{
+}
+
+void WaitGroup::add(int64_t n)
+{
+    m_count += n;
+}
+
+/**
+ *  @brief 一个任务完成
+ *  @details 在锁内减计数并通知：等待方要拿到锁才能确认计数归零返回，
+ *           这样它析构 WaitGroup 时这里已经不再访问成员
+ */
+void WaitGroup::done()
+{
+    Mutex::Lock lock(m_mutex);
+    int64_t left = --m_count;
+    SYLAR_ASSERT2(left >= 0, "WaitGroup::done() called more times than add()");
+    if (left == 0)
+    {
+        m_cond.notifyAll();
+    }
+}
+
+void WaitGroup::wait()
+{
+    Mutex::Lock lock(m_mutex);
+    while (m_count > 0)
+    {
+        m_cond.wait(lock);
+    }
+}
+
+bool WaitGroup::waitFor(uint64_t timeout_ms)
+{
+    uint64_t deadline = GetCurrentMS() + timeout_ms;
+    Mutex::Lock lock(m_mutex);
+    while (m_count > 0)
+    {
+        uint64_t now = GetCurrentMS();
+        if (now >= deadline)
+        {
+            return false;
+        }
+        m_cond.waitFor(lock, deadline - now);
+    }
+    return true;
+}
+
+}
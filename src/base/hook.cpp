@@ -5,6 +5,7 @@
 #include <cstdarg>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include "config.h"
 #include "log.h"
@@ -110,6 +111,60 @@ struct timer_info
     int cancelled = 0;
 };
 
+#ifdef SYLAR_HAS_IO_URING
+/**
+ *  @brief 按被hook函数的参数填写 io_uring 请求，数据未就绪时由内核在就绪后直接完成这次操作
+ *  @details 只处理socket，所以read/write等同于flags为0的recv/send；其余参数形式(readv、recvfrom等)不支持，返回false后走epoll
+ */
+static void uring_init(io_uring_sqe& sqe, uint8_t opcode, int fd)
+{
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+}
+
+template<typename... Args>
+static bool uring_prep(io_uring_sqe&, uint32_t, int, Args&&...)
+{
+    return false;
+}
+
+static bool uring_prep(io_uring_sqe& sqe, uint32_t event, int fd, void* buf, size_t len, int flags = 0)
+{
+    uring_init(sqe, IORING_OP_RECV, fd);
+    sqe.addr = (uint64_t)(uintptr_t)buf;
+    sqe.len = len;
+    sqe.msg_flags = flags;
+    return event == sylar::IOManager::READ;
+}
+
+static bool uring_prep(io_uring_sqe& sqe, uint32_t event, int fd, const void* buf, size_t len, int flags = 0)
+{
+    uring_init(sqe, IORING_OP_SEND, fd);
+    sqe.addr = (uint64_t)(uintptr_t)buf;
+    sqe.len = len;
+    sqe.msg_flags = flags;
+    return event == sylar::IOManager::WRITE;
+}
+
+static bool uring_prep(io_uring_sqe& sqe, uint32_t event, int fd, sockaddr* addr, socklen_t* addrlen)
+{
+    uring_init(sqe, IORING_OP_ACCEPT, fd);
+    sqe.addr = (uint64_t)(uintptr_t)addr;
+    sqe.addr2 = (uint64_t)(uintptr_t)addrlen;
+    return event == sylar::IOManager::READ;
+}
+
+/**
+ *  @brief 当前协程能否把IO交给 io_uring
+ *  @details 请求里的缓冲区通常在协程栈上，共享栈协程挂起后运行栈由别的协程使用，内核写进去会破坏别的协程，只能走epoll
+ */
+static bool use_uring(sylar::IOManager* iom)
+{
+    return iom && iom->hasUring() && !sylar::Fiber::GetThisRaw()->isSharedStack();
+}
+#endif
+
 /**
  *  @brief  把传进来的任意 IO 函数（如 read、write、recv）及其参数原封不动地“转发”给真正的系统调用，但在需要 hook 的时候可以加以拦截、处理。
  *  @param[in]  fd  文件句柄
@@ -172,6 +227,20 @@ retry:
     {
         // 获得当前IO协程调度器
         sylar::IOManager* iom = sylar::IOManager::GetThis();
+#ifdef SYLAR_HAS_IO_URING
+        // io_uring 后端把这次操作整个交给内核，完成后直接拿到结果，不用注册事件再重试一次
+        io_uring_sqe sqe;
+        if (use_uring(iom) && uring_prep(sqe, event, fd, args...))
+        {
+            int res = iom->submitIo(sqe, to);
+            if (res < 0)
+            {
+                errno = -res;
+                return -1;
+            }
+            return res;
+        }
+#endif
         // 设置一个定时器
         sylar::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
@@ -189,10 +258,16 @@ retry:
                 iom->cancelEvent(fd, static_cast<sylar::IOManager::Event>(event));
             }, winfo);
         }
-        // 将 fd 对应的事件 event 添加到 epoll 内核事件表
-        int rt = iom->addEvent(fd, static_cast<sylar::IOManager::Event>(event));
+        // 持久注册时fd第一次需要等待才注册到epoll，之后等待和唤醒都不再调用epoll_ctl
+        if (iom->isPersistentEvents() && ctx->getArmedIn() != iom && iom->armEvents(fd) == 0)
+        {
+            ctx->setArmedIn(iom);
+        }
+        // 将 fd 对应的事件 event 添加到 epoll 内核事件表，已经持久注册的fd不再调用epoll_ctl
+        int rt = ctx->getArmedIn() == iom ? iom->addArmedEvent(fd, static_cast<sylar::IOManager::Event>(event))
+                                          : iom->addEvent(fd, static_cast<sylar::IOManager::Event>(event));
         // 这表示往epoll添加事件失败
-        if (SYLAR_UNLIKELY(rt))
+        if (SYLAR_UNLIKELY(rt < 0))
         {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                                       << fd << ", " << event << ")";
@@ -202,11 +277,20 @@ retry:
             }
             return -1;
         }
+        // 这表示持久注册的fd在等待之前已经就绪，直接重试
+        else if (rt > 0)
+        {
+            if (timer)
+            {
+                timer->cancel();
+            }
+            goto retry;
+        }
         // 这表示往epoll添加事件成功
         else
         {
             // 当前协程让出执行权
-            sylar::Fiber::GetThis()->yield();
+            sylar::Fiber::GetThisRaw()->yield();
             if (timer)
             {
                 timer->cancel();
@@ -229,6 +313,25 @@ retry:
 
 
 
+/**
+ *  @brief IOManager配置了 iomanager.busy_poll.socket_us 时给新的socket设置SO_BUSY_POLL
+ *  @details 阻塞读取时由内核先在网卡队列上轮询一段时间，需要网卡驱动支持，设置失败不影响使用
+ */
+static void set_busy_poll(int fd)
+{
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if (!iom || !iom->getSocketBusyPollUs())
+    {
+        return;
+    }
+    int us = iom->getSocketBusyPollUs();
+    if (setsockopt_f(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0)
+    {
+        SYLAR_LOG_DEBUG(g_logger) << "setsockopt(" << fd << ", SO_BUSY_POLL, " << us << ") errno="
+                                  << errno << " " << strerror(errno);
+    }
+}
+
 /*<-------------------------------------------------------------------->*/
 extern "C"
 {
@@ -249,14 +352,14 @@ unsigned int sleep(unsigned int seconds)
     }
     // 这说明当前线程被hook
     SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << "hook start";
-    sylar::Fiber::ptr fiber  = sylar::Fiber::GetThis();         // 获得当前线程正在执行的协程
+    sylar::Fiber::ptr fiber(sylar::Fiber::GetThisRaw());        // 定时器持有当前线程正在执行的协程
     sylar::IOManager* iom = sylar::IOManager::GetThis();        // 获得当前线程所属的IO协程调度器
-    // 
-    iom->addTimer(seconds * 1000, false, [iom, fiber](){
+    // 一次性定时器的回调只执行一次，直接把持有的协程交给调度器
+    iom->addTimer(seconds * 1000, false, [iom, fiber = std::move(fiber)]() mutable {
         SYLAR_LOG_DEBUG(SYLAR_LOG_ROOT()) << "Timer triggered, scheduling fiber.";
-        iom->schedule(fiber);
+        iom->schedule(std::move(fiber));
     });
-    sylar::Fiber::GetThis()->yield();                    // 因为要睡眠，所以要让出执行权
+    sylar::Fiber::GetThisRaw()->yield();                    // 因为要睡眠，所以要让出执行权
     return 0;
 }
 
@@ -266,12 +369,12 @@ int usleep(useconds_t usec)
     {
         return usleep_f(usec);
     }
-    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(sylar::Fiber::GetThisRaw());
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(usec/1000, false, [iom, fiber](){
-        iom->schedule(fiber);
+    iom->addTimer(usec/1000, false, [iom, fiber = std::move(fiber)]() mutable {
+        iom->schedule(std::move(fiber));
     });
-    sylar::Fiber::GetThis()->yield();
+    sylar::Fiber::GetThisRaw()->yield();
     return 0;
 }
 
@@ -283,12 +386,12 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
     }
 
     int timeout_ms = req->tv_sec * 1000 +  req->tv_nsec/1000/1000;
-    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(sylar::Fiber::GetThisRaw());
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(timeout_ms, false, [iom, fiber]() {
-        iom->schedule(fiber, -1);
+    iom->addTimer(timeout_ms, false, [iom, fiber = std::move(fiber)]() mutable {
+        iom->schedule(std::move(fiber), -1);
     });
-    sylar::Fiber::GetThis()->yield();
+    sylar::Fiber::GetThisRaw()->yield();
     return 0;
 }
 
@@ -305,7 +408,12 @@ int socket(int domain, int type, int protocol)
     {
         return fd;
     }
-    sylar::FdMgr::GetInstance()->get(fd, true);
+    // 没有经过hook关闭的旧句柄会留下FdCtx，新句柄不能沿用它的持久注册状态
+    sylar::FdMgr::GetInstance()->get(fd, true)->setArmedIn(nullptr);
+    if (domain == AF_INET || domain == AF_INET6)
+    {
+        set_busy_poll(fd);
+    }
     return fd;
 }
 
@@ -332,6 +440,27 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
     
+#ifdef SYLAR_HAS_IO_URING
+    // io_uring 后端直接把连接交给内核，完成时的结果就是连接的最终结果
+    sylar::IOManager* uring_iom = sylar::IOManager::GetThis();
+    if (use_uring(uring_iom))
+    {
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)addr;
+        sqe.off = addrlen;
+        int res = uring_iom->submitIo(sqe, timeout_ms);
+        if (res < 0)
+        {
+            errno = -res;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
     // 尝试连接fd到给定的地址
     int n = connect_f(fd, addr, addrlen);
     // 这表示直接连接成功
@@ -363,13 +492,27 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
             iom->cancelEvent(fd, sylar::IOManager::WRITE);  // 由于该协程被唤醒, 在内核事件表 epoll 上删除该 fd 感兴趣的写事件
     }, winfo);
     }
+    // 持久注册时这里就把fd注册到epoll，之后的读写不再调用epoll_ctl
+    if (iom->isPersistentEvents() && ctx->getArmedIn() != iom && iom->armEvents(fd) == 0)
+    {
+        ctx->setArmedIn(iom);
+    }
     // 给 epoll 注册该 fd，监听该 fd 上的事件
-    int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
+    int rt = ctx->getArmedIn() == iom ? iom->addArmedEvent(fd, sylar::IOManager::WRITE)
+                                      : iom->addEvent(fd, sylar::IOManager::WRITE);
+    // 这表示已经连接完成(持久注册的fd在等待之前已经就绪)
+    if (rt > 0)
+    {
+        if (timer)
+        {
+            timer->cancel();
+        }
+    }
     // 这表示注册成功
-    if (rt == 0)
+    else if (rt == 0)
     {
         // 让出当前协程的执行权
-        sylar::Fiber::GetThis()->yield();
+        sylar::Fiber::GetThisRaw()->yield();
         // 唤醒后检查是否被定时器取消
         if (timer)
         {
@@ -420,7 +563,8 @@ int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen)
     int fd = do_io(sockfd, accept_f, "accept", sylar::IOManager::READ,SO_RCVTIMEO, addr,addrlen);
     if (fd >= 0)
     {
-        sylar::FdMgr::GetInstance()->get(fd, true);
+        sylar::FdMgr::GetInstance()->get(fd, true)->setArmedIn(nullptr);
+        set_busy_poll(fd);
     }
     return fd;
 }
@@ -0,0 +1,278 @@
+#include "io_uring.h"
+#include "log.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+#ifdef SYLAR_HAS_IO_URING
+
+static int SysSetup(uint32_t entries, io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int SysEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int SysRegister(int fd, uint32_t opcode, const void* arg, uint32_t nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::ptr IoUring::Create(uint32_t entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = SysSetup(entries, &params);
+    if (fd < 0)
+    {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") fail errno=" << errno
+                                 << " " << strerror(errno);
+        return nullptr;
+    }
+    IoUring::ptr ring(new IoUring);
+    ring->m_fd = fd;
+
+    // 完成事件中的偏移按内核告诉的布局计算，老内核的完成队列需要单独映射
+    ring->m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+    {
+        ring->m_sqRingSize = ring->m_cqRingSize = std::max(ring->m_sqRingSize, ring->m_cqRingSize);
+    }
+    ring->m_sqRing = mmap(nullptr, ring->m_sqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->m_sqRing == MAP_FAILED)
+    {
+        ring->m_sqRing = nullptr;
+        return nullptr;
+    }
+    if (single)
+    {
+        ring->m_cqRing = ring->m_sqRing;
+    }
+    else
+    {
+        ring->m_cqRing = mmap(nullptr, ring->m_cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->m_cqRing == MAP_FAILED)
+        {
+            ring->m_cqRing = nullptr;
+            return nullptr;
+        }
+    }
+    ring->m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, ring->m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    ring->m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)ring->m_sqRing;
+    char* cq = (char*)ring->m_cqRing;
+    ring->m_sqHead = (uint32_t*)(sq + params.sq_off.head);
+    ring->m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+    ring->m_sqFlags = (uint32_t*)(sq + params.sq_off.flags);
+    ring->m_sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->m_sqEntries = params.sq_entries;
+    ring->m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+    ring->m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    ring->m_cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->m_cqes = cq + params.cq_off.cqes;
+
+    ring->m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->m_eventFd < 0 || SysRegister(fd, IORING_REGISTER_EVENTFD, &ring->m_eventFd, 1) < 0)
+    {
+        SYLAR_LOG_WARN(g_logger) << "io_uring register eventfd fail errno=" << errno << " " << strerror(errno);
+        return nullptr;
+    }
+    return ring;
+}
+
+IoUring::~IoUring()
+{
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing)
+    {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing)
+    {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_eventFd >= 0)
+    {
+        close(m_eventFd);
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+uint32_t IoUring::sqSpace() const
+{
+    uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    return m_sqEntries - (*m_sqTail - head);
+}
+
+int IoUring::submitLocked()
+{
+    uint32_t pending = m_pending.load(std::memory_order_relaxed);
+    if (!pending)
+    {
+        return 0;
+    }
+    int rt = SysEnter(m_fd, pending, 0, 0);
+    while (rt < 0 && errno == EINTR)
+    {
+        rt = SysEnter(m_fd, pending, 0, 0);
+    }
+    if (rt < 0)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring_enter submit " << pending << " fail errno=" << errno
+                                  << " " << strerror(errno);
+        return rt;
+    }
+    m_pending.fetch_sub(rt, std::memory_order_relaxed);
+    return rt;
+}
+
+bool IoUring::push(const io_uring_sqe& sqe, const io_uring_sqe* link)
+{
+    uint32_t need = link ? 2 : 1;
+    Mutex::Lock lock(m_sqMutex);
+    bool first = m_pending.load(std::memory_order_relaxed) == 0;
+    while (sqSpace() < need)
+    {
+        // 队列满了，先把已经排队的请求交给内核；内核还没来得及取走时稍后再试
+        if (submitLocked() <= 0)
+        {
+            sched_yield();
+        }
+    }
+    uint32_t tail = *m_sqTail;
+    for (uint32_t i = 0; i < need; ++i)
+    {
+        uint32_t idx = (tail + i) & m_sqMask;
+        m_sqes[idx] = i == 0 ? sqe : *link;
+        m_sqArray[idx] = idx;
+    }
+    __atomic_store_n(m_sqTail, tail + need, __ATOMIC_RELEASE);
+    m_pending.fetch_add(need, std::memory_order_relaxed);
+    return first;
+}
+
+int IoUring::flush()
+{
+    if (!m_pending.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    Mutex::Lock lock(m_sqMutex);
+    return submitLocked();
+}
+
+bool IoUring::reap(std::vector<Completion>& out)
+{
+    io_uring_cqe* cqes = (io_uring_cqe*)m_cqes;
+    bool reaped = false;
+    do
+    {
+        if (m_reaping.exchange(true, std::memory_order_acquire))
+        {
+            // 正在收割的线程放开之前会再检查一次，不会漏掉
+            return reaped;
+        }
+        // 完成队列满时内核把多出来的事件暂存起来，需要主动让它搬回完成队列
+        if (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+        {
+            SysEnter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+        }
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            io_uring_cqe& cqe = cqes[head & m_cqMask];
+            out.push_back(Completion{cqe.user_data, cqe.res});
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        m_reaping.store(false, std::memory_order_release);
+        reaped = true;
+        // 检查和放开之间到达的完成事件，它们的eventfd通知可能已经被其他线程读走
+    } while (__atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) != *m_cqHead
+             || (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW));
+    return true;
+}
+
+void IoUring::drainEventFd()
+{
+    uint64_t value;
+    while (read(m_eventFd, &value, sizeof(value)) > 0)
+        ;
+}
+
+#else
+
+IoUring::ptr IoUring::Create(uint32_t entries)
+{
+    SYLAR_LOG_WARN(g_logger) << "io_uring is not available at build time";
+    return nullptr;
+}
+
+IoUring::~IoUring()
+{
+}
+
+bool IoUring::push(const io_uring_sqe& sqe, const io_uring_sqe* link)
+{
+    SYLAR_ASSERT2(false, "io_uring is not available");
+    return false;
+}
+
+int IoUring::flush()
+{
+    return 0;
+}
+
+bool IoUring::reap(std::vector<Completion>& out)
+{
+    return false;
+}
+
+void IoUring::drainEventFd()
+{
+}
+
+uint32_t IoUring::sqSpace() const
+{
+    return 0;
+}
+
+int IoUring::submitLocked()
+{
+    return 0;
+}
+
+#endif
+
+}
@@ -1,48 +1,182 @@
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
+#include "config.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <strings.h>
 #include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <mutex>
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 namespace sylar
 {
 
+// 唤醒指定调度线程使用的信号
+static const int kWakeupSignal = SIGURG;
+// 信号在epoll_pwait之外被处理时记录下来，下一次epoll_pwait不再阻塞
+static thread_local volatile sig_atomic_t t_wakeup = 0;
+
+// 安装唤醒信号处理函数之前的处理方式，不是本进程发给调度线程的信号(比如带外数据通知)交给它
+static struct sigaction s_prevWakeupAction;
+
+static void OnWakeupSignal(int sig, siginfo_t* info, void* ctx)
+{
+    if (info->si_code == SI_TKILL && info->si_pid == getpid())
+    {
+        t_wakeup = 1;
+        return;
+    }
+    if (s_prevWakeupAction.sa_flags & SA_SIGINFO)
+    {
+        s_prevWakeupAction.sa_sigaction(sig, info, ctx);
+    }
+    else if (s_prevWakeupAction.sa_handler != SIG_DFL && s_prevWakeupAction.sa_handler != SIG_IGN)
+    {
+        s_prevWakeupAction.sa_handler(sig);
+    }
+}
+
+/**
+ *  @brief 安装唤醒信号的处理函数，SIGURG默认被忽略，不安装的话不会打断epoll_pwait
+ *  @details 只在第一个使用共享epoll的IOManager构造时安装一次，没有创建IOManager的程序不受影响
+ */
+static void InstallWakeupSignal()
+{
+    static std::once_flag s_once;
+    std::call_once(s_once, []() {
+        // 保留原来的SA_RESTART，非调度线程上收到的信号对系统调用的影响不变
+        sigaction(kWakeupSignal, nullptr, &s_prevWakeupAction);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = OnWakeupSignal;
+        sa.sa_flags = SA_SIGINFO | (s_prevWakeupAction.sa_flags & SA_RESTART);
+        sigemptyset(&sa.sa_mask);
+        sigaction(kWakeupSignal, &sa, nullptr);
+    });
+}
+
+// IO后端，epoll 或者 io_uring，构造IOManager时读取
+static ConfigVar<std::string>::ptr g_backend =
+    Config::Lookup<std::string>("iomanager.backend", "io backend, epoll or io_uring", "epoll");
+
+// io_uring 提交队列的大小
+static ConfigVar<uint32_t>::ptr g_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", "io_uring submission queue entries", 256);
+
+// 被hook的socket是否持久注册到epoll，避免每次等待都要epoll_ctl
+static ConfigVar<bool>::ptr g_persistent_events =
+    Config::Lookup<bool>("iomanager.persistent_events", "keep hooked sockets registered in epoll", false);
+
+// 每个调度线程是否使用自己的epoll实例，fd的事件只由注册它的线程处理
+static ConfigVar<bool>::ptr g_reactor_per_thread =
+    Config::Lookup<bool>("iomanager.reactor_per_thread", "one epoll instance per worker thread", false);
+
+// 空闲线程上次取到任务之后用不阻塞的epoll_wait忙轮询多久再休眠，0表示不轮询
+static ConfigVar<uint64_t>::ptr g_busy_poll_us =
+    Config::Lookup<uint64_t>("iomanager.busy_poll.spin_us", "busy poll epoll_wait for this long before sleeping", 0);
+
+// 被hook的socket设置的SO_BUSY_POLL(微秒)，0表示不设置
+static ConfigVar<uint32_t>::ptr g_socket_busy_poll_us =
+    Config::Lookup<uint32_t>("iomanager.busy_poll.socket_us", "SO_BUSY_POLL for hooked sockets", 0);
+
+/**
+ *  @brief 一个挂起在 io_uring 上的请求，user_data指向它
+ *  @details 放在堆上而不是等待协程的栈上：共享栈协程让出之后运行栈由别的协程使用，
+ *           内核提交时读取的超时和收割线程写入的结果不能落在上面
+ */
+struct UringRequest
+{
+    Fiber::ptr fiber;       // 等待的协程
+    int res = 0;            // 完成事件的结果
+#ifdef SYLAR_HAS_IO_URING
+    __kernel_timespec ts;   // 链接的超时请求读取的超时时间，提交时由内核读取
+#endif
+};
+
 /**
  *  @brief 构造函数
  */
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name)
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, size_t max_threads)
+    : Scheduler(threads, use_caller, name, max_threads)
 {
     // 创建一个epoll实例，返回对应的内核事件表
     m_epfd = epoll_create(5000);
     SYLAR_ASSERT(m_epfd > 0);
 
-    // 创建一个管道，返回对应的文件描述符(句柄)
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(rt == 0);
-
     // 创建一个epoll_event事件，用于联系 fd 和 fd 对应的读写事件
     epoll_event event;
     bzero(&event,sizeof(event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+    int rt = 0;
 
-    // 修改m_tickleFds[0]的属性为非阻塞模式
-    rt = fcntl(m_tickleFds[0],F_SETFL, O_NONBLOCK);
-    SYLAR_ASSERT(!rt);
+    // io_uring 的完成通知也挂在epoll上，等待点仍然只有epoll_wait，定时器和普通fd事件照常处理
+    if (g_backend->getValue() == "io_uring")
+    {
+        m_uring = IoUring::Create(g_uring_entries->getValue());
+        if (!m_uring)
+        {
+            SYLAR_LOG_WARN(g_logger) << "IOManager " << name << " io_uring unavailable, fall back to epoll";
+        }
+    }
+    else if (g_backend->getValue() != "epoll")
+    {
+        SYLAR_LOG_WARN(g_logger) << "unknown iomanager.backend=" << g_backend->getValue() << ", use epoll";
+    }
 
-    // 往内核事件表上注册fd和其对应的事件
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
+    m_persistentEvents = g_persistent_events->getValue();
+    m_reactorPerThread = g_reactor_per_thread->getValue();
+    m_busyPollUs = g_busy_poll_us->getValue();
+    m_socketBusyPollUs = g_socket_busy_poll_us->getValue();
 
-    // 默认设置64个大小
-    contextResize(32);
+    // 每个调度线程的等待状态按最多的线程数一次性创建，伸缩出来的线程也有自己的；
+    // 每线程反应器模式下每个线程还有自己的epoll实例和唤醒用的eventfd
+    for (size_t i = 0; i < getMaxWorkerCount(); ++i)
+    {
+        m_pollers.emplace_back(new Poller);
+        Poller& poller = *m_pollers.back();
+        if (!m_reactorPerThread)
+        {
+            poller.epfd = m_epfd;
+            continue;
+        }
+        poller.epfd = epoll_create(5000);
+        SYLAR_ASSERT(poller.epfd > 0);
+        poller.tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(poller.tickleFd >= 0);
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = poller.tickleFd;
+        rt = epoll_ctl(poller.epfd, EPOLL_CTL_ADD, poller.tickleFd, &event);
+        SYLAR_ASSERT(!rt);
+        // io_uring 的完成事件不属于某个fd，每个线程都能收割
+        if (m_uring)
+        {
+            event.data.fd = m_uring->getEventFd();
+            rt = epoll_ctl(poller.epfd, EPOLL_CTL_ADD, m_uring->getEventFd(), &event);
+            SYLAR_ASSERT(!rt);
+        }
+    }
+    if (m_reactorPerThread)
+    {
+        setInboxRouting(true);
+    }
+    else
+    {
+        // 共享epoll用信号唤醒指定的线程
+        InstallWakeupSignal();
+        if (m_uring)
+        {
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = m_uring->getEventFd();
+            rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_uring->getEventFd(), &event);
+            SYLAR_ASSERT(!rt);
+        }
+    }
 
     // 默认启动 协程调度器Scheduler
     start();
@@ -56,33 +190,74 @@ IOManager::~IOManager()
     // 关闭调度器scheduler
     stop();
     // 释放资源
+    m_uring.reset();
     close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-    for (size_t i = 0; i < m_fdcontexts.size(); i++)
+    for (auto& poller : m_pollers)
+    {
+        if (poller->tickleFd >= 0)
+        {
+            close(poller->epfd);
+            close(poller->tickleFd);
+        }
+    }
+    for (auto& i : m_fdSegments)
     {
-        if (m_fdcontexts[i])
+        FdSlot* segment = i.load(std::memory_order_acquire);
+        if (!segment)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < kFdSegmentSize; ++j)
         {
-            delete m_fdcontexts[i];
+            delete segment[j].load(std::memory_order_acquire);
         }
+        delete[] segment;
     }
 }
 
-/**
- * @brief 重置socket句柄上下文的容器大小
- * @param[in] size 容量大小
- */
-void IOManager::contextResize(size_t size)
+IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create)
 {
-    m_fdcontexts.resize(size);
-    for (size_t i = 0; i < m_fdcontexts.size(); i++)
+    if (SYLAR_UNLIKELY(fd < 0 || (size_t)fd >= kFdSegmentSize * kFdSegmentCount))
+    {
+        return nullptr;
+    }
+
+    // 段和句柄上下文都只增不减，分配之后地址不变，读取不需要加锁；并发创建时CAS失败的一方释放自己的
+    std::atomic<FdSlot*>& slot = m_fdSegments[fd >> kFdSegmentBits];
+    FdSlot* segment = slot.load(std::memory_order_acquire);
+    if (!segment)
     {
-        if (!m_fdcontexts[i])
+        if (!auto_create)
         {
-            m_fdcontexts[i] = new FdContext;
-            m_fdcontexts[i]->fd = i;
+            return nullptr;
         }
-    } 
+        FdSlot* fresh = new FdSlot[kFdSegmentSize]();
+        if (slot.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            segment = fresh;
+        }
+        else
+        {
+            delete[] fresh;
+        }
+    }
+
+    FdSlot& entry = segment[fd & (kFdSegmentSize - 1)];
+    FdContext* fd_ctx = entry.load(std::memory_order_acquire);
+    if (!fd_ctx && auto_create)
+    {
+        FdContext* fresh = new FdContext;
+        fresh->fd = fd;
+        if (entry.compare_exchange_strong(fd_ctx, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            fd_ctx = fresh;
+        }
+        else
+        {
+            delete fresh;
+        }
+    }
+    return fd_ctx;
 }
 
 /**
@@ -90,21 +265,23 @@ void IOManager::contextResize(size_t size)
  *  @param[in] fd
  *  @param[in] Event
  */
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+int IOManager::addEvent(int fd, Event event, Callback cb)
 {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdcontexts.size() > fd)
-    {
-        fd_ctx = m_fdcontexts[fd];
-        lock.unlock();
-    }
-    else
+    return addEvent(fd, event, std::move(cb), false);
+}
+
+int IOManager::addArmedEvent(int fd, Event event, Callback cb)
+{
+    return addEvent(fd, event, std::move(cb), true);
+}
+
+int IOManager::addEvent(int fd, Event event, Callback cb, bool armed)
+{
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if (!fd_ctx)
     {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdcontexts[fd];
+        SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
 
     // 同一个fd不允许重复添加相同的事件
@@ -117,20 +294,63 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         SYLAR_ASSERT(!(fd_ctx->m_events & event));
     }
     
-    // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
-    int op = fd_ctx->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | static_cast<EPOLL_EVENTS>(fd_ctx->m_events) | static_cast<EPOLL_EVENTS>(event);
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt)
+    if (armed && fd_ctx->persistent)
     {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-        << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-        << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-        << (EPOLL_EVENTS)fd_ctx->m_events;
-        return -1;
+        // 持久注册的fd已经在epoll里，没有等待者期间已经就绪的话直接让调用者重试
+        if (fd_ctx->ready & event)
+        {
+            fd_ctx->ready &= ~event;
+            return 1;
+        }
+    }
+    else if (fd_ctx->persistent)
+    {
+        // 调用者不能确认这个fd号还是当初持久注册的句柄(旧句柄可能没有经过cancelAll就关闭了)，
+        // 按持久注册的方式重新注册一次；注册时内核会重新报告当前已经就绪的事件，旧的就绪标记不再需要
+        int epfd = bindEpfd(fd_ctx);
+        epoll_event epevent;
+        epevent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        epevent.data.ptr = fd_ctx;
+        int op = EPOLL_CTL_MOD;
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt && errno == ENOENT)
+        {
+            op = EPOLL_CTL_ADD;
+            rt = epoll_ctl(epfd, op, fd, &epevent);
+        }
+        if (rt)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+            << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return -1;
+        }
+        fd_ctx->ready = NONE;
+    }
+    else
+    {
+        // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
+        int epfd = bindEpfd(fd_ctx);
+        int op = fd_ctx->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | static_cast<EPOLL_EVENTS>(fd_ctx->m_events) | static_cast<EPOLL_EVENTS>(event);
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt && errno == EEXIST)
+        {
+            // 解除持久注册但没有关闭的fd仍然在epoll里
+            op = EPOLL_CTL_MOD;
+            rt = epoll_ctl(epfd, op, fd, &epevent);
+        }
+        if (rt)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+            << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+            << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+            << (EPOLL_EVENTS)fd_ctx->m_events;
+            return -1;
+        }
     }
     
     // 待执行IO事件数加1
@@ -143,9 +363,14 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 
     // 赋值scheduler和回调函数，如果回调函数为空，则把当前协程当成回调执行体
     event_ctx.scheduler = Scheduler::GetThis();
+    if (event_ctx.scheduler == this && fd_ctx->owner >= 0 && (cb || !Fiber::GetThisRaw()->isSharedStack()))
+    {
+        // 每线程反应器模式下事件只由fd所属的线程处理，等待的协程也在那里恢复；共享栈协程只能回到自己所属的线程
+        event_ctx.threadid = getWorkerTid(fd_ctx->owner);
+    }
     if (cb)
     {
-        event_ctx.cb.swap(cb);
+        event_ctx.cb = std::move(cb);
     }
     else
     {
@@ -164,13 +389,11 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 bool IOManager::delEvent(int fd, Event event)
 {
     // 判断fd是否对应的FdContext存在
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdcontexts.size() <= fd)
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx)
     {
         return false;
     }
-    FdContext* fd_ctx = m_fdcontexts[fd];
-    lock.unlock();
 
     // 判断fd是否对应的FdContext上是否有event这个事件
     FdContext::MutexType::Lock lock2(fd_ctx->m_mutex);
@@ -179,21 +402,25 @@ bool IOManager::delEvent(int fd, Event event)
         return false;
     }
 
-    // 构造新的epoll_event结构体
+    // 构造新的epoll_event结构体，持久注册的fd保持原样
     Event new_event = static_cast<Event>(fd_ctx->m_events & ~event);
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;;
-    epoll_event epevent;
-    epevent.events = static_cast<EPOLL_EVENTS>(new_event) | EPOLLET;
-    epevent.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt)
+    if (!fd_ctx->persistent)
     {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                  << (EPOLL_EVENTS)fd_ctx->m_events;
+        int epfd = bindEpfd(fd_ctx);
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;;
+        epoll_event epevent;
+        epevent.events = static_cast<EPOLL_EVENTS>(new_event) | EPOLLET;
+        epevent.data.ptr = fd_ctx;
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                      << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                      << (EPOLL_EVENTS)fd_ctx->m_events;
 
-        return false;
+            return false;
+        }
     }
 
     // 待执行IO事件数减1
@@ -214,31 +441,32 @@ bool IOManager::delEvent(int fd, Event event)
 bool IOManager::cancelEvent(int fd, Event event)
 {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_fdcontexts.size() <= fd) {
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdcontexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->m_mutex);
     if (!(fd_ctx->m_events & event)) {
         return false;
     }
 
-    // 删除事件
+    // 删除事件，持久注册的fd保持原样
     Event new_events = (Event)(fd_ctx->m_events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | static_cast<EPOLL_EVENTS>(new_events);
-    epevent.data.ptr = fd_ctx;
+    if (!fd_ctx->persistent) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | static_cast<EPOLL_EVENTS>(new_events);
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        int epfd = bindEpfd(fd_ctx);
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                      << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 删除之前触发一次事件
@@ -255,30 +483,42 @@ bool IOManager::cancelEvent(int fd, Event event)
 bool IOManager::cancelAll(int fd)
 {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_fdcontexts.size() <= fd) {
+    FdContext *fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdcontexts[fd];
-    lock.unlock();
+
+    if (m_uring && fd_ctx->uringPending)
+    {
+        cancelUring(fd);
+    }
 
     FdContext::MutexType::Lock lock2(fd_ctx->m_mutex);
+    // 解除持久注册，fd号复用之后重新注册；fd通常紧接着被关闭，内核会把它移出epoll，这里不再调用epoll_ctl
+    bool persistent = fd_ctx->persistent;
+    int epfd = fd_ctx->m_events ? bindEpfd(fd_ctx) : -1;
+    fd_ctx->persistent = false;
+    fd_ctx->ready = NONE;
+    // 同一个fd号上的新句柄重新选择所属的调度线程，已经注册的事件仍然恢复到原来的线程
+    fd_ctx->owner = -1;
     if (!fd_ctx->m_events) {
         return false;
     }
 
     // 删除全部事件
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = 0;
-    epevent.data.ptr = fd_ctx;
+    if (!persistent) {
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = 0;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                      << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 触发全部已注册的事件
@@ -295,6 +535,155 @@ bool IOManager::cancelAll(int fd)
     return true;
 }
 
+int IOManager::armEvents(int fd)
+{
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if (!fd_ctx)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "armEvents fd=" << fd << " out of range";
+        return -1;
+    }
+
+    // 调用者(hook)按FdCtx判断是否需要注册，这里的persistent可能是同一个fd号上已经关闭的旧句柄留下的，总是重新注册
+    FdContext::MutexType::Lock lock3(fd_ctx->m_mutex);
+    int epfd = bindEpfd(fd_ctx);
+    int op = fd_ctx->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epevent;
+    epevent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    epevent.data.ptr = fd_ctx;
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    if (rt && errno == EEXIST)
+    {
+        op = EPOLL_CTL_MOD;
+        rt = epoll_ctl(epfd, op, fd, &epevent);
+    }
+    if (rt)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                  << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        return -1;
+    }
+    // 注册时内核会检查一次当前状态，已经就绪的事件随后照常报告
+    fd_ctx->persistent = true;
+    fd_ctx->ready = NONE;
+    return 0;
+}
+
+int IOManager::submitIo(io_uring_sqe& sqe, uint64_t timeout_ms)
+{
+#ifdef SYLAR_HAS_IO_URING
+    SYLAR_ASSERT(m_uring);
+    FdContext* fd_ctx = getFdContext(sqe.fd, true);
+    if (!fd_ctx)
+    {
+        return -EBADF;
+    }
+
+    Fiber* cur = Fiber::GetThisRaw();
+    // 内核会在协程挂起之后访问sqe里的缓冲区，共享栈协程的栈数据那时已经被换出
+    SYLAR_ASSERT2(!cur->isSharedStack(), "shared stack fiber can not submit io_uring requests");
+    std::unique_ptr<UringRequest> req(new UringRequest);
+    req->fiber.reset(cur);
+    sqe.user_data = (uint64_t)(uintptr_t)req.get();
+
+    // 超时用链接的 LINK_TIMEOUT 实现，超时后内核取消请求，请求以-ECANCELED完成
+    io_uring_sqe link;
+    bool has_timeout = timeout_ms != ~0ull;
+    if (has_timeout)
+    {
+        sqe.flags |= IOSQE_IO_LINK;
+        req->ts.tv_sec = timeout_ms / 1000;
+        req->ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        memset(&link, 0, sizeof(link));
+        link.opcode = IORING_OP_LINK_TIMEOUT;
+        link.fd = -1;
+        link.addr = (uint64_t)(uintptr_t)&req->ts;
+        link.len = 1;
+        link.user_data = 0;
+    }
+
+    // 和addEvent一样计入待处理事件，请求完成之前调度器不会停止
+    ++m_pendingEventCount;
+    ++fd_ctx->uringPending;
+    if (m_uring->push(sqe, has_timeout ? &link : nullptr))
+    {
+        // 队列里第一个请求，叫醒一个休眠的线程在epoll_wait之前提交，之后的请求随它一起提交；
+        // 没有休眠的线程时所有线程都在执行任务，不知道什么时候才进入idle，由自己提交
+        bool woken = wakeOne();
+        countWakeup(woken);
+        if (!woken)
+        {
+            m_uring->flush();
+        }
+    }
+    // 完成事件可能在让出之前就被其他线程收割，调度器会等协程真正让出之后再恢复它
+    cur->yield();
+    --fd_ctx->uringPending;
+    if (has_timeout && req->res == -ECANCELED)
+    {
+        return -ETIMEDOUT;
+    }
+    return req->res;
+#else
+    SYLAR_ASSERT2(false, "io_uring is not available");
+    return -ENOSYS;
+#endif
+}
+
+size_t IOManager::reapUring(std::vector<IoUring::Completion>& completions, std::vector<ScheduleTask>& batch)
+{
+    m_uring->drainEventFd();
+    m_uring->reap(completions);
+    size_t completed = 0;
+    for (auto& c : completions)
+    {
+        // user_data为0的是超时请求自己的完成事件
+        if (!c.userData)
+        {
+            continue;
+        }
+        UringRequest* req = (UringRequest*)(uintptr_t)c.userData;
+        req->res = c.res;
+        batch.emplace_back(std::move(req->fiber), -1, Scheduler::IO_RESUME);
+        ++completed;
+    }
+    completions.clear();
+    return completed;
+}
+
+void IOManager::cancelUring(int fd)
+{
+#ifdef SYLAR_HAS_IO_URING
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = fd;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe.user_data = 0;
+    m_uring->push(sqe);
+    m_uring->flush();
+#endif
+}
+
+int IOManager::bindEpfd(FdContext* fd_ctx)
+{
+    if (!m_reactorPerThread)
+    {
+        return m_epfd;
+    }
+    if (fd_ctx->owner < 0)
+    {
+        int idx = getWorkerIndex();
+        if (idx < 0)
+        {
+            idx = pickWorker();
+        }
+        fd_ctx->owner = idx < 0 ? 0 : idx;
+    }
+    return m_pollers[fd_ctx->owner]->epfd;
+}
+
 /**
  *  @brief 获得当前的IOManager
  */
@@ -331,14 +720,16 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.threadid = -1;
 }
 
 /**
  * @brief 触发事件
  * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
  * @param[in] event 事件类型
+ * @param[out] batch 批量调度的任务列表
  */
-void IOManager::FdContext::triggerEvent(Event event)
+void IOManager::FdContext::triggerEvent(Event event, std::vector<ScheduleTask>* batch)
 {
     // 待触发的事件必须被注册过
     SYLAR_ASSERT(m_events & event);
@@ -349,14 +740,26 @@ void IOManager::FdContext::triggerEvent(Event event)
      */
     m_events = static_cast<Event>(m_events & ~event);
     // 调度对应的协程
+    // 等待IO的协程按最高优先级恢复，不会排在大量普通任务后面
     EventContext& ctx = getEventContext(event);
-    if (ctx.cb)
+    if (batch && ctx.scheduler == Scheduler::GetThis())
     {
-        ctx.scheduler->schedule(ctx.cb);
+        if (ctx.cb)
+        {
+            batch->emplace_back(std::move(ctx.cb), ctx.threadid, Scheduler::IO_RESUME);
+        }
+        else
+        {
+            batch->emplace_back(std::move(ctx.fiber), ctx.threadid, Scheduler::IO_RESUME);
+        }
+    }
+    else if (ctx.cb)
+    {
+        ctx.scheduler->schedule(std::move(ctx.cb), Scheduler::IO_RESUME, ctx.threadid);
     }
     else
     {
-        ctx.scheduler->schedule(ctx.fiber);
+        ctx.scheduler->schedule(std::move(ctx.fiber), Scheduler::IO_RESUME, ctx.threadid);
     }
     resetEventContext(ctx);
     return;
@@ -365,12 +768,52 @@ void IOManager::FdContext::triggerEvent(Event event)
 void IOManager::tickle()
 {
     SYLAR_LOG_DEBUG(g_logger) << "tickle";
-    if (!hasIdleThreads())
+    countWakeup(wakeOne());
+}
+
+bool IOManager::wakeOne()
+{
+    // 轮流找一个正在休眠的线程，只唤醒一个；已经被唤醒还没醒来的线程不会被重复唤醒
+    size_t n = m_pollers.size();
+    size_t start = m_nextTickle++;
+    for (size_t i = 0; i < n; ++i)
     {
-        return;
+        if (wakeWorker((start + i) % n))
+        {
+            return true;
+        }
     }
-    int rt = write(m_tickleFds[1], "T",1);
-    SYLAR_ASSERT(rt == 1);
+    return false;
+}
+
+void IOManager::tickleWorker(size_t idx)
+{
+    countWakeup(wakeWorker(idx));
+}
+
+bool IOManager::wakeWorker(size_t idx)
+{
+    // 先读再交换，没有在休眠的线程不产生写操作；多个唤醒方只有交换成功的一个发出唤醒
+    Poller& poller = *m_pollers[idx];
+    if (!poller.sleeping.load() || !poller.sleeping.exchange(0))
+    {
+        return false;
+    }
+    if (m_reactorPerThread)
+    {
+        uint64_t one = 1;
+        int rt = write(poller.tickleFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
+        return true;
+    }
+    pthread_t thread = getWorkerThread(idx);
+    if (!thread)
+    {
+        // 线程已经退出了调度
+        return false;
+    }
+    pthread_kill(thread, kWakeupSignal);
+    return true;
 }
 
 bool IOManager::stopping()
@@ -396,6 +839,22 @@ void IOManager::idle()
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
     });
+    // 到期定时器的回调和就绪事件的任务，容量在循环之间保留
+    std::vector<Callback> cbs;
+    std::vector<ScheduleTask> batch;
+    std::vector<IoUring::Completion> completions;
+
+    // 平时屏蔽唤醒信号，只在epoll_pwait期间放开，信号不会打断其他系统调用，也不会在检查和等待之间丢失
+    sigset_t block_mask, wait_mask;
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, kWakeupSignal);
+    pthread_sigmask(SIG_BLOCK, &block_mask, &wait_mask);
+    sigdelset(&wait_mask, kWakeupSignal);
+
+    // 每线程反应器模式下只等待自己的epoll实例；fd留在注册它的线程上，线程不能因空闲而退出
+    Poller& poller = *m_pollers[getWorkerIndex()];
+    int epfd = poller.epfd;
+    bool retirable = isRetirable() && !m_reactorPerThread;
 
     while(true)
     {
@@ -421,44 +880,122 @@ void IOManager::idle()
             {
                 next_timeout = TIMEOUT;
             }
+            // 可能退出的线程按空闲退出的时间醒来检查
+            if (retirable)
+            {
+                next_timeout = std::min<uint64_t>(next_timeout, getRetireIdleMs() + 1);
+            }
 
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
-            if (rt < 0 && errno == EINTR)
+            if (t_wakeup)
             {
-                continue;
+                // 屏蔽信号之前已经收到了唤醒
+                t_wakeup = 0;
+                next_timeout = 0;
             }
-            else
+
+            // 刚执行过任务的线程在忙轮询的时间内不休眠，反复用不阻塞的epoll_wait检查
+            bool spinning = m_busyPollUs && next_timeout && GetCurrentUS() - getLastActiveUs() < m_busyPollUs;
+            if (spinning)
+            {
+                next_timeout = 0;
+            }
+
+            // 先发布休眠状态再检查一次，与tickle()先入队再检查休眠状态配对：
+            // 要么唤醒方看到本线程在休眠而发出唤醒，要么这里看到新的任务、提前的定时器或者停止而不阻塞
+            if (next_timeout)
             {
+                poller.sleeping = 1;
+                uint64_t recheck = 0;
+                if (hasReadyTasks() || stopping(recheck) || recheck < next_timeout)
+                {
+                    next_timeout = 0;
+                }
+            }
+
+            // 这一轮期间排队的 io_uring 请求在等待之前一次提交
+            if (m_uring)
+            {
+                m_uring->flush();
+            }
+
+            rt = epoll_pwait(epfd, events, MAX_EVENTS, (int)next_timeout, &wait_mask);
+            poller.sleeping = 0;
+            if (rt < 0 && errno == EINTR)
+            {
+                // 被唤醒信号打断，回到调度协程检查信箱
+                t_wakeup = 0;
+                rt = 0;
                 break;
-            } 
+            }
+            // 忙轮询时没有就绪的事件、任务和到期的定时器就留在这里继续轮询，
+            // 只有确实有东西可取时才回到调度协程，避免每一轮都去加锁检查所有线程的队列
+            if (spinning && rt == 0 && !hasReadyTasks() && !stopping(next_timeout) && next_timeout)
+            {
+                continue;
+            }
+            break;
         } while (true);
+
+        // 空闲太久的多余线程退出，epoll和定时器由其余线程继续处理
+        if (rt == 0 && retirable && retireIfIdle())
+        {
+            break;
+        }
         
         // 收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
         listExpireCb(cbs);
         if(!cbs.empty()) 
         {
-            for(const auto &cb : cbs) 
-            {
-                schedule(cb);
-            }
+            scheduleBatch(cbs.begin(), cbs.end());
             cbs.clear();
         }
 
         // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
+        size_t triggered = 0;
         for (size_t i = 0; i < rt; ++i)
         {
             epoll_event& event = events[i];
-            if (event.data.fd == m_tickleFds[0])
+            if (poller.tickleFd >= 0 && event.data.fd == poller.tickleFd)
             {
-                // ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
+                // 本线程的eventfd用于通知协程调度，这时只需要把计数读掉即可
+                uint64_t dummy;
+                while (read(poller.tickleFd, &dummy, sizeof(dummy)) > 0)
                     ;
                 continue;
             }
+            if (m_uring && event.data.fd == m_uring->getEventFd())
+            {
+                triggered += reapUring(completions, batch);
+                continue;
+            }
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->m_mutex);
+            if (fd_ctx->persistent)
+            {
+                // 持久注册的fd留在epoll里：有等待者就触发，没有就记下来给下一个等待者
+                int real_events = NONE;
+                if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+                {
+                    real_events |= READ;
+                }
+                if (event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                {
+                    real_events |= WRITE;
+                }
+                int waiting = fd_ctx->m_events & real_events;
+                fd_ctx->ready |= real_events & ~waiting;
+                if (waiting & READ)
+                {
+                    fd_ctx->triggerEvent(READ, &batch);
+                    ++triggered;
+                }
+                if (waiting & WRITE)
+                {
+                    fd_ctx->triggerEvent(WRITE, &batch);
+                    ++triggered;
+                }
+                continue;
+            }
              /**
              * EPOLLERR: 出错，比如写读端已经关闭的pipe
              * EPOLLHUP: 套接字对端关闭
@@ -487,35 +1024,34 @@ void IOManager::idle()
             int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events = EPOLLET | left_events;
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int rt2 = epoll_ctl(epfd, op, fd_ctx->fd, &event);
             if (rt2)
             {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
                                           << op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
                                           << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
                 continue;
             }
             
-            // 处理已经发生的事件件，也就是让调度器调度指定的函数或协程
+            // 处理已经发生的事件件，也就是让调度器调度指定的函数或协程，本轮所有事件收集起来一起调度
             if (real_events & READ)
             {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(READ, &batch);
+                ++triggered;
             }
             if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(WRITE, &batch);
+                ++triggered;
             }
         }
+        // 任务入队之后才减少待处理事件数，避免其他线程在两者之间误判可以停止
+        scheduleBatch(batch);
+        m_pendingEventCount -= triggered;
         /**
          * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
          * 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
          */ 
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr   = cur.get();
-        cur.reset();
-
-        raw_ptr->yield();
+        Fiber::GetThisRaw()->yield();
     }
 }
 
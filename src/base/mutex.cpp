@@ -1,5 +1,7 @@
 #include "mutex.h"
 #include <stdexcept>
+#include <cerrno>
+#include <ctime>
 
 namespace sylar
 {
@@ -34,6 +36,34 @@ void Semaphore::wait()
     }
 }
 
+/**
+ * @brief 最多等待ms毫秒获取信号量
+ */
+bool Semaphore::waitFor(uint64_t ms)
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&m_semaphore, &ts))
+    {
+        if (errno == ETIMEDOUT)
+        {
+            return false;
+        }
+        if (errno != EINTR)
+        {
+            throw std::logic_error("sem_timedwait error");
+        }
+    }
+    return true;
+}
+
 /**
  * @brief 释放信号量
  */
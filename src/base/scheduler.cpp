@@ -2,6 +2,14 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "affinity.h"
+#include "watchdog.h"
+
+#include <algorithm>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace sylar
 {
@@ -12,13 +20,99 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 static thread_local Scheduler* t_schedule = nullptr;
 //  每个线程都有一个协程
 static thread_local Fiber* t_schedule_fiber = nullptr;
+// 当前调度线程在所属调度器中的私有数据
+static thread_local void* t_worker = nullptr;
+// 当前线程正在运行的任务这次开始运行的时间，0表示没有在运行任务
+static thread_local uint64_t t_slice_start = 0;
+
+// 每个调度线程最多缓存多少个已结束的函数任务协程，0表示不缓存
+static ConfigVar<uint32_t>::ptr g_fiber_cache_max =
+    Config::Lookup<uint32_t>("scheduler.fiber_cache.max", "max cached callback fibers per worker", 32);
+
+// 空闲线程在futex上休眠之前自旋检查新任务的次数，0表示直接休眠
+static ConfigVar<uint32_t>::ptr g_idle_spin_count =
+    Config::Lookup<uint32_t>("scheduler.idle_spin_count", "idle worker spin rounds before parking", 256);
+
+// 调度线程的CPU亲和性策略，取值见 PlanAffinity
+static ConfigVar<std::string>::ptr g_affinity =
+    Config::Lookup<std::string>("scheduler.affinity", "default scheduler thread affinity policy", "none");
+
+// 按调度器名称覆盖的亲和性策略
+static ConfigVar<std::map<std::string, std::string>>::ptr g_affinity_by_name =
+    Config::Lookup<std::map<std::string, std::string>>("scheduler.affinity_by_name",
+        "scheduler thread affinity policy by scheduler name", {});
+
+// 各优先级(IO_RESUME, NORMAL, BACKGROUND)的调度权重
+static ConfigVar<std::vector<uint32_t>>::ptr g_priority_weights =
+    Config::Lookup<std::vector<uint32_t>>("scheduler.priority.weights",
+        "scheduler dequeue weights of io_resume, normal and background tasks", {8, 4, 1});
+
+// 任务最长等待时间，超过后不论优先级都先执行，0表示不提前
+static ConfigVar<uint64_t>::ptr g_priority_max_wait_ms =
+    Config::Lookup<uint64_t>("scheduler.priority.max_wait_ms", "max queueing time before a task is promoted", 50);
+
+// 任务排队超过这个时间并且没有空闲线程时增加线程，只对线程数可以伸缩的调度器有效
+static ConfigVar<uint64_t>::ptr g_elastic_grow_wait_ms =
+    Config::Lookup<uint64_t>("scheduler.elastic.grow_wait_ms", "queueing time that makes an elastic scheduler grow", 5);
+
+// 多出来的线程空闲超过这个时间后退出
+static ConfigVar<uint64_t>::ptr g_elastic_retire_idle_ms =
+    Config::Lookup<uint64_t>("scheduler.elastic.retire_idle_ms", "idle time before an extra worker retires", 10000);
+
+// maybe_yield() 的时间预算，任务连续运行超过它之后让出
+static ConfigVar<uint64_t>::ptr g_yield_budget_us =
+    Config::Lookup<uint64_t>("scheduler.yield_budget_us", "time budget before maybe_yield() yields", 2000);
+
+/**
+ *  @brief 在futex上等待
+ *  @param[in] timeout_ms 超时时间，~0ull表示一直等待
+ */
+static void FutexWait(std::atomic<uint32_t>* addr, uint32_t expect, uint64_t timeout_ms = ~0ull)
+{
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if (timeout_ms != ~0ull)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = timeout_ms % 1000 * 1000000;
+        pts = &ts;
+    }
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expect, pts, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t>* addr)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name, size_t max_threads)
 {
     SYLAR_ASSERT(threads > 0);
 
     m_useCaller = use_caller;
     m_name = name;
+    auto affinity = g_affinity_by_name->getValue();
+    auto it = affinity.find(name);
+    m_affinity = it != affinity.end() ? it->second : g_affinity->getValue();
+    std::vector<uint32_t> weights = g_priority_weights->getValue();
+    for (size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        m_weights[i] = std::max<uint32_t>(1, i < weights.size() ? weights[i] : 1);
+    }
+    m_maxWaitUs = g_priority_max_wait_ms->getValue() * 1000;
+    m_growWaitUs = g_elastic_grow_wait_ms->getValue() * 1000;
+    m_retireIdleUs = g_elastic_retire_idle_ms->getValue() * 1000;
+    m_minWorkers = threads;
+    max_threads = std::max(threads, max_threads);
     if (use_caller)         // 这表示打算将当前的线程用作调度线程
     {
         --threads;          // 将调度线程的数量减一
@@ -41,13 +135,27 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     {
         m_rootThread = -1;
     }
-    m_threadCount = threads;
+    m_threadCount = max_threads - (use_caller ? 1 : 0);
+
+    // 调度线程的私有队列按最多的线程数在构造时一次性分配好，运行期间不再变化，其他线程可以无锁地遍历
+    for (size_t i = 0; i < max_threads; ++i)
+    {
+        m_workers.emplace_back(new Worker);
+        m_workers.back()->index = i;
+    }
+    if (use_caller)
+    {
+        m_workers[0]->tid = m_rootThread;
+        m_workers[0]->running = true;
+        m_workerCount = 1;
+    }
 }
 
 Scheduler::~Scheduler()
 {
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler:~Scheduler()" ;
     SYLAR_ASSERT(m_stopping);
+    Watchdog::GetInstance()->remove(this);
     if (GetThis() == this)
     {
         t_schedule = nullptr;
@@ -76,30 +184,826 @@ void Scheduler::start()
     SYLAR_ASSERT(m_threads.empty());
     m_threads.resize(m_threadCount);
 
-    for (size_t i = 0; i < m_threads.size(); ++i)
+    // 伸缩时新增的线程也按启动时的计划绑定CPU
+    size_t offset = m_useCaller ? 1 : 0;
+    m_plan = PlanAffinity(m_affinity, m_workers.size());
+    if (m_useCaller && GetThreadId() == m_rootThread)
     {
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run,this), m_name + "_" + std::to_string(i)));
-        m_tids.push_back(m_threads[i]->getId());
+        SetThreadAffinity(m_plan[0]);
+        bindWorker(m_workers[0].get(), GetThreadAffinity());
     }
+    for (size_t i = offset; i < m_minWorkers; ++i)
+    {
+        spawnWorker(i);
+    }
+
+    std::stringstream ss;
+    ss << "scheduler " << m_name << " affinity=" << m_affinity << " workers=" << m_minWorkers;
+    if (m_workers.size() > m_minWorkers)
+    {
+        ss << "-" << m_workers.size();
+    }
+    ss << " placement:";
+    for (size_t i = 0; i < m_minWorkers; ++i)
+    {
+        Worker* w = m_workers[i].get();
+        std::vector<int> cpus = i < offset ? GetThreadAffinity() : m_threads[i - offset]->getCpus();
+        ss << " [" << i << " tid=" << w->tid << " cpus=" << FormatCpuList(cpus)
+           << " node=" << w->numaNode << "]";
+    }
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+    Watchdog::GetInstance()->add(this);
 }
 
-bool Scheduler::stopping()
+void Scheduler::spawnWorker(size_t idx)
+{
+    size_t offset = m_useCaller ? 1 : 0;
+    Worker* w = m_workers[idx].get();
+    Thread::ptr& thread = m_threads[idx - offset];
+    if (thread)
+    {
+        // 退出的线程已经离开run()，这里很快返回
+        thread->join();
+    }
+    w->running = true;
+    w->lastActiveUs = GetCurrentUS();
+    thread.reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(idx - offset),
+                            m_plan[idx]));
+    m_tids.push_back(thread->getId());
+    // 新线程进入run()后要先拿m_mutex才能找到自己的Worker，所以这里赋值不会晚于它被使用
+    w->tid = thread->getId();
+    ++m_workerCount;
+    bindWorker(w, thread->getCpus());
+}
+
+void Scheduler::bindWorker(Worker* worker, const std::vector<int>& cpus)
+{
+    // 队列的缓冲区由线程自己第一次写入时分配在本地
+    const CpuTopology& topo = CpuTopology::Get();
+    if (topo.getNodeCount() > 1 && !m_plan[worker->index].empty())
+    {
+        worker->numaNode = topo.getNodeIdOfCpus(cpus);
+        if (worker->numaNode >= 0)
+        {
+            BindMemoryToNode(worker, sizeof(Worker), worker->numaNode, true);
+        }
+    }
+}
+
+void Scheduler::grow()
 {
+    if (m_stopping || m_workerCount >= m_workers.size() || m_idleCount > 0)
+    {
+        return;
+    }
+    // 每个排队阈值的时间内最多增加一个线程，新线程来不及分担之前不会接连增加
+    uint64_t now = GetCurrentUS();
+    uint64_t last = m_lastGrowUs;
+    if (now - last < m_growWaitUs || !m_lastGrowUs.compare_exchange_strong(last, now))
+    {
+        return;
+    }
+
     MutexType::Lock lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeCount == 0;
+    if (m_stopping || m_threads.empty())
+    {
+        return;
+    }
+    for (size_t i = m_minWorkers; i < m_workers.size(); ++i)
+    {
+        if (!m_workers[i]->running)
+        {
+            spawnWorker(i);
+            ++m_growCount;
+            SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " grow worker " << i
+                                     << " tid=" << m_workers[i]->tid << " workers=" << m_workerCount;
+            return;
+        }
+    }
+}
+
+bool Scheduler::isRetirable() const
+{
+    Worker* worker = (Worker*)t_worker;
+    return worker && worker->index >= m_minWorkers && !m_sharedStack;
+}
+
+bool Scheduler::retireIfIdle()
+{
+    // 共享栈协程只能在所属线程上恢复，线程退出后它们再也无法执行，所以使用共享栈时不退出
+    Worker* worker = (Worker*)t_worker;
+    if (!isRetirable() || m_stopping || GetCurrentUS() - worker->lastActiveUs < m_retireIdleUs)
+    {
+        return false;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    if (m_stopping)
+    {
+        return false;
+    }
+    {
+        // 清掉tid之后findWorker找不到本线程，之后指定本线程的任务不会再进入信箱
+        MutexType::Lock lock2(worker->mailboxMutex);
+        if (worker->mailboxSize > 0)
+        {
+            return false;
+        }
+        worker->tid = -1;
+    }
+    auto it = std::find(m_tids.begin(), m_tids.end(), (Tid)GetThreadId());
+    if (it != m_tids.end())
+    {
+        m_tids.erase(it);
+    }
+    worker->thread = 0;
+    --m_workerCount;
+    ++m_retireCount;
+    SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " retire worker " << worker->index
+                             << " workers=" << m_workerCount;
+    return true;
+}
+
+void Scheduler::getRunningSlices(std::vector<RunningSlice>& slices) const
+{
+    for (auto& w : m_workers)
+    {
+        // 空闲的线程也要列出来(startUs为0)，看门狗据此区分空闲和已经退出的线程
+        RunningSlice slice;
+        slice.tid = w->tid;
+        if (slice.tid == -1)
+        {
+            continue;
+        }
+        slice.startUs = w->sliceStartUs.load(std::memory_order_relaxed);
+        slice.index = w->index;
+        slice.fiberId = w->sliceFiberId.load(std::memory_order_relaxed);
+        slices.push_back(slice);
+    }
+}
+
+void Scheduler::resumeTask(Worker* worker, Fiber* fiber)
+{
+    // 取到任务时已经取过时间，任务从那时开始计时
+    t_slice_start = worker->lastActiveUs;
+    worker->sliceFiberId.store(fiber->getId(), std::memory_order_relaxed);
+    worker->sliceStartUs.store(t_slice_start, std::memory_order_relaxed);
+    fiber->resume();
+    worker->sliceStartUs.store(0, std::memory_order_relaxed);
+    t_slice_start = 0;
+}
+
+Scheduler::PriorityStats Scheduler::getPriorityStats(Priority prio) const
+{
+    PriorityStats stats;
+    stats.depth = m_depth[prio].value;
+    for (auto& w : m_workers)
+    {
+        const LaneStats& lane = w->stats[prio];
+        stats.dequeued += lane.dequeued.load(std::memory_order_relaxed);
+        stats.totalWaitUs += lane.totalWaitUs.load(std::memory_order_relaxed);
+        stats.maxWaitUs = std::max(stats.maxWaitUs, lane.maxWaitUs.load(std::memory_order_relaxed));
+        stats.promoted += lane.promoted.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void Scheduler::setPriorityWeight(Priority prio, uint32_t weight)
+{
+    m_weights[prio] = std::max<uint32_t>(1, weight);
+}
+
+bool Scheduler::stopping()
+{
+    // 先取走任务再减少m_pendingCount之前已经增加了m_activeCount，按这个顺序读取不会漏掉正在转移的任务
+    return m_stopping && m_pendingCount == 0 && m_activeCount == 0;
+}
+
+void Scheduler::scheduleBatch(std::vector<ScheduleTask>& tasks)
+{
+    if (tasks.empty())
+    {
+        return;
+    }
+
+    Worker* self = GetThis() == this ? (Worker*)t_worker : nullptr;
+    // 每个任务的目标信箱，nullptr表示放入自己的队列或全局注入队列
+    static thread_local std::vector<Worker*> targets;
+    static thread_local std::vector<char> woken;
+    targets.assign(tasks.size(), nullptr);
+    woken.assign(m_workers.size(), 0);
+
+    size_t shared = 0;      // 任意线程都能执行的任务数
+    bool has_pinned = false;
+    uint64_t now = GetCurrentUS();
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        ScheduleTask& task = tasks[i];
+        onEnqueue(task, now);
+        // 共享栈协程的栈数据只能恢复到所属线程的运行栈上，优先于调用者指定的线程(比如fd所属的反应器线程)
+        if (task.fiber && task.fiber->isSharedStack())
+        {
+            task.threadid = task.fiber->getOwnerThread();
+        }
+        if (task.threadid != -1)
+        {
+            targets[i] = findWorker(task.threadid);
+            has_pinned |= (targets[i] != nullptr);
+            // 指定的线程已经退出，和enqueue()一样按不指定线程的任务处理
+            if (!targets[i] && !(task.fiber && task.fiber->isSharedStack()))
+            {
+                task.threadid = -1;
+            }
+        }
+        else if (!self && m_inboxRouting)
+        {
+            int idx = pickWorker();
+            targets[i] = idx >= 0 ? m_workers[idx].get() : nullptr;
+            has_pinned |= (targets[i] != nullptr);
+        }
+        if (!targets[i] && task.threadid == -1)
+        {
+            ++shared;
+        }
+    }
+
+    // 信箱：每个目标线程加一次锁
+    size_t mailed = 0;
+    size_t fallback = 0;    // 目标线程已经退出，改放到全局注入队列的任务数
+    if (has_pinned)
+    {
+        for (auto& w : m_workers)
+        {
+            size_t count = 0;
+            MutexType::Lock lock(w->mailboxMutex);
+            for (size_t i = 0; i < tasks.size(); ++i)
+            {
+                if (targets[i] != w.get())
+                {
+                    continue;
+                }
+                // 目标线程可能在查找之后退出了，不再指定线程，留给全局注入队列
+                if (w->tid != -1 && (tasks[i].threadid == -1 || w->tid == tasks[i].threadid))
+                {
+                    w->mailbox.push(std::move(tasks[i]));
+                    ++count;
+                }
+                else
+                {
+                    if (!(tasks[i].fiber && tasks[i].fiber->isSharedStack()))
+                    {
+                        tasks[i].threadid = -1;
+                    }
+                    ++fallback;
+                }
+            }
+            if (count)
+            {
+                w->mailboxSize += count;
+                m_mailboxCount += count;
+                m_pendingCount += count;
+                mailed += count;
+                woken[w->index] = 1;
+            }
+        }
+    }
+
+    // 调度线程把不指定线程的任务放入自己的队列
+    size_t local = 0;
+    if (self && shared)
+    {
+        MutexType::Lock lock(self->mutex);
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            if (!targets[i] && tasks[i].threadid == -1)
+            {
+                self->tasks.push(std::move(tasks[i]));
+                ++local;
+            }
+        }
+        m_pendingCount += local;
+    }
+
+    // 剩下的任务(非调度线程添加的，或者目标不是调度线程的)放入全局注入队列
+    if (mailed + local < tasks.size())
+    {
+        size_t global = 0;
+        MutexType::Lock lock(m_mutex);
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            if (tasks[i].fiber || tasks[i].cb)
+            {
+                m_tasks.push(std::move(tasks[i]));
+                ++global;
+            }
+        }
+        m_pendingCount += global;
+    }
+    tasks.clear();
+
+    // 有新信件的空闲线程必须唤醒
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if (woken[i] && m_workers[i].get() != self && m_workers[i]->idle)
+        {
+            tickleWorker(i);
+        }
+        else
+        {
+            woken[i] = 0;
+        }
+    }
+
+    // 共享的任务按数量唤醒空闲线程，当前调度线程自己也会执行其中一个；改放到全局注入队列的任务也要有线程去取
+    size_t need = (self && shared ? shared - 1 : shared) + fallback;
+    for (size_t i = 0; i < m_workers.size() && need > 0; ++i)
+    {
+        Worker* w = m_workers[i].get();
+        if (w == self || !w->idle)
+        {
+            continue;
+        }
+        if (!woken[i])
+        {
+            tickleWorker(i);
+        }
+        --need;
+    }
+}
+
+uint64_t Scheduler::getLastActiveUs() const
+{
+    Worker* worker = GetThis() == this ? (Worker*)t_worker : nullptr;
+    return worker ? worker->lastActiveUs : 0;
+}
+
+int Scheduler::getWorkerIndex() const
+{
+    Worker* worker = GetThis() == this ? (Worker*)t_worker : nullptr;
+    return worker ? (int)worker->index : -1;
+}
+
+int Scheduler::pickWorker()
+{
+    // 槽位在构造时分配好之后不再变化，可以无锁遍历；还没进入run()的线程收到任务也不会被唤醒，跳过
+    size_t n = m_workers.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        Worker* w = m_workers[m_nextInbox++ % n].get();
+        if (w->tid != -1 && w->thread)
+        {
+            return (int)w->index;
+        }
+    }
+    return -1;
+}
+
+Scheduler::Worker* Scheduler::findWorker(int tid)
+{
+    for (auto& i : m_workers)
+    {
+        if (i->tid == tid)
+        {
+            return i.get();
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::onEnqueue(ScheduleTask& task, uint64_t now)
+{
+    task.enqueueUs = now;
+    ++m_depth[task.priority].value;
+}
+
+void Scheduler::onDequeue(const ScheduleTask& task, uint64_t now, bool promoted)
+{
+    --m_depth[task.priority].value;
+
+    // 统计只由当前线程写入，不需要原子的读改写
+    Worker* worker = (Worker*)t_worker;
+    LaneStats& lane = worker->stats[task.priority];
+    uint64_t wait = now > task.enqueueUs ? now - task.enqueueUs : 0;
+    worker->lastActiveUs = now;
+    if (wait >= m_growWaitUs && m_workers.size() > m_minWorkers)
+    {
+        worker->growHint = true;
+    }
+    lane.dequeued.store(lane.dequeued.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    lane.totalWaitUs.store(lane.totalWaitUs.load(std::memory_order_relaxed) + wait, std::memory_order_relaxed);
+    if (wait > lane.maxWaitUs.load(std::memory_order_relaxed))
+    {
+        lane.maxWaitUs.store(wait, std::memory_order_relaxed);
+    }
+    if (promoted)
+    {
+        lane.promoted.store(lane.promoted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+bool Scheduler::enqueue(ScheduleTask& task)
+{
+    onEnqueue(task, GetCurrentUS());
+
+    // 共享栈协程的栈数据只能恢复到所属线程的运行栈上，优先于调用者指定的线程(比如fd所属的反应器线程)
+    if (task.fiber && task.fiber->isSharedStack())
+    {
+        task.threadid = task.fiber->getOwnerThread();
+    }
+
+    Worker* worker = GetThis() == this ? (Worker*)t_worker : nullptr;
+    Worker* target = nullptr;
+    if (task.threadid != -1)
+    {
+        target = findWorker(task.threadid);
+    }
+    else if (!worker && m_inboxRouting)
+    {
+        int idx = pickWorker();
+        target = idx >= 0 ? m_workers[idx].get() : nullptr;
+    }
+    if (target)
+    {
+        // 指定了线程的任务(以及按轮转选定了线程的任务)直接投递到目标线程的信箱，只唤醒目标线程
+        {
+            MutexType::Lock lock(target->mailboxMutex);
+            // 目标线程可能在查找之后退出了
+            if (target->tid != -1 && (task.threadid == -1 || target->tid == task.threadid))
+            {
+                target->mailbox.push(std::move(task));
+                ++target->mailboxSize;
+                ++m_mailboxCount;
+                ++m_pendingCount;
+            }
+        }
+        if (!task.fiber && !task.cb)
+        {
+            if (target->idle)
+            {
+                tickleWorker(target->index);
+            }
+            return false;
+        }
+    }
+
+    if (task.threadid != -1)
+    {
+        if (task.fiber && task.fiber->isSharedStack())
+        {
+            // 共享栈协程只能等所属线程从全局注入队列里取
+            MutexType::Lock lock(m_mutex);
+            m_tasks.push(std::move(task));
+            ++m_pendingCount;
+            return false;
+        }
+        // 指定的线程不是(或者不再是)本调度器的调度线程，比如空闲后退出的弹性线程，
+        // 没有线程能执行它，按不指定线程的任务处理
+        task.threadid = -1;
+    }
+
+    if (worker)
+    {
+        MutexType::Lock lock(worker->mutex);
+        worker->tasks.push(std::move(task));
+        ++m_pendingCount;
+    }
+    else
+    {
+        // 非调度线程添加的任务放入全局注入队列
+        MutexType::Lock lock(m_mutex);
+        m_tasks.push(std::move(task));
+        ++m_pendingCount;
+    }
+
+    // 与run()中进入idle前的检查配对：要么这里看到有空闲线程，要么空闲线程看到新增的任务
+    return m_idleCount > 0;
+}
+
+void Scheduler::makeOrder(Worker* worker, DequeueOrder& order)
+{
+    order.now = GetCurrentUS();
+
+    // 平滑加权轮询：有任务的优先级加上自己的权重，选积分最高的，被选中的减去本轮权重之和
+    int best = -1;
+    int64_t total = 0;
+    for (int i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        if (m_depth[i].value == 0)
+        {
+            continue;
+        }
+        worker->credit[i] += m_weights[i];
+        total += m_weights[i];
+        if (best < 0 || worker->credit[i] > worker->credit[best])
+        {
+            best = i;
+        }
+    }
+    if (best < 0)
+    {
+        best = IO_RESUME;
+    }
+    else
+    {
+        worker->credit[best] -= total;
+    }
+
+    // 选中的通道取不到任务时，其余通道按优先级依次尝试
+    size_t n = 0;
+    order.lanes[n++] = (Priority)best;
+    for (int i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        if (i != best)
+        {
+            order.lanes[n++] = (Priority)i;
+        }
+    }
+}
+
+bool Scheduler::popLane(RingQueue<ScheduleTask>& lane, const DequeueOrder& order, ScheduleTask& task,
+                        bool& retry, bool global, bool head_only)
+{
+    size_t count = head_only ? std::min<size_t>(1, lane.size()) : lane.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        ScheduleTask& t = lane[i];
+        /**
+         *  @brief 情况一：全局注入队列中的任务指定了调度线程，但不是当前线程
+         *  @details 能找到目标线程的任务都已经投递到信箱里了，留在这里的只能跳过并计数
+         */
+        if (global && t.threadid != -1 && t.threadid != sylar::GetThreadId())
+        {
+            if (!head_only)
+            {
+                ++m_pinnedSkipped;
+            }
+            continue;
+        }
+
+        // 判断任务至少存在
+        SYLAR_ASSERT(t.fiber || t.cb);
+
+        /**
+         *  @brief 情况二：协程还没有从上一次yield中切换出去，暂时不能执行，稍后重试
+         */
+        if (t.fiber && t.fiber->getState() == Fiber::RUNNING)
+        {
+            retry = true;
+            continue;
+        }
+
+        /**
+         *  @brief 情况三：找到了一个任务，准备开始调度（将其从任务队列中删除）
+         */
+        if (head_only && t.enqueueUs + m_maxWaitUs > order.now)
+        {
+            return false;
+        }
+        task = std::move(t);
+        if (i == 0)
+        {
+            lane.pop_front();
+        }
+        else
+        {
+            lane.erase(i);
+        }
+        onDequeue(task, order.now, head_only);
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::popFrom(TaskQueue& queue, const DequeueOrder& order, ScheduleTask& task, bool& retry, bool global)
+{
+    // 防止饥饿：低优先级通道的队头等待太久，不论权重先执行
+    if (m_maxWaitUs)
+    {
+        for (int i = PRIORITY_COUNT - 1; i > IO_RESUME; --i)
+        {
+            if (popLane(queue.lanes[i], order, task, retry, global, true))
+            {
+                return true;
+            }
+        }
+    }
+    for (Priority prio : order.lanes)
+    {
+        if (popLane(queue.lanes[prio], order, task, retry, global, false))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::steal(Worker* worker)
+{
+    // 窃取到的任务先放在线程局部的缓冲里，容量只增不减，稳定后不再分配内存
+    static thread_local std::vector<ScheduleTask> stolen;
+    size_t n = m_workers.size();
+    for (size_t i = 1; i < n && stolen.empty(); ++i)
+    {
+        Worker* victim = m_workers[(worker->index + i) % n].get();
+        MutexType::Lock lock(victim->mutex);
+        // 每条通道从尾部取走一半，与victim从头部取任务的方向相反，仍在运行的协程留给victim
+        for (auto& lane : victim->tasks.lanes)
+        {
+            size_t want = (lane.size() + 1) / 2;
+            size_t idx = lane.size();
+            while (want > 0 && idx > 0)
+            {
+                --idx;
+                ScheduleTask& t = lane[idx];
+                if (t.fiber && t.fiber->getState() == Fiber::RUNNING)
+                {
+                    continue;
+                }
+                stolen.push_back(std::move(t));
+                lane.erase(idx);
+                --want;
+            }
+        }
+    }
+    if (stolen.empty())
+    {
+        return false;
+    }
+
+    // 两把队列锁不同时持有，避免互相窃取时死锁
+    MutexType::Lock lock(worker->mutex);
+    for (auto it = stolen.rbegin(); it != stolen.rend(); ++it)
+    {
+        worker->tasks.push(std::move(*it));
+    }
+    stolen.clear();
+    return true;
+}
+
+bool Scheduler::popTask(Worker* worker, ScheduleTask& task, bool& retry)
+{
+    DequeueOrder order;
+    makeOrder(worker, order);
+
+    // 信箱里的任务只能由本线程执行，优先处理
+    if (worker->mailboxSize > 0)
+    {
+        MutexType::Lock lock(worker->mailboxMutex);
+        if (popFrom(worker->mailbox, order, task, retry, false))
+        {
+            --worker->mailboxSize;
+            --m_mailboxCount;
+            return true;
+        }
+    }
+    bool global_first = m_maxWaitUs && order.now - worker->lastGlobalUs >= m_maxWaitUs / 2;
+    if (global_first)
+    {
+        worker->lastGlobalUs = order.now;
+        MutexType::Lock lock(m_mutex);
+        if (popFrom(m_tasks, order, task, retry, true))
+        {
+            return true;
+        }
+    }
+    {
+        MutexType::Lock lock(worker->mutex);
+        if (popFrom(worker->tasks, order, task, retry, false))
+        {
+            return true;
+        }
+    }
+    if (!global_first)
+    {
+        worker->lastGlobalUs = order.now;
+        MutexType::Lock lock(m_mutex);
+        if (popFrom(m_tasks, order, task, retry, true))
+        {
+            return true;
+        }
+    }
+    if (steal(worker))
+    {
+        MutexType::Lock lock(worker->mutex);
+        return popFrom(worker->tasks, order, task, retry, false);
+    }
+    return false;
+}
+
+void Scheduler::tickleWorker(size_t idx)
+{
+    countWakeup(unpark(m_workers[idx].get()));
+}
+
+void Scheduler::wakeIdleWorkers()
+{
+    Worker* self = GetThis() == this ? (Worker*)t_worker : nullptr;
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if (m_workers[i].get() != self && m_workers[i]->idle)
+        {
+            tickleWorker(i);
+        }
+    }
+}
+
+bool Scheduler::hasReadyTasks()
+{
+    Worker* worker = GetThis() == this ? (Worker*)t_worker : nullptr;
+    return worker && hasWork(worker);
+}
+
+void Scheduler::countWakeup(bool sent)
+{
+    m_wakeupsNeeded.fetch_add(1, std::memory_order_relaxed);
+    if (sent)
+    {
+        m_wakeupsSent.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool Scheduler::hasWork(Worker* worker)
+{
+    // 自己的信箱里有任务，或者有任意线程都能执行的任务
+    return worker->mailboxSize > 0 || m_pendingCount > m_mailboxCount;
+}
+
+void Scheduler::park(Worker* worker)
+{
+    // 先自旋一会儿，任务很快到来时省掉一次休眠和唤醒的系统调用
+    uint32_t spin = g_idle_spin_count->getValue();
+    ++m_spinningCount;
+    for (uint32_t i = 0; i < spin && !hasWork(worker) && !m_stopping; ++i)
+    {
+        CpuRelax();
+    }
+    --m_spinningCount;
+
+    // 先发布休眠状态再检查一次，与unpark()配对，不会丢失唤醒
+    worker->parked = 1;
+    if (hasWork(worker) || stopping())
+    {
+        worker->parked = 0;
+        return;
+    }
+    ++m_parkCount;
+    // 可能退出的线程定时醒来检查空闲了多久
+    uint64_t timeout = isRetirable() ? m_retireIdleUs / 1000 + 1 : ~0ull;
+    while (worker->parked == 1)
+    {
+        FutexWait(&worker->parked, 1, timeout);
+        if (timeout != ~0ull)
+        {
+            worker->parked = 0;
+        }
+    }
+}
+
+bool Scheduler::unpark(Worker* worker)
+{
+    if (worker->parked == 1 && worker->parked.exchange(0) == 1)
+    {
+        FutexWake(&worker->parked);
+        return true;
+    }
+    return false;
 }
 
 void Scheduler::tickle()
 {
-    SYLAR_LOG_INFO(g_logger) << "tickle"; 
+    SYLAR_LOG_DEBUG(g_logger) << "tickle"; 
+    // 有正在自旋的线程会自己发现新任务，不需要唤醒休眠的线程
+    if (m_spinningCount > 0)
+    {
+        countWakeup(false);
+        return;
+    }
+    for (auto& i : m_workers)
+    {
+        if (unpark(i.get()))
+        {
+            countWakeup(true);
+            return;
+        }
+    }
+    countWakeup(false);
 }
 
 void Scheduler::idle()
 {
     SYLAR_LOG_DEBUG(g_logger) << "idle";
+    Worker* worker = (Worker*)t_worker;
     while(!stopping())
     {
-        sylar::Fiber::GetThis()->yield();
+        if (!hasWork(worker))
+        {
+            park(worker);
+            if (!hasWork(worker) && retireIfIdle())
+            {
+                break;
+            }
+        }
+        sylar::Fiber::GetThisRaw()->yield();
     }
 }
 
@@ -111,6 +1015,7 @@ void Scheduler::stop()
         return;
     }
     m_stopping = true;
+    wakeIdleWorkers();
 
     // 判断是否使用了caller线程
     if (m_useCaller)
@@ -144,13 +1049,28 @@ void Scheduler::stop()
         thres.swap(m_threads);
     }
     
+    // 弹性调度器按最大线程数预留了位置，没有扩容过的位置是空的
     for (auto& i : thres)
     {
-        i->join();
+        if (i)
+        {
+            i->join();
+        }
     }
+    // 调度线程都已退出，看门狗不再采样，它们的报告记录随之移除
+    Watchdog::GetInstance()->remove(this);
     
 }
 
+void Scheduler::notifyIfStopped()
+{
+    // 停止过程中最后一个任务执行完了，空闲线程要醒来检查并退出
+    if (SYLAR_UNLIKELY(m_stopping) && m_pendingCount == 0 && m_activeCount == 0)
+    {
+        wakeIdleWorkers();
+    }
+}
+
 void Scheduler::setThis()
 {
     t_schedule = this;
@@ -165,59 +1085,73 @@ void Scheduler::run()
     setThis();  
     if (sylar::GetThreadId() != m_rootThread)   // 这表示不是当前线程的id不是调度线程的id
     {
-        t_schedule_fiber = sylar::Fiber::GetThis().get();   // 线程创建协程
+        t_schedule_fiber = sylar::Fiber::GetThisRaw();   // 线程创建协程
+    }
+
+    Worker* worker = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        for (auto& i : m_workers)
+        {
+            if (i->tid == sylar::GetThreadId())
+            {
+                worker = i.get();
+                break;
+            }
+        }
     }
+    SYLAR_ASSERT(worker);
+    worker->thread = pthread_self();
+    t_worker = worker;
 
     Fiber::ptr idle(new Fiber(std::bind(&Scheduler::idle, this)));  // 创建懒惰携程
     Fiber::ptr cb_fiber;
+    std::vector<Fiber::ptr> fiber_cache;    // 本线程缓存的已结束的函数任务协程，通过Fiber::reset复用栈
     ScheduleTask task;  
     while (true)
     {
+        if (SYLAR_UNLIKELY(worker->tid == -1))
+        {
+            // 空闲太久退出了调度，退出前本线程的队列和信箱都是空的
+            break;
+        }
         task.reset();
-        bool tickle_me = false;     // 是否tickle其他线程进行任务调度
+        bool retry = false;         // 是否有还没切换出去的协程，需要稍后重试
+        bool found = popTask(worker, task, retry);
+        if (!found && !retry)
         {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            while (it != m_tasks.end())
+            if (idle->getState() == Fiber::TERM)
             {
-                /**
-                 *  @brief 情况一：当前任务指定了调度线程，但不是当前线程
-                 */
-                if (it->threadid != -1 && it->threadid != sylar::GetThreadId())
-                {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                // 判断任务至少存在
-                SYLAR_ASSERT(it->fiber || it->cb);
-                
-                /**
-                 *  @brief 情况二：当前任务存在，但是正在运行在该线程的协程上
-                 */
-                if (it->fiber && it->fiber->getState() == Fiber::RUNNING)
-                {
-                    ++it;
-                    continue;
-                }
-
-                /**
-                 *  @brief 情况三：当前调度线程找到了一个任务，准备开始调度（将其从任务队列中删除，活动线程数量加一）
-                 */
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeCount;
+                // 这说明调度器已被停止
+                SYLAR_LOG_INFO(g_logger) << "idle fiber term";
                 break;
             }
-            
-            // 当前线程如果拿到一个任务后，发现任务队列中还有任务，就tick其他线程
-            tickle_me |= (it != m_tasks.end());
-            
+            ++m_idleCount;
+            worker->idle = true;
+            // 与enqueue()配对：进入idle之前任务已经入队的话，生产者可能没有看到本线程空闲而不会唤醒它
+            found = popTask(worker, task, retry);
+            if (!found && !retry)
+            {
+                idle->resume();
+            }
+            worker->idle = false;
+            --m_idleCount;
+        }
+        if (!found)
+        {
+            continue;
         }
 
-        // 通知其他线程
-        if (tickle_me)
+        // 先增加活跃数再减少待执行数，stopping()不会在两者之间看到都为0
+        ++m_activeCount;
+        --m_pendingCount;
+        if (SYLAR_UNLIKELY(worker->growHint))
+        {
+            worker->growHint = false;
+            grow();
+        }
+        // 当前线程拿到一个任务后，发现还有其他线程也能执行的任务并且有空闲线程，就tick其他线程来窃取
+        if (m_pendingCount > m_mailboxCount && m_idleCount > 0)
         {
             tickle();
         }
@@ -225,40 +1159,60 @@ void Scheduler::run()
         if (task.fiber)
         {
             // 使该task对应的协程执行，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
-            task.fiber->resume();
+            resumeTask(worker, task.fiber.get());
             --m_activeCount;
             task.reset();
+            notifyIfStopped();
         }
         else if (task.cb)
         {
-            if (cb_fiber)
+            if (!fiber_cache.empty() && fiber_cache.back()->isSharedStack() == m_sharedStack)
             {
-                cb_fiber->reset(task.cb);
+                cb_fiber.swap(fiber_cache.back());
+                fiber_cache.pop_back();
+                cb_fiber->reset(std::move(task.cb));
+                ++m_fiberCacheHits;
             }
             else
             {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(std::move(task.cb), 0, true, m_sharedStack));
+                ++m_fiberCacheMisses;
             }
             task.reset();
-            cb_fiber->resume();
+            resumeTask(worker, cb_fiber.get());
             --m_activeCount;
-            cb_fiber.reset();
-        }
-        else    // 进入到这个分支，说明没有在任务队列中取到task
-        {
-            if (idle->getState() == Fiber::TERM)
+            notifyIfStopped();
+            // 只有执行完且没有其他地方持有的协程才能复用，否则别人可能还会调度这个协程
+            if (cb_fiber->getState() == Fiber::TERM && cb_fiber.use_count() == 1
+                    && fiber_cache.size() < g_fiber_cache_max->getValue())
             {
-                // 这说明调度器已被停止
-                SYLAR_LOG_INFO(g_logger) << "idle fiber term";
-                break;
+                fiber_cache.push_back(std::move(cb_fiber));
             }
-            ++m_idleCount;
-            idle->resume();
-            --m_idleCount;
+            cb_fiber.reset();
         }
     }
+    t_worker = nullptr;
+    worker->running = false;
     SYLAR_LOG_INFO(g_logger) << "Scheduler::run() exit";
 }
 
+bool maybe_yield()
+{
+    // 不在调度器的任务中
+    if (!t_slice_start || GetCurrentUS() - t_slice_start < g_yield_budget_us->getValue())
+    {
+        return false;
+    }
+    Scheduler* sc = Scheduler::GetThis();
+    Fiber* cur = Fiber::GetThisRaw();
+    if (!sc || !cur->isRunInScheduler())
+    {
+        return false;
+    }
+    // 先放回队列再让出，调度器会等协程切换出去之后再恢复它
+    sc->schedule(Fiber::ptr(cur));
+    cur->yield();
+    return true;
+}
 
-}
\ No newline at end of file
+}
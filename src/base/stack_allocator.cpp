@@ -0,0 +1,279 @@
+#include "stack_allocator.h"
+#include "affinity.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 默认栈分配器的类型: pool / malloc
+static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "fiber stack allocator, pool or malloc", "pool");
+
+// 每个线程每个尺寸档位最多缓存多少个空闲栈
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", "max cached stacks per size class per thread", 64);
+
+// 是否对缓存中的冷栈执行 MADV_DONTNEED
+static ConfigVar<bool>::ptr g_stack_pool_trim =
+    Config::Lookup<bool>("fiber.stack_pool.trim", "madvise idle cached stacks", false);
+
+// 开启trim时，每个档位保留多少个热栈不做 MADV_DONTNEED
+static ConfigVar<uint32_t>::ptr g_stack_pool_trim_keep =
+    Config::Lookup<uint32_t>("fiber.stack_pool.trim_keep", "hot stacks kept without trimming", 8);
+
+// 尺寸档位数量，第 i 档的栈大小为 2^i 页，超过最大档位的栈不缓存
+static const size_t kSizeClasses = 16;
+
+static std::atomic<uint64_t> s_mapped{0};
+static std::atomic<uint64_t> s_cached{0};
+static std::atomic<uint64_t> s_hits{0};
+static std::atomic<uint64_t> s_misses{0};
+static std::atomic<uint64_t> s_trimmed{0};
+
+// 通过 SetDefault 设置的分配器，为空时使用配置决定的分配器
+static std::atomic<StackAllocator*> s_user_allocator{nullptr};
+// 由配置 fiber.stack_allocator 决定的分配器
+static std::atomic<StackAllocator*> s_config_allocator{nullptr};
+
+static size_t PageSize()
+{
+    static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+/**
+ *  @brief 计算栈大小对应的档位，返回kSizeClasses表示不缓存
+ *  @param[out] bytes 档位对应的可用栈大小
+ */
+static size_t SizeClass(size_t size, size_t& bytes)
+{
+    size_t page = PageSize();
+    size_t pages = (size + page - 1) / page;
+    size_t cls = 0;
+    while (((size_t)1 << cls) < pages)
+    {
+        ++cls;
+    }
+    if (cls >= kSizeClasses)
+    {
+        bytes = pages * page;
+        return kSizeClasses;
+    }
+    bytes = ((size_t)1 << cls) * page;
+    return cls;
+}
+
+/**
+ *  @brief 映射一块带保护页的栈，返回保护页之上的可用地址
+ */
+static void* MapStack(size_t bytes)
+{
+    size_t guard = PageSize();
+    void* base = mmap(nullptr, bytes + guard, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "mmap stack fail, size=" << bytes
+                                  << " errno=" << errno << " " << strerror(errno);
+        return nullptr;
+    }
+    // 线程绑定到单个NUMA节点时，栈的物理页从该节点分配。栈缓存是线程私有的，复用时也留在本节点
+    int node = GetThreadNumaNode();
+    if (node >= 0)
+    {
+        BindMemoryToNode(base, bytes + guard, node);
+    }
+    // 栈向低地址增长，保护页放在最低端
+    if (mprotect(base, guard, PROT_NONE))
+    {
+        SYLAR_LOG_ERROR(g_logger) << "mprotect guard page fail, errno=" << errno
+                                  << " " << strerror(errno);
+    }
+    ++s_mapped;
+    return (char*)base + guard;
+}
+
+static void UnmapStack(void* p, size_t bytes)
+{
+    size_t guard = PageSize();
+    munmap((char*)p - guard, bytes + guard);
+    --s_mapped;
+}
+
+// 线程退出时栈缓存是否已经析构
+static thread_local bool t_stack_cache_dead = false;
+
+/**
+ *  @brief 线程私有的空闲栈缓存
+ *  @details 每个档位一个vector，尾部是最近归还的热栈，头部是被trim过的冷栈
+ */
+struct StackCache
+{
+    std::vector<void*> free[kSizeClasses];
+
+    ~StackCache()
+    {
+        release();
+        t_stack_cache_dead = true;
+    }
+
+    void release()
+    {
+        for (size_t i = 0; i < kSizeClasses; ++i)
+        {
+            size_t bytes = ((size_t)1 << i) * PageSize();
+            for (auto p : free[i])
+            {
+                UnmapStack(p, bytes);
+                --s_cached;
+            }
+            free[i].clear();
+        }
+    }
+};
+
+static thread_local StackCache t_stack_cache;
+
+/*---------------------  StackAllocator  ------------------------*/
+
+StackAllocator* StackAllocator::GetDefault()
+{
+    StackAllocator* allocator = s_user_allocator.load(std::memory_order_acquire);
+    if (allocator)
+    {
+        return allocator;
+    }
+    allocator = s_config_allocator.load(std::memory_order_acquire);
+    if (allocator)
+    {
+        return allocator;
+    }
+    static MallocStackAllocator s_malloc;
+    allocator = g_fiber_stack_allocator->getValue() == "malloc"
+              ? (StackAllocator*)&s_malloc : (StackAllocator*)PooledStackAllocator::GetInstance();
+    s_config_allocator.store(allocator, std::memory_order_release);
+    return allocator;
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator)
+{
+    s_user_allocator.store(allocator, std::memory_order_release);
+}
+
+/**
+ *  @brief 配置变化时重新选择分配器
+ */
+struct _StackAllocatorIniter
+{
+    _StackAllocatorIniter()
+    {
+        g_fiber_stack_allocator->addlistener([](const std::string& old_value, const std::string& new_value){
+            SYLAR_LOG_INFO(g_logger) << "fiber.stack_allocator changed from "
+                                     << old_value << " to " << new_value;
+            s_config_allocator.store(nullptr, std::memory_order_release);
+        });
+    }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+/*---------------------  MallocStackAllocator  ------------------------*/
+
+void* MallocStackAllocator::alloc(size_t size)
+{
+    return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* p, size_t size)
+{
+    free(p);
+}
+
+/*---------------------  PooledStackAllocator  ------------------------*/
+
+PooledStackAllocator* PooledStackAllocator::GetInstance()
+{
+    static PooledStackAllocator s_instance;
+    return &s_instance;
+}
+
+void* PooledStackAllocator::alloc(size_t size)
+{
+    size_t bytes = 0;
+    size_t cls = SizeClass(size, bytes);
+    if (cls < kSizeClasses && !t_stack_cache_dead)
+    {
+        auto& list = t_stack_cache.free[cls];
+        if (!list.empty())
+        {
+            void* p = list.back();
+            list.pop_back();
+            --s_cached;
+            ++s_hits;
+            return p;
+        }
+    }
+    ++s_misses;
+    return MapStack(bytes);
+}
+
+void PooledStackAllocator::dealloc(void* p, size_t size)
+{
+    if (!p)
+    {
+        return;
+    }
+    size_t bytes = 0;
+    size_t cls = SizeClass(size, bytes);
+    // 线程退出阶段缓存已析构，直接归还给系统
+    if (cls >= kSizeClasses || t_stack_cache_dead)
+    {
+        UnmapStack(p, bytes);
+        return;
+    }
+
+    auto& list = t_stack_cache.free[cls];
+    if (list.size() >= g_stack_pool_max_cached->getValue())
+    {
+        UnmapStack(p, bytes);
+        return;
+    }
+
+    ++s_cached;
+    if (g_stack_pool_trim->getValue() && list.size() >= g_stack_pool_trim_keep->getValue())
+    {
+        // 冷栈释放物理页后放到链表头部，优先复用仍然驻留内存的热栈
+        madvise(p, bytes, MADV_DONTNEED);
+        ++s_trimmed;
+        list.insert(list.begin(), p);
+        return;
+    }
+    list.push_back(p);
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::GetStats()
+{
+    Stats stats;
+    stats.mapped = s_mapped;
+    stats.cached = s_cached;
+    stats.hits = s_hits;
+    stats.misses = s_misses;
+    stats.trimmed = s_trimmed;
+    return stats;
+}
+
+void PooledStackAllocator::ReleaseThreadCache()
+{
+    t_stack_cache.release();
+}
+
+}
@@ -1,5 +1,6 @@
 #include "thread.h"
 #include "log.h"
+#include "affinity.h"
 namespace sylar
 {
 
@@ -12,10 +13,12 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
  *  @brief 构造函数
  *  @param[in] cb 线程执行函数
  *  @param[in] name 线程名称
+ *  @param[in] cpus 线程绑定的CPU，在新线程中设置，之后该线程映射的协程栈优先从所在NUMA节点分配
  */
-Thread::Thread(std::function<void()> cb, const std::string &name)
+Thread::Thread(std::function<void()> cb, const std::string &name, const std::vector<int>& cpus)
     : m_cb(cb)
     , m_name(name)
+    , m_cpus(cpus)
 {
     if (name.empty())
     {
@@ -101,6 +104,8 @@ void* Thread::run(void* arg)
     t_thread_name = thread->m_name;
     thread->m_id = sylar::GetThreadId();
     pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    SetThreadAffinity(thread->m_cpus);
+    thread->m_cpus = GetThreadAffinity();
     
     std::function<void()> cb;
     cb.swap(thread->m_cb);
@@ -4,6 +4,21 @@
 namespace sylar
 {
 
+/**
+ *  @brief 循环定时器的回调包装
+ *  @details Callback 只能移动，循环定时器每次到期都要交出一份回调，所以把可调用对象放到共享指针里，
+ *           交出去的是可以拷贝的包装，同一个定时器的多次回调可能在不同线程上同时执行
+ */
+struct SharedCallback
+{
+    std::shared_ptr<Callback> cb;
+
+    void operator()()
+    {
+        (*cb)();
+    }
+};
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const
 {
     if (!lhs && !rhs)
@@ -34,12 +49,19 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs)
     return lhs.get() < rhs.get();
 }
 
-Timer::Timer(bool recurring, uint64_t ms, std::function<void()> cb, TimerManager* manager)
+Timer::Timer(bool recurring, uint64_t ms, Callback cb, TimerManager* manager)
     : recurring(recurring)
     , m_ms(ms)
-    , m_cb(cb)
     , m_manager(manager)
 {
+    if (recurring && cb)
+    {
+        m_cb = SharedCallback{std::make_shared<Callback>(std::move(cb))};
+    }
+    else
+    {
+        m_cb = std::move(cb);
+    }
     m_next = sylar::GetCurrentMS() + m_ms ;
 }
 
@@ -134,10 +156,10 @@ TimerManager::TimerManager()
 TimerManager::~TimerManager()
 {}
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, bool recurring, std::function<void()> cb)
+Timer::ptr TimerManager::addTimer(uint64_t ms, bool recurring, Callback cb)
 {
     // 构造一个定时器
-    Timer::ptr timer(new Timer(recurring, ms, cb, this));
+    Timer::ptr timer(new Timer(recurring, ms, std::move(cb), this));
     // 创建一个写者锁
     TimerManager::RWMutexType::WriteLock Lock(m_mutex);
     // 将定时器添加到定时器列表中
@@ -162,19 +184,16 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& Lock)
     }
 }
 
-static void onTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
-{
-    // 这用来检测智能指针的指向的对象是否存在(通过弱智能指针weak_ptr不会使引用计数 + 1的特点)
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if (tmp)
-    {
-        cb();
-    }
-}
-
-Timer::ptr TimerManager::addTimerCondition(uint64_t ms, bool recurring, std::function<void()> cb, std::weak_ptr<void> weak_cond)
+Timer::ptr TimerManager::addTimerCondition(uint64_t ms, bool recurring, Callback cb, std::weak_ptr<void> weak_cond)
 {
-    return addTimer(ms, recurring, std::bind(&onTimer,weak_cond, cb));
+    return addTimer(ms, recurring, [weak_cond = std::move(weak_cond), cb = std::move(cb)]() mutable {
+        // 这用来检测智能指针的指向的对象是否存在(通过弱智能指针weak_ptr不会使引用计数 + 1的特点)
+        std::shared_ptr<void> tmp = weak_cond.lock();
+        if (tmp)
+        {
+            cb();
+        }
+    });
 }
 
 uint64_t TimerManager::getNextTimer()
@@ -202,7 +221,7 @@ uint64_t TimerManager::getNextTimer()
     }
 }
 
-void TimerManager::listExpireCb(std::vector<std::function<void()>>& cbs)
+void TimerManager::listExpireCb(std::vector<Callback>& cbs)
 {
     // 获得系统到现在的总时间
     uint64_t now = GetCurrentMS();
@@ -248,19 +267,24 @@ void TimerManager::listExpireCb(std::vector<std::function<void()>>& cbs)
     // 将超时定时器从原来的列表中删除
     m_timers.erase(m_timers.begin(), it);
     // 给回调函数集合扩容
-    cbs.resize(expired.size());
+    cbs.reserve(cbs.size() + expired.size());
     // 遍历超时定时器集合，将超时定时器的回调函数全部添加到回调函数集合中
     for (auto& timer : expired)
     {
-        cbs.push_back(timer->m_cb);
         // 判断是不是循环定时器
         if (timer->recurring)
         {
+            SharedCallback* shared = timer->m_cb.target<SharedCallback>();
+            if (shared)
+            {
+                cbs.emplace_back(*shared);
+            }
             timer->m_next = now + timer->m_ms;
             m_timers.insert(timer);
         }
         else
         {
+            cbs.push_back(std::move(timer->m_cb));
             timer->m_cb = nullptr;
         } 
     } 
@@ -95,6 +95,23 @@ std::string BacktraceToString(int size, int skip, const std::string prefix)
     return ss.str();
 }
 
+std::string BacktraceToString(void* const* frames, int size, int skip, const std::string prefix)
+{
+    std::stringstream ss;
+    char** str = ::backtrace_symbols(frames, size);
+    if (str == NULL)
+    {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "backtrace str erroor";
+        return ss.str();
+    }
+    for (int i = skip; i < size; i++)
+    {
+        ss << prefix << str[i] << std::endl;
+    }
+    free(str);
+    return ss.str();
+}
+
 
 
 /*---------------------  timer.h  ------------------------*/
@@ -0,0 +1,229 @@
+#include "watchdog.h"
+#include "config.h"
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include <algorithm>
+#include <execinfo.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// 协程连续运行超过这个时间时报告，0表示关闭看门狗；需要在调度器启动之前打开
+static ConfigVar<uint64_t>::ptr g_watchdog_slice_ms =
+    Config::Lookup<uint64_t>("scheduler.watchdog.slice_ms", "report fibers running longer than this without yielding", 0);
+
+// 看门狗的采样间隔
+static ConfigVar<uint64_t>::ptr g_watchdog_interval_ms =
+    Config::Lookup<uint64_t>("scheduler.watchdog.interval_ms", "watchdog sampling interval", 10);
+
+// 采集调用栈用的信号，0表示SIGRTMIN；应用自己使用SIGRTMIN时换成别的信号
+static ConfigVar<int>::ptr g_watchdog_signal =
+    Config::Lookup<int>("scheduler.watchdog.signal", "signal used to capture worker stacks, 0 means SIGRTMIN", 0);
+
+// 采集调用栈的最大层数
+static const int kMaxFrames = 64;
+
+/**
+ *  @brief 一次调用栈采集，同一时间只有看门狗线程发起一次
+ */
+struct StackCapture
+{
+    std::atomic<pid_t> target = {0};    // 需要采集的线程
+    std::atomic<int> size = {-1};       // 采集到的层数，-1表示还没有采集
+    void* frames[kMaxFrames];
+};
+
+static StackCapture s_capture;
+
+// 安装处理函数之前这个信号的处理方式，不是看门狗发出的信号交给它
+static struct sigaction s_prevAction;
+
+/**
+ *  @brief 在被采样的线程上执行，只采集栈地址，符号化留给看门狗线程
+ */
+static void OnCaptureSignal(int sig, siginfo_t* info, void* ctx)
+{
+    int saved = errno;
+    if (s_capture.target == (pid_t)syscall(SYS_gettid))
+    {
+        s_capture.size = ::backtrace(s_capture.frames, kMaxFrames);
+    }
+    else if (s_prevAction.sa_flags & SA_SIGINFO)
+    {
+        s_prevAction.sa_sigaction(sig, info, ctx);
+    }
+    else if (s_prevAction.sa_handler != SIG_DFL && s_prevAction.sa_handler != SIG_IGN)
+    {
+        s_prevAction.sa_handler(sig);
+    }
+    errno = saved;
+}
+
+Watchdog* Watchdog::GetInstance()
+{
+    // 看门狗线程一直运行到进程退出，单例不析构，退出时不会访问已经析构的成员
+    static Watchdog* s_instance = new Watchdog;
+    return s_instance;
+}
+
+Watchdog::Watchdog()
+{
+    // 第一次调用backtrace会加载libgcc并分配内存，不能发生在信号处理函数中
+    void* dummy[1];
+    ::backtrace(dummy, 1);
+}
+
+bool Watchdog::installSignal()
+{
+    if (m_signal)
+    {
+        return true;
+    }
+    int sig = g_watchdog_signal->getValue() ? g_watchdog_signal->getValue() : SIGRTMIN;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = OnCaptureSignal;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(sig, &sa, &s_prevAction) != 0)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "watchdog: sigaction(" << sig << ") fail, errno=" << errno
+                                  << " errstr=" << strerror(errno);
+        return false;
+    }
+    m_signal = sig;
+    return true;
+}
+
+void Watchdog::add(Scheduler* sc)
+{
+    Mutex::Lock lock(m_mutex);
+    if (std::find(m_schedulers.begin(), m_schedulers.end(), sc) == m_schedulers.end())
+    {
+        m_schedulers.push_back(sc);
+    }
+    // 没有打开时不启动看门狗线程，也不安装信号处理函数
+    if (!m_thread && g_watchdog_slice_ms->getValue())
+    {
+        m_thread.reset(new Thread(std::bind(&Watchdog::run, this), "watchdog"));
+    }
+}
+
+void Watchdog::remove(Scheduler* sc)
+{
+    Mutex::Lock lock(m_mutex);
+    m_schedulers.erase(std::remove(m_schedulers.begin(), m_schedulers.end(), sc), m_schedulers.end());
+}
+
+void Watchdog::run()
+{
+    while (true)
+    {
+        usleep(std::max<uint64_t>(1, g_watchdog_interval_ms->getValue()) * 1000);
+        if (g_watchdog_slice_ms->getValue())
+        {
+            check();
+        }
+    }
+}
+
+void Watchdog::check()
+{
+    uint64_t slice_us = g_watchdog_slice_ms->getValue() * 1000;
+    Mutex::Lock lock(m_mutex);
+    ++m_round;
+    for (Scheduler* sc : m_schedulers)
+    {
+        m_slices.clear();
+        sc->getRunningSlices(m_slices);
+        uint64_t now = GetCurrentUS();
+        for (auto& i : m_slices)
+        {
+            if (i.tid == -1)
+            {
+                continue;
+            }
+            auto it = m_reported.find(i.tid);
+            if (it != m_reported.end())
+            {
+                it->second.round = m_round;
+            }
+            if (!i.startUs || now < i.startUs + slice_us)
+            {
+                continue;
+            }
+            if (it == m_reported.end())
+            {
+                it = m_reported.emplace(i.tid, Reported()).first;
+                it->second.round = m_round;
+            }
+            else if (it->second.startUs == i.startUs)
+            {
+                continue;
+            }
+            it->second.startUs = i.startUs;
+
+            std::string bt;
+            if (!capture(i.tid, bt))
+            {
+                bt = "    <backtrace unavailable>\n";
+            }
+            ++m_reportCount;
+            SYLAR_LOG_WARN(g_logger) << "watchdog: scheduler=" << sc->getName() << " worker=" << i.index
+                                     << " tid=" << i.tid << " fiber_id=" << i.fiberId
+                                     << " running " << (now - i.startUs) / 1000 << "ms without yielding"
+                                     << std::endl << bt;
+        }
+    }
+
+    // 这一轮没有采样到的线程已经退出(比如伸缩退出的调度线程，或者调度器已经停止)，不再保留它的记录
+    for (auto it = m_reported.begin(); it != m_reported.end();)
+    {
+        if (it->second.round != m_round)
+        {
+            it = m_reported.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+bool Watchdog::capture(pid_t tid, std::string& bt)
+{
+    if (!installSignal())
+    {
+        return false;
+    }
+    s_capture.size = -1;
+    s_capture.target = tid;
+    if (syscall(SYS_tgkill, getpid(), tid, m_signal) != 0)
+    {
+        s_capture.target = 0;
+        return false;
+    }
+    for (int i = 0; i < 200 && s_capture.size < 0; ++i)
+    {
+        usleep(100);
+    }
+    s_capture.target = 0;
+    int size = s_capture.size;
+    if (size <= 0)
+    {
+        return false;
+    }
+    // 跳过信号处理函数和信号返回的栈帧
+    bt = BacktraceToString(s_capture.frames, size, 2, "    ");
+    return true;
+}
+
+}
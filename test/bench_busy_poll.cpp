@@ -0,0 +1,122 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+
+/**
+ * @brief 忙轮询对请求延迟的影响
+ * @details 服务端是单线程的IOManager，在被hook的socket上回显；客户端是不经过hook的普通线程，用阻塞socket
+ *          发送请求、等待响应，两个请求之间间隔一段时间，让服务端在请求之间空闲下来。
+ *          分别在 iomanager.busy_poll.spin_us 为0和给定值时运行，输出往返延迟的p50/p99/p999以及进程的CPU占用
+ *          用法: bench_busy_poll [忙轮询微秒数] [请求数] [请求间隔微秒数]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void echo(int fd) {
+    char buf[64];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        if (write(fd, buf, n) != n) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static uint64_t cpu_us() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec * 1000000ull + usage.ru_utime.tv_usec
+           + usage.ru_stime.tv_sec * 1000000ull + usage.ru_stime.tv_usec;
+}
+
+static void run(uint64_t spin_us, size_t requests, uint64_t gap_us) {
+    sylar::Config::Lookup<uint64_t>("iomanager.busy_poll.spin_us")->setValue(spin_us);
+    sylar::IOManager server_iom(1, false, "rpc");
+
+    static int listen_fd = -1;
+    static sockaddr_in addr;
+    std::atomic<bool> listening{false};
+    server_iom.schedule([&listening]() {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        SYLAR_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        SYLAR_ASSERT(listen(listen_fd, 16) == 0);
+        socklen_t len = sizeof(addr);
+        SYLAR_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+        listening = true;
+        int fd = accept(listen_fd, nullptr, nullptr);
+        SYLAR_ASSERT(fd >= 0);
+        close(listen_fd);
+        echo(fd);
+    });
+    while (!listening) {
+        usleep(1000);
+    }
+
+    // 客户端线程不是调度线程，socket调用不经过hook
+    std::vector<uint64_t> latencies;
+    latencies.reserve(requests);
+    uint64_t cpu = 0;
+    uint64_t wall = 0;
+    sylar::Thread client([&]() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        char buf[64] = {0};
+        uint64_t cpu_begin = cpu_us();
+        uint64_t wall_begin = sylar::GetCurrentUS();
+        for (size_t i = 0; i < requests; ++i) {
+            usleep(gap_us);
+            uint64_t begin = sylar::GetCurrentUS();
+            SYLAR_ASSERT(write(fd, buf, sizeof(buf)) == sizeof(buf));
+            size_t got = 0;
+            while (got < sizeof(buf)) {
+                ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+                SYLAR_ASSERT(n > 0);
+                got += n;
+            }
+            latencies.push_back(sylar::GetCurrentUS() - begin);
+        }
+        cpu = cpu_us() - cpu_begin;
+        wall = sylar::GetCurrentUS() - wall_begin;
+        close(fd);
+    }, "client");
+    client.join();
+    server_iom.stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * p))];
+    };
+    SYLAR_LOG_INFO(g_logger) << "busy_poll.spin_us=" << spin_us << " requests=" << requests
+                             << " gap=" << gap_us << "us p50=" << pct(0.5) << "us p99=" << pct(0.99)
+                             << "us p999=" << pct(0.999) << "us cpu=" << cpu * 100 / wall << "%";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    uint64_t spin_us = 1000;
+    size_t requests = 20000;
+    uint64_t gap_us = 100;
+    if (argc > 1) {
+        spin_us = std::stoull(argv[1]);
+    }
+    if (argc > 2) {
+        requests = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+        gap_us = std::stoull(argv[3]);
+    }
+    run(0, requests, gap_us);
+    run(spin_us, requests, gap_us);
+    return 0;
+}
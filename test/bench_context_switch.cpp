@@ -0,0 +1,104 @@
+#include "sylar.h"
+#include <ucontext.h>
+
+/**
+ * @brief 对比 ucontext 和汇编两种上下文切换的开销
+ * @details 每一轮是一次 main -> 协程 -> main 的往返，也就是两次切换
+ *          用法: bench_context_switch [轮数]
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const size_t kStackSize = 64 * 1024;
+static uint64_t s_rounds = 1000000;
+
+/*---------------------  ucontext  ------------------------*/
+
+static ucontext_t s_main_uc;
+static ucontext_t s_co_uc;
+
+static void uc_func() {
+    while (true) {
+        swapcontext(&s_co_uc, &s_main_uc);
+    }
+}
+
+static double bench_ucontext() {
+    std::vector<char> stack(kStackSize);
+    getcontext(&s_co_uc);
+    s_co_uc.uc_link = nullptr;
+    s_co_uc.uc_stack.ss_sp = stack.data();
+    s_co_uc.uc_stack.ss_size = stack.size();
+    makecontext(&s_co_uc, uc_func, 0);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_main_uc, &s_co_uc);
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    return (end - begin) * 1000.0 / (s_rounds * 2);
+}
+
+/*---------------------  asm  ------------------------*/
+
+#ifdef SYLAR_ASM_CONTEXT
+static sylar::Context s_main_ctx;
+static sylar::Context s_co_ctx;
+
+static void asm_func() {
+    while (true) {
+        sylar::SwapContext(&s_co_ctx, &s_main_ctx);
+    }
+}
+
+static double bench_asm() {
+    std::vector<char> stack(kStackSize);
+    sylar::MakeContext(&s_co_ctx, stack.data(), stack.size(), asm_func);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        sylar::SwapContext(&s_main_ctx, &s_co_ctx);
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    return (end - begin) * 1000.0 / (s_rounds * 2);
+}
+#endif
+
+/*---------------------  Fiber  ------------------------*/
+
+static double bench_fiber() {
+    sylar::Fiber::GetThis();
+    bool running = true;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&running](){
+        while (running) {
+            sylar::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->resume();
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    running = false;
+    fiber->resume();
+    return (end - begin) * 1000.0 / (s_rounds * 2);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_rounds = std::stoull(argv[1]);
+    }
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    SYLAR_LOG_INFO(g_logger) << "rounds=" << s_rounds;
+    SYLAR_LOG_INFO(g_logger) << "ucontext swapcontext: " << bench_ucontext() << " ns/switch";
+#ifdef SYLAR_ASM_CONTEXT
+    SYLAR_LOG_INFO(g_logger) << "asm swap_context:     " << bench_asm() << " ns/switch";
+#else
+    SYLAR_LOG_INFO(g_logger) << "asm swap_context:     not built (SYLAR_ASM_CONTEXT off)";
+#endif
+    SYLAR_LOG_INFO(g_logger) << "Fiber resume/yield (" << sylar::ContextBackendName() << "): "
+                             << bench_fiber() << " ns/switch";
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "sylar.h"
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+/**
+ * @brief IOManager句柄表的并发访问
+ * @details 打开大量eventfd，分给多个线程，每个线程只操作自己的那一段：
+ *          1. 第一次注册(armEvents)，句柄表从空开始增长
+ *          2. 在已经持久注册的fd上反复 addEvent / delEvent，不调用epoll_ctl，只剩句柄表和fd上的锁
+ *          用法: bench_fd_table [fd数] [线程数] [每个fd的addEvent次数]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void run_threads(size_t threads, const std::function<void(size_t)>& fn) {
+    std::vector<sylar::Thread::ptr> pool;
+    for (size_t i = 0; i < threads; ++i) {
+        pool.emplace_back(new sylar::Thread(std::bind(fn, i), "bench_" + std::to_string(i)));
+    }
+    for (auto& t : pool) {
+        t->join();
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    size_t count = 100000;
+    size_t threads = 16;
+    size_t rounds = 20;
+    if (argc > 1) {
+        count = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+        threads = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+        rounds = std::stoul(argv[3]);
+    }
+
+    rlimit limit;
+    limit.rlim_cur = limit.rlim_max = count + 1024;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        getrlimit(RLIMIT_NOFILE, &limit);
+        count = std::min<size_t>(count, limit.rlim_cur - 1024);
+        SYLAR_LOG_WARN(g_logger) << "setrlimit fail, use " << count << " fds";
+    }
+    std::vector<int> fds(count);
+    for (auto& fd : fds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(fd >= 0);
+    }
+
+    sylar::IOManager iom(1, false, "fd_table");
+    size_t per_thread = (count + threads - 1) / threads;
+    auto slice = [&](size_t idx, size_t& begin, size_t& end) {
+        begin = std::min(count, idx * per_thread);
+        end = std::min(count, begin + per_thread);
+    };
+
+    uint64_t start = sylar::GetCurrentUS();
+    run_threads(threads, [&](size_t idx) {
+        size_t begin, end;
+        slice(idx, begin, end);
+        for (size_t i = begin; i < end; ++i) {
+            SYLAR_ASSERT(iom.armEvents(fds[i]) == 0);
+        }
+    });
+    uint64_t arm_us = sylar::GetCurrentUS() - start;
+
+    start = sylar::GetCurrentUS();
+    run_threads(threads, [&](size_t idx) {
+        size_t begin, end;
+        slice(idx, begin, end);
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = begin; i < end; ++i) {
+                SYLAR_ASSERT(iom.addArmedEvent(fds[i], sylar::IOManager::READ, []() {}) == 0);
+                SYLAR_ASSERT(iom.delEvent(fds[i], sylar::IOManager::READ));
+            }
+        }
+    });
+    uint64_t add_us = sylar::GetCurrentUS() - start;
+
+    for (int fd : fds) {
+        iom.cancelAll(fd);
+        close(fd);
+    }
+    iom.stop();
+
+    SYLAR_LOG_INFO(g_logger) << "fds=" << count << " threads=" << threads
+                             << " armEvents/s=" << (uint64_t)(count * 1000000.0 / arm_us)
+                             << " addEvent+delEvent/s=" << (uint64_t)(count * rounds * 1000000.0 / add_us);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "sylar.h"
+
+/**
+ * @brief 协程句柄的引用计数开销
+ * @details 1. 从裸指针重新得到持有者再释放：shared_from_this 对比 IntrusivePtr，以及多个线程同时操作同一个对象
+ *          2. 一次 resume/yield 往返中，让出时持有当前协程(GetThis)对比借用(GetThisRaw)
+ *          用法: bench_fiber_handle [次数] [线程数]
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t s_rounds = 10000000;
+static int s_threads = 2;
+
+struct SharedObj : public std::enable_shared_from_this<SharedObj> {
+    uint64_t value = 0;
+};
+
+struct IntrusiveObj : public sylar::RefCounted {
+    uint64_t value = 0;
+};
+
+/*---------------------  句柄  ------------------------*/
+
+template<typename Fn>
+static double bench_threads(int threads, Fn fn) {
+    std::vector<sylar::Thread::ptr> workers;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(std::make_shared<sylar::Thread>(fn, "bench_" + std::to_string(i)));
+    }
+    for (auto& t : workers) {
+        t->join();
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    return (end - begin) * 1000.0 / (s_rounds * threads);
+}
+
+static double bench_shared(int threads) {
+    auto obj = std::make_shared<SharedObj>();
+    SharedObj* raw = obj.get();
+    return bench_threads(threads, [raw]() {
+        for (uint64_t i = 0; i < s_rounds; ++i) {
+            std::shared_ptr<SharedObj> p = raw->shared_from_this();
+            asm volatile("" : : "r"(p.get()) : "memory");
+        }
+    });
+}
+
+static double bench_intrusive(int threads) {
+    sylar::IntrusivePtr<IntrusiveObj> obj(new IntrusiveObj);
+    IntrusiveObj* raw = obj.get();
+    return bench_threads(threads, [raw]() {
+        for (uint64_t i = 0; i < s_rounds; ++i) {
+            sylar::IntrusivePtr<IntrusiveObj> p(raw);
+            asm volatile("" : : "r"(p.get()) : "memory");
+        }
+    });
+}
+
+/*---------------------  resume/yield  ------------------------*/
+
+template<bool Borrow>
+static double bench_switch() {
+    sylar::Fiber::GetThis();
+    bool running = true;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&running](){
+        while (running) {
+            if (Borrow) {
+                sylar::Fiber::GetThisRaw()->yield();
+            } else {
+                sylar::Fiber::GetThis()->yield();
+            }
+        }
+    }, 0, false));
+
+    uint64_t rounds = s_rounds / 10;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < rounds; ++i) {
+        fiber->resume();
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    running = false;
+    fiber->resume();
+    return (end - begin) * 1000.0 / (rounds * 2);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_rounds = std::stoull(argv[1]);
+    }
+    if (argc > 2) {
+        s_threads = std::max(1, atoi(argv[2]));
+    }
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    SYLAR_LOG_INFO(g_logger) << "rounds=" << s_rounds << " threads=" << s_threads;
+    SYLAR_LOG_INFO(g_logger) << "shared_from_this acquire/release: " << bench_shared(1) << " ns/op, "
+                             << s_threads << " threads " << bench_shared(s_threads) << " ns/op";
+    SYLAR_LOG_INFO(g_logger) << "IntrusivePtr acquire/release:     " << bench_intrusive(1) << " ns/op, "
+                             << s_threads << " threads " << bench_intrusive(s_threads) << " ns/op";
+    SYLAR_LOG_INFO(g_logger) << "resume/yield holding GetThis():   " << bench_switch<false>() << " ns/switch";
+    SYLAR_LOG_INFO(g_logger) << "resume/yield borrowing GetThisRaw(): " << bench_switch<true>() << " ns/switch";
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "sylar.h"
+
+/**
+ * @brief 对比协程局部存储和 thread_local 的访问开销
+ * @details 在同一个协程里分别读写 thread_local 变量和 FiberLocal 变量
+ *          用法: bench_fiber_local [次数]
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t s_rounds = 10000000;
+
+static thread_local uint64_t t_value = 0;
+static sylar::FiberLocal<uint64_t> s_value;
+
+static double bench_thread_local() {
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        t_value += i;
+        asm volatile("" : : : "memory");
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    return (end - begin) * 1000.0 / s_rounds;
+}
+
+static double bench_fiber_local() {
+    *s_value = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        *s_value += i;
+        asm volatile("" : : : "memory");
+    }
+    uint64_t end = sylar::GetCurrentUS();
+    return (end - begin) * 1000.0 / s_rounds;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_rounds = std::stoull(argv[1]);
+    }
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    double tl = 0, fl = 0;
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&]() {
+        tl = bench_thread_local();
+        fl = bench_fiber_local();
+    }, 0, false));
+    fiber->resume();
+
+    SYLAR_LOG_INFO(g_logger) << "rounds=" << s_rounds;
+    SYLAR_LOG_INFO(g_logger) << "thread_local read+write: " << tl << " ns/op";
+    SYLAR_LOG_INFO(g_logger) << "FiberLocal read+write:   " << fl << " ns/op";
+    return 0;
+}
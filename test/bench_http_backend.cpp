@@ -0,0 +1,108 @@
+#include "sylar.h"
+
+/**
+ * @brief HttpServer 在 epoll 和 io_uring 两种IO后端下的吞吐
+ * @details 服务端和压测客户端各用一个IOManager，客户端固定使用epoll，只切换服务端的 iomanager.backend。
+ *          每个客户端协程保持一条长连接，不停地发送GET请求并等待响应，统计固定时间内完成的请求数
+ *          用法: bench_http_backend [连接数] [每种后端的秒数] [端口]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<bool> s_stop{false};
+static std::atomic<uint64_t> s_requests{0};
+static std::atomic<uint64_t> s_errors{0};
+
+static void client(sylar::Address::ptr addr) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if (!sock->connect(addr)) {
+        ++s_errors;
+        return;
+    }
+    sylar::http::HttpConnection conn(sock);
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest(0x11, false));
+    req->setPath("/bench");
+    req->setHeader("Host", "localhost");
+    // sendRequest 会把请求打印到标准输出，这里直接写序列化好的请求
+    std::string data = req->toString();
+    while (!s_stop) {
+        if (conn.writeFixSize(data.c_str(), data.size()) <= 0 || !conn.recvResponse()) {
+            ++s_errors;
+            return;
+        }
+        ++s_requests;
+    }
+}
+
+static double run(const std::string& backend, size_t conns, int seconds, uint16_t port) {
+    auto backend_var = sylar::Config::Lookup<std::string>("iomanager.backend");
+    backend_var->setValue(backend);
+    sylar::IOManager server_iom(1, false, "http_" + backend);
+    backend_var->setValue("epoll");
+    if (backend == "io_uring" && !server_iom.hasUring()) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring not supported, skip";
+        return 0;
+    }
+
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true, &server_iom, &server_iom));
+    sylar::Address::ptr addr = sylar::IPAddress::Create("127.0.0.1", port);
+    std::atomic<bool> started{false};
+    server_iom.schedule([server, addr, &started]() {
+        SYLAR_ASSERT(server->bind(addr));
+        server->getServletDispatch()->addServlet("/bench", [](sylar::http::HttpRequest::ptr req,
+                                                               sylar::http::HttpResponse::ptr rsp,
+                                                               sylar::http::HttpSession::ptr session) {
+            rsp->setBody("hello sylar");
+            return 0;
+        });
+        server->start();
+        started = true;
+    });
+    while (!started) {
+        usleep(1000);
+    }
+
+    s_stop = false;
+    s_requests = 0;
+    s_errors = 0;
+    sylar::IOManager client_iom(1, false, "client");
+    for (size_t i = 0; i < conns; ++i) {
+        client_iom.schedule(std::bind(&client, addr));
+    }
+    // 先预热一会儿，连接都建立之后再开始计数
+    usleep(200 * 1000);
+    uint64_t begin_requests = s_requests;
+    uint64_t begin = sylar::GetCurrentUS();
+    sleep(seconds);
+    uint64_t done = s_requests - begin_requests;
+    uint64_t end = sylar::GetCurrentUS();
+    s_stop = true;
+    client_iom.stop();
+    server->stop();
+    server_iom.stop();
+    SYLAR_ASSERT(s_errors == 0);
+    return done * 1000000.0 / (end - begin);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("http")->setLoggerLevel(sylar::LogLevel::ERROR);
+    size_t conns = 32;
+    int seconds = 3;
+    uint16_t port = 18020;
+    if (argc > 1) {
+        conns = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = std::stoi(argv[2]);
+    }
+    if (argc > 3) {
+        port = std::stoi(argv[3]);
+    }
+    for (const char* backend : {"epoll", "io_uring"}) {
+        double qps = run(backend, conns, seconds, port++);
+        SYLAR_LOG_INFO(g_logger) << "backend=" << backend << " conns=" << conns
+                                 << " requests/s=" << (uint64_t)qps;
+    }
+    return 0;
+}
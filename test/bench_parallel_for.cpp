@@ -0,0 +1,58 @@
+#include "sylar.h"
+
+/**
+ * @brief parallel_for 和逐个元素schedule的对比
+ * @details 逐个schedule每个元素一个任务，用WaitGroup等待；parallel_for按线程数切块，每块一个任务
+ *          用法: bench_parallel_for [线程数] [元素数]
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 每个元素一点计算量
+ */
+static uint64_t work(size_t i) {
+    uint64_t x = i;
+    for (int k = 0; k < 50; ++k) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return x;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t n = argc > 2 ? atoi(argv[2]) : 200000;
+    std::vector<uint64_t> out(n);
+
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+
+    uint64_t begin = sylar::GetCurrentUS();
+    sylar::WaitGroup wg(n);
+    for (size_t i = 0; i < n; ++i) {
+        sc.schedule([&out, &wg, i]() {
+            out[i] = work(i);
+            wg.done();
+        });
+    }
+    wg.wait();
+    uint64_t naive = sylar::GetCurrentUS() - begin;
+
+    begin = sylar::GetCurrentUS();
+    sylar::parallel_for(&sc, 0, n, [&out](size_t i) { out[i] = work(i); });
+    uint64_t chunked = sylar::GetCurrentUS() - begin;
+
+    begin = sylar::GetCurrentUS();
+    uint64_t sum = sylar::parallel_reduce(&sc, 0, n, (uint64_t)0,
+        [](size_t i) { return work(i); },
+        [](uint64_t a, uint64_t b) { return a ^ b; });
+    uint64_t reduced = sylar::GetCurrentUS() - begin;
+
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "threads=" << threads << " items=" << n
+                             << " per-item schedule: " << naive << "us"
+                             << " parallel_for: " << chunked << "us"
+                             << " parallel_reduce: " << reduced << "us (" << sum << ")";
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief 一次性注册和持久注册的系统调用次数
+ * @details 服务端和客户端各一个IOManager，每个客户端协程在一条长连接上不停地发送请求并等待回显。
+ *          替换libc的epoll_ctl和epoll_pwait统计调用次数(相当于 strace -c -e epoll_ctl,epoll_pwait)，
+ *          分别在 iomanager.persistent_events 关闭和打开时运行，输出每次往返的调用次数和吞吐
+ *          用法: bench_persistent_events [连接数] [每种模式的秒数]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_ctl{0};
+static std::atomic<uint64_t> s_epoll_wait{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+    ++s_epoll_ctl;
+    return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+extern "C" int epoll_pwait(int epfd, struct epoll_event* events, int maxevents, int timeout, const sigset_t* sigmask) {
+    ++s_epoll_wait;
+    // 内核的sigset_t是64位
+    return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, sigmask, 64 / 8);
+}
+
+static std::atomic<bool> s_stop{false};
+static std::atomic<uint64_t> s_rounds{0};
+
+static void echo(int fd) {
+    char buf[64];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        if (write(fd, buf, n) != n) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void client(sockaddr_in addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    char buf[64];
+    const char req[] = "GET /bench HTTP/1.1\r\n\r\n";
+    while (!s_stop) {
+        SYLAR_ASSERT(write(fd, req, sizeof(req)) == sizeof(req));
+        SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == sizeof(req));
+        ++s_rounds;
+    }
+    close(fd);
+}
+
+static void run(bool persistent, size_t conns, int seconds) {
+    sylar::Config::Lookup<bool>("iomanager.persistent_events")->setValue(persistent);
+    sylar::IOManager server_iom(1, false, "server");
+    sylar::IOManager client_iom(1, false, "client");
+
+    static int listen_fd = -1;
+    static sockaddr_in addr;
+    std::atomic<bool> listening{false};
+    server_iom.schedule([conns, &listening]() {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        SYLAR_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        SYLAR_ASSERT(listen(listen_fd, 1024) == 0);
+        socklen_t len = sizeof(addr);
+        SYLAR_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+        listening = true;
+        for (size_t i = 0; i < conns; ++i) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            SYLAR_ASSERT(fd >= 0);
+            sylar::IOManager::GetThis()->schedule(std::bind(&echo, fd));
+        }
+        close(listen_fd);
+    });
+    while (!listening) {
+        usleep(1000);
+    }
+
+    s_stop = false;
+    s_rounds = 0;
+    for (size_t i = 0; i < conns; ++i) {
+        client_iom.schedule(std::bind(&client, addr));
+    }
+    usleep(200 * 1000);
+    uint64_t rounds = s_rounds;
+    uint64_t ctl = s_epoll_ctl;
+    uint64_t waits = s_epoll_wait;
+    uint64_t begin = sylar::GetCurrentUS();
+    sleep(seconds);
+    rounds = s_rounds - rounds;
+    ctl = s_epoll_ctl - ctl;
+    waits = s_epoll_wait - waits;
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    s_stop = true;
+    client_iom.stop();
+    server_iom.stop();
+
+    SYLAR_LOG_INFO(g_logger) << "persistent=" << persistent << " conns=" << conns
+                             << " round trips/s=" << (uint64_t)(rounds * 1000000.0 / used)
+                             << " epoll_ctl/round trip=" << (double)ctl / rounds
+                             << " epoll_pwait/round trip=" << (double)waits / rounds;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    size_t conns = 64;
+    int seconds = 3;
+    if (argc > 1) {
+        conns = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = std::stoi(argv[2]);
+    }
+    run(false, conns, seconds);
+    run(true, conns, seconds);
+    return 0;
+}
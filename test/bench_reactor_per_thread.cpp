@@ -0,0 +1,140 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief 共享epoll和每线程反应器的对比
+ * @details 服务端IOManager有多个调度线程，客户端IOManager固定使用共享epoll。每个客户端协程在一条长连接上不停地发送请求并等待回显。
+ *          分别在 iomanager.reactor_per_thread 关闭和打开时运行，输出吞吐、每次往返的epoll_pwait次数，
+ *          以及服务端协程在等待之后换到另一个线程上恢复的比例
+ *          用法: bench_reactor_per_thread [服务端线程数] [连接数] [每种模式的秒数]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_wait{0};
+
+extern "C" int epoll_pwait(int epfd, struct epoll_event* events, int maxevents, int timeout, const sigset_t* sigmask) {
+    ++s_epoll_wait;
+    // 内核的sigset_t是64位
+    return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, sigmask, 64 / 8);
+}
+
+static std::atomic<bool> s_stop{false};
+static std::atomic<uint64_t> s_rounds{0};
+static std::atomic<uint64_t> s_served{0};
+static std::atomic<uint64_t> s_migrated{0};
+
+static void echo(int fd) {
+    char buf[64];
+    int last = -1;
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        int tid = sylar::GetThreadId();
+        if (last != -1 && tid != last) {
+            ++s_migrated;
+        }
+        last = tid;
+        ++s_served;
+        if (write(fd, buf, n) != n) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void client(sockaddr_in addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    char buf[64];
+    const char req[] = "GET /bench HTTP/1.1\r\n\r\n";
+    while (!s_stop) {
+        SYLAR_ASSERT(write(fd, req, sizeof(req)) == sizeof(req));
+        SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == sizeof(req));
+        ++s_rounds;
+    }
+    close(fd);
+}
+
+static void run(bool per_thread, size_t threads, size_t conns, int seconds) {
+    auto reactor_var = sylar::Config::Lookup<bool>("iomanager.reactor_per_thread");
+    reactor_var->setValue(per_thread);
+    sylar::IOManager server_iom(threads, false, "server");
+    reactor_var->setValue(false);
+    sylar::IOManager client_iom(2, false, "client");
+
+    static int listen_fd = -1;
+    static sockaddr_in addr;
+    std::atomic<bool> listening{false};
+    server_iom.schedule([conns, &listening]() {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        SYLAR_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        SYLAR_ASSERT(listen(listen_fd, 1024) == 0);
+        socklen_t len = sizeof(addr);
+        SYLAR_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+        listening = true;
+        for (size_t i = 0; i < conns; ++i) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            SYLAR_ASSERT(fd >= 0);
+            sylar::IOManager::GetThis()->schedule(std::bind(&echo, fd));
+        }
+        close(listen_fd);
+    });
+    while (!listening) {
+        usleep(1000);
+    }
+
+    s_stop = false;
+    s_rounds = 0;
+    for (size_t i = 0; i < conns; ++i) {
+        client_iom.schedule(std::bind(&client, addr));
+    }
+    usleep(200 * 1000);
+    uint64_t rounds = s_rounds;
+    uint64_t waits = s_epoll_wait;
+    uint64_t served = s_served;
+    uint64_t migrated = s_migrated;
+    uint64_t begin = sylar::GetCurrentUS();
+    sleep(seconds);
+    rounds = s_rounds - rounds;
+    waits = s_epoll_wait - waits;
+    served = s_served - served;
+    migrated = s_migrated - migrated;
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    s_stop = true;
+    client_iom.stop();
+    server_iom.stop();
+
+    SYLAR_LOG_INFO(g_logger) << "reactor_per_thread=" << per_thread << " threads=" << threads << " conns=" << conns
+                             << " round trips/s=" << (uint64_t)(rounds * 1000000.0 / used)
+                             << " epoll_pwait/round trip=" << (double)waits / rounds
+                             << " server migrations=" << (served ? migrated * 100.0 / served : 0) << "%";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    size_t threads = 4;
+    size_t conns = 64;
+    int seconds = 3;
+    if (argc > 1) {
+        threads = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+        conns = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+        seconds = std::stoi(argv[3]);
+    }
+    run(false, threads, conns, seconds);
+    run(true, threads, conns, seconds);
+    return 0;
+}
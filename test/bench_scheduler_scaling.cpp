@@ -0,0 +1,70 @@
+#include "sylar.h"
+
+/**
+ * @brief 调度器吞吐随线程数的变化
+ * @details 每个线程数下先由外部线程投递一批根任务，每个根任务再在调度线程内派生子任务，
+ *          前者走全局注入队列，后者走调度线程自己的队列并被空闲线程窃取
+ *          用法: bench_scheduler_scaling [最大线程数] [根任务数] [每个根任务派生的子任务数]
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+
+/**
+ * @brief 模拟一点计算量，避免纯粹测量队列锁
+ */
+static void work() {
+    volatile uint64_t x = 0;
+    for (int i = 0; i < 200; ++i) {
+        x = x + i;
+    }
+    ++s_done;
+}
+
+static double run(size_t threads, size_t roots, size_t children) {
+    s_done = 0;
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    uint64_t begin = sylar::GetCurrentUS();
+    for (size_t i = 0; i < roots; ++i) {
+        sc.schedule([&sc, children]() {
+            for (size_t j = 0; j < children; ++j) {
+                sc.schedule(&work);
+            }
+            work();
+        });
+    }
+    sc.stop();
+    uint64_t end = sylar::GetCurrentUS();
+    SYLAR_ASSERT(s_done == roots * (children + 1));
+    return s_done * 1000000.0 / (end - begin);
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    size_t roots = 1000;
+    size_t children = 100;
+    if (argc > 1) {
+        max_threads = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+        roots = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+        children = std::stoul(argv[3]);
+    }
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    double base = 0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double tps = run(threads, roots, children);
+        if (threads == 1) {
+            base = tps;
+        }
+        SYLAR_LOG_INFO(g_logger) << "threads=" << threads
+                                 << " tasks/s=" << (uint64_t)tps
+                                 << " speedup=" << tps / base;
+    }
+    return 0;
+}
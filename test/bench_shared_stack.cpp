@@ -0,0 +1,74 @@
+#include "sylar.h"
+#include <fstream>
+
+/**
+ * @brief 统计独立栈和共享栈两种模式下，每个挂起(yield之后未结束)协程占用的内存
+ * @details 用法: bench_shared_stack [协程数量]
+ *          独立栈模式每个协程还会占用两个VMA(栈和保护页)，数量过大时会受 vm.max_map_count 限制
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 读取进程的虚拟内存和常驻内存(字节)
+ */
+static void read_mem(uint64_t& vsz, uint64_t& rss) {
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    ifs >> size >> resident;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    vsz = size * page;
+    rss = resident * page;
+}
+
+/**
+ * @brief 模拟一个处理完请求后挂起等待下一个请求的连接协程
+ */
+static void idle_conn() {
+    char buf[512];
+    memset(buf, 'x', sizeof(buf));
+    volatile char sink = buf[sizeof(buf) - 1];
+    (void)sink;
+    sylar::Fiber::GetThis()->yield();
+}
+
+static void run(size_t count, bool shared) {
+    sylar::Fiber::GetThis();
+    uint64_t vsz0, rss0, vsz1, rss1;
+    read_mem(vsz0, rss0);
+    uint64_t save0 = sylar::Fiber::GetSharedStackSaveBytes();
+
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(&idle_conn, 0, false, shared)));
+        fibers.back()->resume();
+    }
+
+    // 共享栈模式下最后几个协程的数据还留在运行栈上，统计时不影响结论
+    read_mem(vsz1, rss1);
+    uint64_t save1 = sylar::Fiber::GetSharedStackSaveBytes();
+    SYLAR_LOG_INFO(g_logger) << (shared ? "shared stack " : "private stack")
+                             << " fibers=" << count
+                             << " rss/fiber=" << (rss1 - rss0) / count << "B"
+                             << " vsz/fiber=" << (vsz1 - vsz0) / count << "B"
+                             << " save_buf/fiber=" << (save1 - save0) / count << "B";
+
+    for (auto& fiber : fibers) {
+        fiber->resume();
+    }
+    fibers.clear();
+    sylar::PooledStackAllocator::ReleaseThreadCache();
+}
+
+int main(int argc, char** argv) {
+    size_t count = 10000;
+    if (argc > 1) {
+        count = std::stoul(argv[1]);
+    }
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    run(count, false);
+    run(count, true);
+    return 0;
+}
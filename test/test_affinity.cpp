@@ -0,0 +1,80 @@
+#include "sylar.h"
+
+/**
+ * @brief 线程亲和性
+ * @details 1. CPU列表的解析和格式化
+ *          2. 各种策略的分配结果
+ *          3. compact策略的调度器，任务只在分配给它的CPU上运行
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void test_cpu_list() {
+    std::vector<int> cpus;
+    SYLAR_ASSERT(sylar::ParseCpuList("0-3, 8,10-11,2", cpus));
+    SYLAR_ASSERT((cpus == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    SYLAR_ASSERT(sylar::FormatCpuList(cpus) == "0-3,8,10-11");
+    SYLAR_ASSERT(!sylar::ParseCpuList("3-1", cpus));
+    SYLAR_ASSERT(!sylar::ParseCpuList("a", cpus));
+    SYLAR_ASSERT(!sylar::ParseCpuList("", cpus));
+}
+
+static void test_plan() {
+    const sylar::CpuTopology& topo = sylar::CpuTopology::Get();
+    SYLAR_LOG_INFO(g_logger) << "cpus=" << sylar::FormatCpuList(topo.getCpus())
+                             << " nodes=" << topo.getNodeCount();
+
+    auto none = sylar::PlanAffinity("none", 3);
+    SYLAR_ASSERT(none.size() == 3 && none[0].empty());
+
+    auto compact = sylar::PlanAffinity("compact", 3);
+    for (auto& i : compact) {
+        SYLAR_ASSERT(i.size() == 1 && topo.getNodeOfCpu(i[0]) >= 0);
+    }
+    SYLAR_ASSERT(compact[0][0] == topo.getNodeCpus(0)[0]);
+
+    auto scatter = sylar::PlanAffinity("scatter", 2);
+    SYLAR_ASSERT(topo.getNodeOfCpu(scatter[1][0]) == (topo.getNodeCount() > 1 ? 1 : 0));
+
+    auto numa = sylar::PlanAffinity("numa", 2);
+    SYLAR_ASSERT(numa[0] == topo.getNodeCpus(0));
+
+    auto list = sylar::PlanAffinity("5,7", 3);
+    SYLAR_ASSERT(list[0][0] == 5 && list[1][0] == 7 && list[2][0] == 5);
+
+    auto bad = sylar::PlanAffinity("x-y", 2);
+    SYLAR_ASSERT(bad.size() == 2 && bad[1].empty());
+}
+
+static void test_scheduler() {
+    auto plan = sylar::PlanAffinity("compact", 2);
+    std::set<int> allowed;
+    for (auto& i : plan) {
+        allowed.insert(i.begin(), i.end());
+    }
+
+    sylar::Scheduler sc(2, false, "affinity");
+    SYLAR_ASSERT(sc.getAffinity() == "none");
+    sc.setAffinity("compact");
+    sc.start();
+    static std::atomic<int> done{0};
+    static std::atomic<int> misplaced{0};
+    for (int i = 0; i < 100; ++i) {
+        sc.schedule([&allowed]() {
+            if (!allowed.count(sched_getcpu())) {
+                ++misplaced;
+            }
+            ++done;
+        });
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "tasks=" << done << " misplaced=" << misplaced;
+    SYLAR_ASSERT(done == 100 && misplaced == 0);
+}
+
+int main(int argc, char** argv) {
+    test_cpu_list();
+    test_plan();
+    test_scheduler();
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/**
+ * @brief 忙轮询
+ * @details 打开 iomanager.busy_poll.spin_us 后，刚执行过任务的线程留在idle里轮询而不休眠：
+ *          1. 轮询期间其他线程添加的任务、新加的定时器和就绪的IO都能及时处理
+ *          2. 轮询期间调用stop()能及时退出
+ *          共享epoll和每线程反应器两种模式都检查
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static bool wait_for(std::atomic<int>& counter, int expect, uint64_t timeout_ms) {
+    uint64_t begin = sylar::GetCurrentMS();
+    while (counter < expect) {
+        if (sylar::GetCurrentMS() - begin > timeout_ms) {
+            return false;
+        }
+        usleep(100);
+    }
+    return true;
+}
+
+static void test_tasks_and_timers() {
+    sylar::IOManager iom(2, false, "busy_poll");
+    static std::atomic<int> done{0};
+    done = 0;
+
+    // 每个任务都让线程重新进入忙轮询，轮询的时间远大于任务之间的间隔
+    for (int i = 0; i < 200; ++i) {
+        usleep(200);
+        iom.schedule([]() {
+            ++done;
+        });
+        SYLAR_ASSERT2(wait_for(done, i + 1, 100), "task not run while spinning, round=" << i);
+    }
+
+    // 轮询期间加入的定时器按时触发
+    static std::atomic<int> fired{0};
+    fired = 0;
+    uint64_t begin = sylar::GetCurrentMS();
+    iom.addTimer(20, false, []() {
+        ++fired;
+    });
+    SYLAR_ASSERT(wait_for(fired, 1, 1000));
+    uint64_t used = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "tasks=" << done << " timer fired after " << used << "ms";
+    SYLAR_ASSERT(used < 200);
+
+    // 轮询的线程上等待的IO
+    static std::atomic<int> echoed{0};
+    echoed = 0;
+    iom.schedule([&iom]() {
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        SYLAR_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        SYLAR_ASSERT(listen(listen_fd, 16) == 0);
+        socklen_t len = sizeof(addr);
+        SYLAR_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+        iom.schedule([addr]() {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+            char buf[16];
+            for (int i = 0; i < 100; ++i) {
+                SYLAR_ASSERT(write(fd, "ping", 4) == 4);
+                SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == 4);
+                ++echoed;
+            }
+            close(fd);
+        });
+        int fd = accept(listen_fd, nullptr, nullptr);
+        SYLAR_ASSERT(fd >= 0);
+        close(listen_fd);
+        char buf[16];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            SYLAR_ASSERT(write(fd, buf, n) == n);
+        }
+        close(fd);
+    });
+    SYLAR_ASSERT(wait_for(echoed, 100, 5000));
+
+    // 线程还在轮询时停止
+    begin = sylar::GetCurrentMS();
+    iom.stop();
+    used = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "echo rounds=" << echoed << " stop took " << used << "ms";
+    SYLAR_ASSERT(used < 1000);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<uint64_t>("iomanager.busy_poll.spin_us")->setValue(500 * 1000);
+    test_tasks_and_timers();
+    sylar::Config::Lookup<bool>("iomanager.reactor_per_thread")->setValue(true);
+    test_tasks_and_timers();
+    return 0;
+}
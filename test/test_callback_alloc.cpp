@@ -0,0 +1,124 @@
+#include "sylar.h"
+#include <cstdlib>
+#include <new>
+
+/**
+ * @brief 统计调度小lambda时的堆分配次数
+ * @details 替换全局 operator new 计数。先用同样规模的任务预热，让队列容量和协程缓存稳定下来，
+ *          之后调度线程之外的投递和调度线程之内的投递都不应该再分配内存
+ */
+
+static std::atomic<uint64_t> s_allocs{0};
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int kTasks = 10000;
+static std::atomic<int> s_done{0};
+
+/**
+ * @brief 捕获了几个变量的小lambda，放得进 Callback 的内部缓冲区
+ */
+static void schedule_batch(sylar::Scheduler& sc) {
+    uint64_t a = 1, b = 2;
+    int* counter = nullptr;
+    for (int i = 0; i < kTasks; ++i) {
+        sc.schedule([a, b, i, counter]() {
+            (void)a; (void)b; (void)i; (void)counter;
+            ++s_done;
+        });
+    }
+}
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+/**
+ * @brief 在调度线程内派生子任务，走调度线程自己的队列
+ */
+static void spawn_children(sylar::Scheduler* sc) {
+    for (int i = 0; i < kTasks; ++i) {
+        sc->schedule([i]() {
+            (void)i;
+            ++s_done;
+        });
+    }
+    ++s_done;
+}
+
+int main(int argc, char** argv) {
+    static_assert(sizeof(sylar::Callback) <= 64, "Callback should fit in a cache line");
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+
+    sylar::Callback empty_fn((void(*)())nullptr);
+    SYLAR_ASSERT(!empty_fn);
+    sylar::Callback empty_std{std::function<void()>()};
+    SYLAR_ASSERT(!empty_std);
+
+    uint64_t before = s_allocs;
+    sylar::Callback small([before]() { (void)before; });
+    SYLAR_ASSERT(s_allocs == before);
+    sylar::Callback moved(std::move(small));
+    SYLAR_ASSERT(!small && moved);
+    SYLAR_ASSERT(s_allocs == before);
+
+    sylar::Scheduler sc(2, false, "alloc");
+    sc.start();
+
+    // 队列容量只增不减，但每轮任务在线程间的分布不同，前几轮可能还会扩容；
+    // 这里取多轮中的最小值，稳定状态下应该为0，总数也远小于任务数(不是每个任务一次分配)
+    const int kRounds = 8;
+    uint64_t external_min = ~0ull, internal_min = ~0ull;
+    uint64_t external_total = 0, internal_total = 0;
+    for (int round = 0; round < kRounds; ++round) {
+        s_done = 0;
+        uint64_t begin = s_allocs;
+        schedule_batch(sc);
+        wait_done(kTasks);
+        uint64_t external = s_allocs - begin;
+
+        s_done = 0;
+        begin = s_allocs;
+        sc.schedule([&sc]() { spawn_children(&sc); });
+        wait_done(kTasks + 1);
+        uint64_t internal = s_allocs - begin;
+
+        if (round > 0) {
+            external_min = std::min(external_min, external);
+            internal_min = std::min(internal_min, internal);
+            external_total += external;
+            internal_total += internal;
+        }
+    }
+
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "tasks/round=" << kTasks
+                             << " allocs(external schedule) min=" << external_min
+                             << " total=" << external_total
+                             << " allocs(worker schedule) min=" << internal_min
+                             << " total=" << internal_total
+                             << " fiber_cache_misses=" << sc.getFiberCacheMisses();
+    SYLAR_ASSERT(external_min == 0);
+    SYLAR_ASSERT(internal_min == 0);
+    SYLAR_ASSERT(external_total + internal_total < kTasks);
+    return 0;
+}
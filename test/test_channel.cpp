@@ -0,0 +1,173 @@
+#include "sylar.h"
+
+/**
+ * @brief 协程通道
+ * @details 1. 多生产者多消费者的有界通道，生产者全部结束后关闭通道
+ *          2. 单生产者单消费者通道走无锁路径，检查顺序并和加锁的通道比较耗时
+ *          3. select 同时等待多个通道，以及超时、关闭的语义
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+static void test_mpmc(sylar::IOManager& iom) {
+    const int kProducers = 4;
+    const int kConsumers = 4;
+    const int kItems = 5000;
+    static sylar::Channel<int> ch(8);
+    static std::atomic<int> producers{kProducers};
+    static std::atomic<long> sum{0};
+
+    s_done = 0;
+    for (int p = 0; p < kProducers; ++p) {
+        iom.schedule([]() {
+            for (int i = 1; i <= kItems; ++i) {
+                SYLAR_ASSERT(ch.send(i));
+            }
+            if (--producers == 0) {
+                ch.close();
+            }
+        });
+    }
+    for (int c = 0; c < kConsumers; ++c) {
+        iom.schedule([]() {
+            int v;
+            while (ch.recv(v)) {
+                sum += v;
+            }
+            ++s_done;
+        });
+    }
+    wait_done(kConsumers);
+    SYLAR_LOG_INFO(g_logger) << "mpmc sum=" << sum;
+    SYLAR_ASSERT(sum == (long)kProducers * kItems * (kItems + 1) / 2);
+    SYLAR_ASSERT(!ch.send(1));
+}
+
+static uint64_t run_spsc(sylar::IOManager& iom, bool spsc, int items) {
+    sylar::Channel<int> ch(1024, spsc);
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule([&ch, items]() {
+        for (int i = 0; i < items; ++i) {
+            ch.send(i);
+        }
+        ch.close();
+    });
+    iom.schedule([&ch]() {
+        int v, expect = 0;
+        while (ch.recv(v)) {
+            SYLAR_ASSERT(v == expect++);
+        }
+        ++s_done;
+    });
+    wait_done(1);
+    return sylar::GetCurrentUS() - begin;
+}
+
+static void test_spsc(sylar::IOManager& iom) {
+    const int kItems = 200000;
+    uint64_t locked = run_spsc(iom, false, kItems);
+    uint64_t lockfree = run_spsc(iom, true, kItems);
+    SYLAR_LOG_INFO(g_logger) << "items=" << kItems << " locked channel: " << locked
+                             << "us spsc channel: " << lockfree << "us";
+}
+
+static void test_select(sylar::IOManager& iom) {
+    static sylar::Channel<int> a(4);
+    static sylar::Channel<std::string> b;
+    static sylar::Channel<int> out(1);
+
+    s_done = 0;
+    iom.schedule([]() {
+        int na = 0, nb = 0;
+        bool a_open = true, b_open = true;
+        while (a_open || b_open) {
+            int v;
+            std::string s;
+            bool ok_a = false, ok_b = false;
+            sylar::Select sel;
+            int ia = -1, ib = -1, n = 0;
+            if (a_open) {
+                sel.recv(a, v, &ok_a);
+                ia = n++;
+            }
+            if (b_open) {
+                sel.recv(b, s, &ok_b);
+                ib = n++;
+            }
+            int idx = sel.wait();
+            if (idx == ia) {
+                if (ok_a) {
+                    ++na;
+                } else {
+                    a_open = false;
+                }
+            } else {
+                SYLAR_ASSERT(idx == ib);
+                if (ok_b) {
+                    SYLAR_ASSERT(s == "x");
+                    ++nb;
+                } else {
+                    b_open = false;
+                }
+            }
+        }
+        out.send(na * 10000 + nb);
+        ++s_done;
+    });
+    iom.schedule([]() {
+        for (int i = 0; i < 1000; ++i) {
+            a.send(i);
+        }
+        a.close();
+    });
+    iom.schedule([]() {
+        for (int i = 0; i < 500; ++i) {
+            b.send(std::string("x"));
+        }
+        b.close();
+    });
+    wait_done(1);
+    int r = 0;
+    // 主线程不在协程中，退化为阻塞线程等待
+    SYLAR_ASSERT(out.recv(r));
+    SYLAR_LOG_INFO(g_logger) << "select received a=" << r / 10000 << " b=" << r % 10000;
+    SYLAR_ASSERT(r == 1000 * 10000 + 500);
+
+    // 超时和发送分支
+    s_done = 0;
+    iom.schedule([]() {
+        sylar::Channel<int> empty(1);
+        int v;
+        uint64_t begin = sylar::GetCurrentMS();
+        SYLAR_ASSERT(sylar::Select().recv(empty, v).wait(30) == -1);
+        uint64_t used = sylar::GetCurrentMS() - begin;
+        SYLAR_LOG_INFO(g_logger) << "select timed out after " << used << "ms";
+        SYLAR_ASSERT(used >= 25);
+
+        SYLAR_ASSERT(sylar::Select().recv(empty, v).send(empty, 7).tryWait() == 1);
+        SYLAR_ASSERT(!empty.trySend(8));
+        SYLAR_ASSERT(!empty.sendFor(8, 10));
+        SYLAR_ASSERT(empty.tryRecv(v) && v == 7);
+        SYLAR_ASSERT(!empty.recvFor(v, 10));
+        ++s_done;
+    });
+    wait_done(1);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "channel");
+    test_mpmc(iom);
+    test_spsc(iom);
+    test_select(iom);
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/**
+ * @brief C++20 无栈协程
+ * @details 1. Task 嵌套 co_await，结果和异常通过 co_spawn 的 Future 返回
+ *          2. SleepFor / WaitEvent 在 IOManager 上挂起和恢复，WaitEvent 超时返回ETIMEDOUT
+ *          3. AsyncAccept / AsyncConnect / AsyncRead / AsyncWrite 完成一次TCP收发
+ *          4. 大量同时挂起的 Task 不占用协程栈
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::Task<int64_t> add(int64_t a, int64_t b) {
+    co_return a + b;
+}
+
+static sylar::Task<int64_t> sum(int n) {
+    int64_t total = 0;
+    for (int i = 1; i <= n; ++i) {
+        total = co_await add(total, i);
+    }
+    co_return total;
+}
+
+static sylar::Task<void> fail() {
+    co_await add(1, 2);
+    throw std::runtime_error("task failed");
+}
+
+static void test_task() {
+    sylar::Scheduler sc(1, false, "co_task");
+    sc.start();
+    SYLAR_ASSERT(sylar::co_spawn(&sc, sum(100000)).get() == 5000050000ll);
+
+    bool caught = false;
+    try {
+        sylar::co_spawn(&sc, fail()).get();
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "task failed";
+    }
+    SYLAR_ASSERT(caught);
+
+    // 让出之后作为新任务恢复
+    static int order = 0;
+    auto yielder = [](sylar::Scheduler* sc) -> sylar::Task<int> {
+        sc->schedule([]() { order = 1; });
+        co_await sylar::ScheduleOn(sc);
+        co_return order;
+    };
+    SYLAR_ASSERT(sylar::co_spawn(&sc, yielder(&sc)).get() == 1);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "task chain ok";
+}
+
+static sylar::Task<uint64_t> sleeper(uint64_t ms) {
+    uint64_t begin = sylar::GetCurrentMS();
+    co_await sylar::SleepFor(ms);
+    co_return sylar::GetCurrentMS() - begin;
+}
+
+static sylar::Task<int> wait_readable(int fd, uint64_t timeout_ms) {
+    int rt = co_await sylar::WaitEvent(fd, sylar::IOManager::READ, timeout_ms);
+    co_return rt == 0 ? 0 : errno;
+}
+
+static void test_events(sylar::IOManager& iom) {
+    uint64_t slept = sylar::co_spawn(&iom, sleeper(30)).get();
+    SYLAR_LOG_INFO(g_logger) << "SleepFor(30) slept " << slept << "ms";
+    SYLAR_ASSERT(slept >= 30);
+
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    SYLAR_ASSERT(sylar::co_spawn(&iom, wait_readable(fds[0], 30)).get() == ETIMEDOUT);
+
+    auto ready = sylar::co_spawn(&iom, wait_readable(fds[0], 1000));
+    usleep(10 * 1000);
+    SYLAR_ASSERT(!ready.isReady());
+    SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+    SYLAR_ASSERT(ready.get() == 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static sylar::Task<std::string> serve_one(int listen_fd) {
+    int client = co_await sylar::AsyncAccept(listen_fd);
+    SYLAR_ASSERT(client >= 0);
+    char buf[64];
+    ssize_t n = co_await sylar::AsyncRead(client, buf, sizeof(buf));
+    SYLAR_ASSERT(n > 0);
+    std::string msg(buf, n);
+    std::string reply = "echo:" + msg;
+    SYLAR_ASSERT(co_await sylar::AsyncWrite(client, reply.data(), reply.size()) == (ssize_t)reply.size());
+    close(client);
+    co_return msg;
+}
+
+static sylar::Task<std::string> request(sockaddr_in addr, std::string msg) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(co_await sylar::AsyncConnect(fd, (sockaddr*)&addr, sizeof(addr), 1000) == 0);
+    SYLAR_ASSERT(co_await sylar::AsyncWrite(fd, msg.data(), msg.size()) == (ssize_t)msg.size());
+    char buf[64];
+    ssize_t n = co_await sylar::AsyncRead(fd, buf, sizeof(buf), 1000);
+    close(fd);
+    co_return std::string(buf, n > 0 ? n : 0);
+}
+
+static void test_socket(sylar::IOManager& iom) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    SYLAR_ASSERT(listen(listen_fd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    SYLAR_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+
+    auto server = sylar::co_spawn(&iom, serve_one(listen_fd));
+    auto client = sylar::co_spawn(&iom, request(addr, "hello"));
+    std::string reply = client.get();
+    std::string received = server.get();
+    SYLAR_LOG_INFO(g_logger) << "server received '" << received << "' client got '" << reply << "'";
+    SYLAR_ASSERT(received == "hello");
+    SYLAR_ASSERT(reply == "echo:hello");
+    close(listen_fd);
+}
+
+static void test_fanout(sylar::IOManager& iom) {
+    const int kTasks = 10000;
+    static std::atomic<int> done{0};
+    static std::atomic<int> sleeping{0};
+    done = 0;
+    sleeping = 0;
+    auto task = []() -> sylar::Task<void> {
+        ++sleeping;
+        co_await sylar::SleepFor(50);
+        ++done;
+    };
+    for (int i = 0; i < kTasks; ++i) {
+        sylar::co_spawn(&iom, task());
+    }
+    // 所有 Task 都挂起在定时器上时，协程数只是调度线程缓存的那几个
+    while (sleeping < kTasks) {
+        usleep(1000);
+    }
+    uint64_t fibers = sylar::Fiber::getTotalFiber();
+    while (done < kTasks) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << kTasks << " suspended tasks, live fibers=" << fibers;
+    SYLAR_ASSERT(fibers < 100);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    test_task();
+    sylar::IOManager iom(2, false, "co_io");
+    test_events(iom);
+    test_socket(iom);
+    test_fanout(iom);
+    return 0;
+}
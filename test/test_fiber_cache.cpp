@@ -0,0 +1,34 @@
+#include "sylar.h"
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_count{0};
+
+/**
+ * @brief 调度大量函数任务，稳定后应该几乎全部命中协程缓存
+ */
+void test_fiber_cache() {
+    sylar::Scheduler sc(2, false, "cache");
+    sc.start();
+    for (int i = 0; i < 10000; ++i) {
+        sc.schedule([](){ ++s_count; });
+    }
+    sc.stop();
+
+    uint64_t hits = sc.getFiberCacheHits();
+    uint64_t misses = sc.getFiberCacheMisses();
+    SYLAR_LOG_INFO(g_logger) << "count=" << s_count
+                             << " hits=" << hits
+                             << " misses=" << misses
+                             << " hit_rate=" << (hits * 100.0 / (hits + misses)) << "%";
+    SYLAR_ASSERT(s_count == 10000);
+    SYLAR_ASSERT(hits + misses == 10000);
+    // 每个线程只有最初几个任务需要新建协程
+    SYLAR_ASSERT(hits > 9000);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    test_fiber_cache();
+    return 0;
+}
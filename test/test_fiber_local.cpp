@@ -0,0 +1,113 @@
+#include "sylar.h"
+
+/**
+ * @brief 协程局部存储
+ * @details 1. 每个协程看到自己的值，协程让出后在其他调度线程上恢复，值不变
+ *          2. 协程结束时值被析构，复用栈的下一个任务看不到上一个任务的值
+ *          3. 不在协程中时使用线程主协程的槽位
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct Tracked {
+    static std::atomic<int> alive;
+    int id = 0;
+    Tracked() { ++alive; }
+    Tracked(int v) : id(v) { ++alive; }
+    Tracked(const Tracked& o) : id(o.id) { ++alive; }
+    ~Tracked() { --alive; }
+};
+std::atomic<int> Tracked::alive{0};
+
+static sylar::FiberLocal<Tracked> s_request;
+static sylar::FiberLocal<uint64_t> s_deadline;
+static std::atomic<int> s_done{0};
+static std::atomic<int> s_errors{0};
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(1000);
+    }
+}
+
+static void test_migrate() {
+    sylar::Scheduler sc(2, false, "fiber_local");
+    sc.start();
+    static std::mutex mutex;
+    static std::set<pid_t> threads;
+    const int kFibers = 8;
+    s_done = 0;
+    for (int i = 0; i < kFibers; ++i) {
+        sc.schedule([i]() {
+            SYLAR_ASSERT(!s_request.has());
+            s_request.set(Tracked(i));
+            *s_deadline = i * 100;
+            for (int j = 0; j < 50; ++j) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    threads.insert(sylar::GetThreadId());
+                }
+                // 放回队列再让出，可能在另一个线程上恢复
+                sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                sylar::Fiber::GetThisRaw()->yield();
+                if (s_request->id != i || *s_deadline != (uint64_t)i * 100) {
+                    ++s_errors;
+                }
+            }
+            ++s_done;
+        });
+    }
+    wait_done(kFibers);
+    SYLAR_LOG_INFO(g_logger) << "fibers ran on " << threads.size() << " threads, errors=" << s_errors;
+    SYLAR_ASSERT(s_errors == 0);
+
+    // 结束的协程被复用时槽位已经清空
+    s_done = 0;
+    for (int i = 0; i < kFibers; ++i) {
+        sc.schedule([]() {
+            if (s_request.has() || s_deadline.has()) {
+                ++s_errors;
+            }
+            ++s_done;
+        });
+    }
+    wait_done(kFibers);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "fiber cache hits=" << sc.getFiberCacheHits() << " alive=" << Tracked::alive;
+    SYLAR_ASSERT(s_errors == 0);
+    SYLAR_ASSERT(Tracked::alive == 0);
+}
+
+static void test_reset() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {
+        s_request.set(Tracked(1));
+        // 替换时析构旧值
+        s_request.set(Tracked(2));
+        SYLAR_ASSERT(Tracked::alive == 1);
+        s_request.reset();
+        SYLAR_ASSERT(Tracked::alive == 0);
+        s_request.set(Tracked(3));
+    }, 0, false));
+    fiber->resume();
+    SYLAR_ASSERT(fiber->getState() == sylar::Fiber::TERM);
+    SYLAR_ASSERT(Tracked::alive == 0);
+
+    // 线程主协程也有自己的槽位
+    SYLAR_ASSERT(!s_request.has());
+    s_request->id = 42;
+    fiber->reset([]() {
+        SYLAR_ASSERT(!s_request.has());
+    });
+    fiber->resume();
+    SYLAR_ASSERT(s_request->id == 42);
+    s_request.reset();
+    SYLAR_ASSERT(Tracked::alive == 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    test_migrate();
+    test_reset();
+    return 0;
+}
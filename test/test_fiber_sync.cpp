@@ -0,0 +1,230 @@
+#include "sylar.h"
+#include <deque>
+
+/**
+ * @brief 协程同步原语
+ * @details 等待锁、条件和信号量时挂起的是协程，调度线程继续执行其他协程；
+ *          临界区内让出执行权来制造竞争，检查互斥、唤醒和超时是否正确
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+/**
+ * @brief 把自己重新放回调度队列再让出，模拟临界区中的IO等待
+ */
+static void reschedule_yield() {
+    sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+    sylar::Fiber::GetThis()->yield();
+}
+
+static void test_mutex(sylar::IOManager& iom) {
+    const int kFibers = 64;
+    const int kLoops = 200;
+    static sylar::FiberMutex mutex;
+    static int counter = 0;
+    static std::atomic<int> inside{0};
+
+    s_done = 0;
+    for (int i = 0; i < kFibers; ++i) {
+        iom.schedule([]() {
+            for (int j = 0; j < kLoops; ++j) {
+                sylar::FiberMutex::Lock lock(mutex);
+                SYLAR_ASSERT(++inside == 1);
+                int v = counter;
+                if (j % 16 == 0) {
+                    reschedule_yield();
+                }
+                counter = v + 1;
+                --inside;
+            }
+            ++s_done;
+        });
+    }
+    wait_done(kFibers);
+    SYLAR_LOG_INFO(g_logger) << "mutex counter=" << counter;
+    SYLAR_ASSERT(counter == kFibers * kLoops);
+}
+
+static void test_rwmutex(sylar::IOManager& iom) {
+    static sylar::FiberRWMutex rw;
+    static std::atomic<int> readers{0};
+    static std::atomic<int> writers{0};
+    static std::atomic<int> max_readers{0};
+
+    s_done = 0;
+    for (int i = 0; i < 32; ++i) {
+        bool writer = i % 4 == 0;
+        iom.schedule([writer]() {
+            for (int j = 0; j < 50; ++j) {
+                if (writer) {
+                    sylar::FiberRWMutex::WriteLock lock(rw);
+                    SYLAR_ASSERT(++writers == 1 && readers == 0);
+                    reschedule_yield();
+                    --writers;
+                } else {
+                    sylar::FiberRWMutex::ReadLock lock(rw);
+                    int r = ++readers;
+                    SYLAR_ASSERT(writers == 0);
+                    int m = max_readers;
+                    while (r > m && !max_readers.compare_exchange_weak(m, r));
+                    reschedule_yield();
+                    --readers;
+                }
+            }
+            ++s_done;
+        });
+    }
+    wait_done(32);
+    SYLAR_LOG_INFO(g_logger) << "rwmutex max concurrent readers=" << max_readers;
+
+    // 读锁之间共享，和写锁互斥
+    s_done = 0;
+    iom.schedule([]() {
+        sylar::FiberRWMutex::ReadLock lock(rw);
+        SYLAR_ASSERT(rw.rdlockFor(0));
+        SYLAR_ASSERT(!rw.wrlockFor(0));
+        rw.unlock();
+        lock.unlock();
+        SYLAR_ASSERT(rw.wrlockFor(0));
+        SYLAR_ASSERT(!rw.rdlockFor(0));
+        rw.unlock();
+        ++s_done;
+    });
+    wait_done(1);
+}
+
+static void test_condition(sylar::IOManager& iom) {
+    const int kItems = 2000;
+    static sylar::FiberMutex mutex;
+    static sylar::FiberCondition cond;
+    static std::deque<int> queue;
+    static long sum = 0;
+
+    s_done = 0;
+    for (int c = 0; c < 4; ++c) {
+        iom.schedule([]() {
+            while (true) {
+                sylar::FiberMutex::Lock lock(mutex);
+                while (queue.empty()) {
+                    cond.wait(lock);
+                }
+                int v = queue.front();
+                queue.pop_front();
+                if (v < 0) {
+                    break;
+                }
+                sum += v;
+            }
+            ++s_done;
+        });
+    }
+    iom.schedule([]() {
+        for (int i = 1; i <= kItems; ++i) {
+            sylar::FiberMutex::Lock lock(mutex);
+            queue.push_back(i);
+            cond.notify();
+        }
+        sylar::FiberMutex::Lock lock(mutex);
+        for (int c = 0; c < 4; ++c) {
+            queue.push_back(-1);
+        }
+        cond.notifyAll();
+    });
+    wait_done(4);
+    SYLAR_LOG_INFO(g_logger) << "condition sum=" << sum;
+    SYLAR_ASSERT(sum == (long)kItems * (kItems + 1) / 2);
+}
+
+static void test_semaphore(sylar::IOManager& iom) {
+    static sylar::FiberSemaphore sem(3);
+    static std::atomic<int> running{0};
+    static std::atomic<int> max_running{0};
+
+    s_done = 0;
+    for (int i = 0; i < 32; ++i) {
+        iom.schedule([]() {
+            sem.wait();
+            int r = ++running;
+            int m = max_running;
+            while (r > m && !max_running.compare_exchange_weak(m, r));
+            reschedule_yield();
+            --running;
+            sem.notify();
+            ++s_done;
+        });
+    }
+    wait_done(32);
+    SYLAR_LOG_INFO(g_logger) << "semaphore max concurrent=" << max_running;
+    SYLAR_ASSERT(max_running <= 3);
+    SYLAR_ASSERT(sem.getCount() == 3);
+}
+
+static void test_timeout(sylar::IOManager& iom) {
+    static sylar::FiberMutex mutex;
+    static sylar::FiberCondition cond;
+
+    s_done = 0;
+    iom.schedule([]() {
+        sylar::FiberMutex::Lock lock(mutex);
+        usleep(200 * 1000);
+        ++s_done;
+    });
+    iom.schedule([]() {
+        usleep(10 * 1000);
+        uint64_t begin = sylar::GetCurrentMS();
+        SYLAR_ASSERT(!mutex.lockFor(50));
+        uint64_t used = sylar::GetCurrentMS() - begin;
+        SYLAR_LOG_INFO(g_logger) << "lockFor(50) timed out after " << used << "ms";
+        SYLAR_ASSERT(used >= 45 && used < 150);
+        // 超时的等待者已经离开队列，锁释放后还能正常加锁
+        mutex.lock();
+        mutex.unlock();
+        ++s_done;
+    });
+    wait_done(2);
+
+    s_done = 0;
+    iom.schedule([]() {
+        sylar::FiberMutex::Lock lock(mutex);
+        uint64_t begin = sylar::GetCurrentMS();
+        SYLAR_ASSERT(!cond.waitFor(lock, 30));
+        SYLAR_LOG_INFO(g_logger) << "condition waitFor(30) timed out after "
+                                 << sylar::GetCurrentMS() - begin << "ms";
+        ++s_done;
+    });
+    wait_done(1);
+}
+
+/**
+ * @brief 普通线程等待，由协程唤醒
+ */
+static void test_thread_waiter(sylar::IOManager& iom) {
+    sylar::FiberSemaphore sem;
+    iom.schedule([&sem]() {
+        usleep(10 * 1000);
+        sem.notify();
+    });
+    sem.wait();
+    SYLAR_ASSERT(!sem.waitFor(20));
+    SYLAR_LOG_INFO(g_logger) << "thread waiter ok";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "sync");
+    test_mutex(iom);
+    test_rwmutex(iom);
+    test_condition(iom);
+    test_semaphore(iom);
+    test_timeout(iom);
+    test_thread_waiter(iom);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "sylar.h"
+
+/**
+ * @brief async/Future、WaitGroup、parallel_for/parallel_reduce
+ * @details 结果和异常都要传回等待方；等待方可以是协程也可以是普通线程
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void test_async(sylar::IOManager& iom) {
+    // 普通线程等待
+    sylar::Future<int> f = sylar::async(&iom, []() { return 42; });
+    SYLAR_ASSERT(f.get() == 42);
+
+    sylar::Future<void> v = sylar::async(&iom, []() { usleep(10 * 1000); });
+    SYLAR_ASSERT(!v.isReady());
+    v.get();
+
+    sylar::Future<std::string> e = sylar::async(&iom, []() -> std::string {
+        throw std::runtime_error("boom");
+    });
+    bool caught = false;
+    try {
+        e.get();
+    } catch (const std::runtime_error& ex) {
+        caught = std::string(ex.what()) == "boom";
+    }
+    SYLAR_ASSERT(caught);
+
+    // 协程等待协程
+    sylar::Future<int> outer = sylar::async(&iom, [&iom]() {
+        std::vector<sylar::Future<int>> fs;
+        for (int i = 0; i < 100; ++i) {
+            fs.push_back(sylar::async(&iom, [i]() { return i; }));
+        }
+        int sum = 0;
+        for (auto& f : fs) {
+            sum += f.get();
+        }
+        return sum;
+    });
+    SYLAR_ASSERT(outer.waitFor(1000));
+    SYLAR_ASSERT(outer.get() == 4950);
+
+    sylar::Future<int> broken;
+    {
+        sylar::Promise<int> p;
+        broken = p.getFuture();
+    }
+    caught = false;
+    try {
+        broken.get();
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    SYLAR_ASSERT(caught);
+    SYLAR_LOG_INFO(g_logger) << "async ok";
+}
+
+static void test_waitgroup(sylar::IOManager& iom) {
+    sylar::WaitGroup wg;
+    std::atomic<int> n{0};
+    for (int i = 0; i < 1000; ++i) {
+        wg.add();
+        iom.schedule([&wg, &n]() {
+            ++n;
+            wg.done();
+        });
+    }
+    wg.wait();
+    SYLAR_ASSERT(n == 1000);
+
+    sylar::WaitGroup never(1);
+    SYLAR_ASSERT(!never.waitFor(20));
+    never.done();
+    SYLAR_ASSERT(never.waitFor(0));
+    SYLAR_LOG_INFO(g_logger) << "waitgroup ok";
+}
+
+static void test_parallel(sylar::IOManager& iom) {
+    const size_t kN = 100000;
+    std::vector<uint64_t> data(kN);
+    sylar::parallel_for(&iom, 0, kN, [&data](size_t i) { data[i] = i * 2; });
+    for (size_t i = 0; i < kN; ++i) {
+        SYLAR_ASSERT(data[i] == i * 2);
+    }
+
+    uint64_t sum = sylar::parallel_reduce(&iom, 0, kN, (uint64_t)0,
+        [&data](size_t i) { return data[i]; },
+        [](uint64_t a, uint64_t b) { return a + b; });
+    SYLAR_ASSERT(sum == (uint64_t)kN * (kN - 1));
+
+    // 在协程中嵌套使用，等待时挂起协程而不是阻塞调度线程
+    sylar::Future<uint64_t> nested = sylar::async(&iom, [&iom]() {
+        return sylar::parallel_reduce(&iom, 0, 1000, (uint64_t)0,
+            [&iom](size_t i) {
+                return sylar::parallel_reduce(&iom, 0, 100, (uint64_t)0,
+                    [](size_t j) { return (uint64_t)j; },
+                    [](uint64_t a, uint64_t b) { return a + b; });
+            },
+            [](uint64_t a, uint64_t b) { return a + b; }, 100);
+    });
+    SYLAR_ASSERT(nested.get() == 1000ull * 4950);
+
+    // 异常传回调用者
+    bool caught = false;
+    try {
+        sylar::parallel_for(&iom, 0, kN, [](size_t i) {
+            if (i == 777) {
+                throw std::out_of_range("777");
+            }
+        });
+    } catch (const std::out_of_range&) {
+        caught = true;
+    }
+    SYLAR_ASSERT(caught);
+    SYLAR_LOG_INFO(g_logger) << "parallel ok sum=" << sum;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "future");
+    test_async(iom);
+    test_waitgroup(iom);
+    test_parallel(iom);
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include "fd_manager.h"
+
+/**
+ * @brief io_uring 后端
+ * @details 1. iomanager.backend 为 io_uring 时，被hook的 accept / connect / recv / send / read / write 由 io_uring 完成
+ *          2. SO_RCVTIMEO 超时返回ETIMEDOUT，连接被拒绝返回ECONNREFUSED，阻塞中的fd被close时请求被取消
+ *          3. 大量协程并发收发时结果正确，调度器在所有请求完成之后才退出
+ *          4. 未知的后端退回epoll
+ *          5. 共享栈协程的IO走epoll，缓冲区在共享运行栈上也不会被别的协程破坏
+ *          6. 所有线程都在执行任务时，提交的请求也会交给内核
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int listen_any(sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    SYLAR_ASSERT(listen(fd, 128) == 0);
+    socklen_t len = sizeof(addr);
+    SYLAR_ASSERT(getsockname(fd, (sockaddr*)&addr, &len) == 0);
+    return fd;
+}
+
+static void test_echo() {
+    sylar::IOManager iom(2, false, "uring_echo");
+    SYLAR_ASSERT(iom.hasUring());
+    const int kClients = 64;
+    const int kRounds = 100;
+    static std::atomic<int> served{0};
+    static std::atomic<int> finished{0};
+    static sockaddr_in addr;
+    static int listen_fd = -1;
+    served = 0;
+    finished = 0;
+
+    iom.schedule([&iom]() {
+        listen_fd = listen_any(addr);
+        for (int i = 0; i < kClients; ++i) {
+            iom.schedule([]() {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+                char buf[64];
+                for (int r = 0; r < kRounds; ++r) {
+                    std::string msg = "ping " + std::to_string(r);
+                    SYLAR_ASSERT(write(fd, msg.data(), msg.size()) == (ssize_t)msg.size());
+                    ssize_t n = read(fd, buf, sizeof(buf));
+                    SYLAR_ASSERT(std::string(buf, n) == "echo " + msg);
+                }
+                close(fd);
+                ++finished;
+            });
+        }
+        for (int i = 0; i < kClients; ++i) {
+            int client = accept(listen_fd, nullptr, nullptr);
+            SYLAR_ASSERT(client >= 0);
+            sylar::IOManager::GetThis()->schedule([client]() {
+                char buf[64];
+                while (true) {
+                    ssize_t n = recv(client, buf, sizeof(buf), 0);
+                    if (n <= 0) {
+                        break;
+                    }
+                    std::string reply = "echo " + std::string(buf, n);
+                    SYLAR_ASSERT(send(client, reply.data(), reply.size(), 0) == (ssize_t)reply.size());
+                }
+                close(client);
+                ++served;
+            });
+        }
+    });
+    iom.stop();
+    close(listen_fd);
+    SYLAR_LOG_INFO(g_logger) << "echo clients=" << finished << " served=" << served;
+    SYLAR_ASSERT(finished == kClients);
+    SYLAR_ASSERT(served == kClients);
+}
+
+static void test_errors() {
+    sylar::IOManager iom(1, false, "uring_error");
+    SYLAR_ASSERT(iom.hasUring());
+    static bool timed_out = false;
+    static bool refused = false;
+    iom.schedule([]() {
+        sockaddr_in addr;
+        int listen_fd = listen_any(addr);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        timeval tv = {0, 50 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char buf[16];
+        uint64_t begin = sylar::GetCurrentMS();
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        uint64_t used = sylar::GetCurrentMS() - begin;
+        SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << n << " errno=" << errno << " used=" << used << "ms";
+        timed_out = n == -1 && errno == ETIMEDOUT && used >= 50;
+        close(fd);
+
+        // 关掉监听之后同一个端口会拒绝连接
+        close(listen_fd);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int rt = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        SYLAR_LOG_INFO(g_logger) << "connect closed port rt=" << rt << " errno=" << errno;
+        refused = rt == -1 && errno == ECONNREFUSED;
+        close(fd);
+    });
+
+    // 挂起在accept上的请求在close时被取消，否则调度器永远等不到它完成
+    static int cancelled_errno = 0;
+    iom.schedule([&iom]() {
+        sockaddr_in addr;
+        int listen_fd = listen_any(addr);
+        iom.schedule([listen_fd]() {
+            usleep(20 * 1000);
+            close(listen_fd);
+        });
+        int rt = accept(listen_fd, nullptr, nullptr);
+        cancelled_errno = rt == -1 ? errno : 0;
+        SYLAR_LOG_INFO(g_logger) << "accept closed fd rt=" << rt << " errno=" << errno;
+    });
+    iom.stop();
+    SYLAR_ASSERT(timed_out);
+    SYLAR_ASSERT(refused);
+    SYLAR_ASSERT(cancelled_errno == ECANCELED);
+}
+
+static void test_shared_stack() {
+    sylar::IOManager iom(2, false, "uring_shared");
+    SYLAR_ASSERT(iom.hasUring());
+    const int kClients = 32;
+    const int kRounds = 50;
+    static std::atomic<int> finished{0};
+    static sockaddr_in addr;
+    finished = 0;
+
+    iom.schedule([&iom]() {
+        int listen_fd = listen_any(addr);
+        // 客户端都是共享栈协程，数量多于每个线程的共享运行栈，挂起时运行栈轮流被别的协程使用
+        for (int i = 0; i < kClients; ++i) {
+            sylar::Fiber::ptr fiber(new sylar::Fiber([i]() {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+                char buf[64];
+                for (int r = 0; r < kRounds; ++r) {
+                    std::string msg = std::to_string(i) + " ping " + std::to_string(r);
+                    SYLAR_ASSERT(send(fd, msg.data(), msg.size(), 0) == (ssize_t)msg.size());
+                    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                    SYLAR_ASSERT2(std::string(buf, n) == "echo " + msg, std::string(buf, n));
+                }
+                close(fd);
+                ++finished;
+            }, 0, true, true));
+            iom.schedule(fiber);
+        }
+        for (int i = 0; i < kClients; ++i) {
+            int client = accept(listen_fd, nullptr, nullptr);
+            SYLAR_ASSERT(client >= 0);
+            iom.schedule([client]() {
+                char buf[64];
+                while (true) {
+                    ssize_t n = recv(client, buf, sizeof(buf), 0);
+                    if (n <= 0) {
+                        break;
+                    }
+                    std::string reply = "echo " + std::string(buf, n);
+                    SYLAR_ASSERT(send(client, reply.data(), reply.size(), 0) == (ssize_t)reply.size());
+                }
+                close(client);
+            });
+        }
+        close(listen_fd);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "shared stack clients=" << finished;
+    SYLAR_ASSERT(finished == kClients);
+}
+
+static void test_busy_submit() {
+    sylar::IOManager iom(1, false, "uring_busy");
+    SYLAR_ASSERT(iom.hasUring());
+    static int fds[2];
+    static bool consumed = false;
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    iom.schedule([]() {
+        char buf[16];
+        SYLAR_ASSERT(recv(fds[0], buf, sizeof(buf), 0) == 4);
+    });
+    // 唯一的线程一直在执行这个任务，不会进入idle；recv的请求必须已经提交，数据才会被它取走
+    iom.schedule([]() {
+        SYLAR_ASSERT(::write(fds[1], "ping", 4) == 4);
+        uint64_t end = sylar::GetCurrentMS() + 1000;
+        int pending = 4;
+        while (sylar::GetCurrentMS() < end && pending > 0) {
+            ioctl(fds[0], FIONREAD, &pending);
+        }
+        consumed = pending == 0;
+    });
+    iom.stop();
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "request submitted while all workers busy: " << consumed;
+    SYLAR_ASSERT(consumed);
+}
+
+static void test_fallback() {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("no_such_backend");
+    sylar::IOManager iom(1, false, "fallback");
+    SYLAR_ASSERT(!iom.hasUring());
+    iom.stop();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    {
+        sylar::IOManager probe(1, false, "probe");
+        if (!probe.hasUring()) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring not supported by this kernel, skip";
+            return 0;
+        }
+    }
+    test_echo();
+    test_errors();
+    test_shared_stack();
+    test_busy_submit();
+    test_fallback();
+    SYLAR_LOG_INFO(g_logger) << "io_uring ok";
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief 持久注册
+ * @details 1. 长连接上反复收发，稳定之后不再调用epoll_ctl
+ *          2. 没有等待者期间到达的数据由下一次读取直接拿到，不会丢失唤醒
+ *          3. 读超时之后fd仍然注册着，后续数据照常唤醒
+ *          4. 关闭之后同一个fd号上的新socket重新注册
+ *          5. 没有经过hook关闭的fd号复用后，直接调用addEvent的等待者仍然能被唤醒
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_ctl{0};
+
+/**
+ * @brief 替换libc的epoll_ctl，统计调用次数
+ */
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+    ++s_epoll_ctl;
+    return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+static int listen_any(sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    SYLAR_ASSERT(listen(fd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    SYLAR_ASSERT(getsockname(fd, (sockaddr*)&addr, &len) == 0);
+    return fd;
+}
+
+/**
+ * @brief 建立一对已连接的被hook的socket
+ */
+static void connect_pair(int& client, int& server) {
+    sockaddr_in addr;
+    int listen_fd = listen_any(addr);
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(connect(client, (sockaddr*)&addr, sizeof(addr)) == 0);
+    server = accept(listen_fd, nullptr, nullptr);
+    SYLAR_ASSERT(server >= 0);
+    close(listen_fd);
+}
+
+static void test_ping_pong() {
+    const int kRounds = 2000;
+    static uint64_t steady_ctl = 0;
+    sylar::IOManager iom(1, false, "persistent");
+    SYLAR_ASSERT(iom.isPersistentEvents());
+    iom.schedule([&iom]() {
+        int client, server;
+        connect_pair(client, server);
+        iom.schedule([server]() {
+            char buf[16];
+            while (true) {
+                ssize_t n = read(server, buf, sizeof(buf));
+                if (n <= 0) {
+                    break;
+                }
+                SYLAR_ASSERT(write(server, buf, n) == n);
+            }
+            close(server);
+        });
+        char buf[16];
+        uint64_t begin = 0;
+        for (int i = 0; i < kRounds; ++i) {
+            if (i == 10) {
+                // 两端都已经注册过了
+                begin = s_epoll_ctl;
+            }
+            SYLAR_ASSERT(write(client, "ping", 4) == 4);
+            SYLAR_ASSERT(read(client, buf, sizeof(buf)) == 4);
+        }
+        steady_ctl = s_epoll_ctl - begin;
+        close(client);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "rounds=" << kRounds << " epoll_ctl after warmup=" << steady_ctl;
+    SYLAR_ASSERT(steady_ctl == 0);
+}
+
+static void test_ready_and_timeout() {
+    static bool ok = false;
+    sylar::IOManager iom(1, false, "persistent");
+    iom.schedule([&iom]() {
+        int client, server;
+        connect_pair(client, server);
+        char buf[16];
+
+        // 超时通过cancelEvent唤醒，持久注册不受影响
+        timeval tv = {0, 20 * 1000};
+        setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        SYLAR_ASSERT(read(server, buf, sizeof(buf)) == -1 && errno == ETIMEDOUT);
+
+        // 没有等待者时到达的数据：先写，过一会儿再读
+        SYLAR_ASSERT(write(client, "a", 1) == 1);
+        usleep(5 * 1000);
+        SYLAR_ASSERT(read(server, buf, sizeof(buf)) == 1);
+
+        // 超时之后挂起的读被后到的数据唤醒
+        tv = {1, 0};
+        setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        iom.schedule([client]() {
+            usleep(10 * 1000);
+            SYLAR_ASSERT(write(client, "b", 1) == 1);
+        });
+        uint64_t begin = sylar::GetCurrentMS();
+        SYLAR_ASSERT(read(server, buf, sizeof(buf)) == 1 && buf[0] == 'b');
+        SYLAR_ASSERT(sylar::GetCurrentMS() - begin < 500);
+
+        // 对端关闭时挂起的读返回0
+        iom.schedule([client]() {
+            usleep(10 * 1000);
+            close(client);
+        });
+        SYLAR_ASSERT(read(server, buf, sizeof(buf)) == 0);
+        close(server);
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "ready / timeout / peer close ok";
+}
+
+static void test_reuse() {
+    static int reused = 0;
+    sylar::IOManager iom(1, false, "persistent");
+    iom.schedule([]() {
+        int last = -1;
+        for (int i = 0; i < 20; ++i) {
+            int client, server;
+            connect_pair(client, server);
+            if (server == last) {
+                ++reused;
+            }
+            last = server;
+            // 服务端先等待，让fd注册之后再由客户端写入唤醒
+            sylar::IOManager::GetThis()->schedule([client]() {
+                usleep(1000);
+                SYLAR_ASSERT(write(client, "x", 1) == 1);
+            });
+            char c;
+            SYLAR_ASSERT(read(server, &c, 1) == 1);
+            close(server);
+            close(client);
+        }
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "fd number reused " << reused << " times";
+    SYLAR_ASSERT(reused > 0);
+}
+
+static void test_unhooked_close() {
+    static bool woken = false;
+    sylar::IOManager iom(1, false, "persistent");
+    iom.schedule([&iom]() {
+        int client, server;
+        connect_pair(client, server);
+        iom.schedule([client]() {
+            usleep(1000);
+            SYLAR_ASSERT(write(client, "x", 1) == 1);
+        });
+        char c;
+        SYLAR_ASSERT(read(server, &c, 1) == 1);
+
+        // 不经过hook关闭，IOManager里留下持久注册的标记；dup2让同一个fd号马上指向新句柄
+        int efd = eventfd(0, EFD_NONBLOCK);
+        SYLAR_ASSERT(dup2(efd, server) == server);
+        ::close(efd);
+        efd = server;
+
+        static std::atomic<bool> fired{false};
+        SYLAR_ASSERT(iom.addEvent(efd, sylar::IOManager::READ, []() { fired = true; }) == 0);
+        uint64_t one = 1;
+        SYLAR_ASSERT(::write(efd, &one, sizeof(one)) == sizeof(one));
+        uint64_t end = sylar::GetCurrentMS() + 1000;
+        while (!fired && sylar::GetCurrentMS() < end) {
+            usleep(1000);
+        }
+        woken = fired;
+        if (!woken) {
+            iom.cancelEvent(efd, sylar::IOManager::READ);
+        }
+        iom.cancelAll(efd);
+        ::close(efd);
+        close(client);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "addEvent on a reused fd number woken=" << woken;
+    SYLAR_ASSERT(woken);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<bool>("iomanager.persistent_events")->setValue(true);
+    test_ping_pong();
+    test_ready_and_timeout();
+    test_reuse();
+    test_unhooked_close();
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "sylar.h"
+#include <set>
+
+/**
+ * @brief 指定线程的任务通过信箱投递，只唤醒目标线程
+ * @details 任务在各个调度线程之间接力，每一跳都指定下一个线程；
+ *          如果唤醒错了线程，目标线程要等到epoll_wait超时才能执行，总耗时会明显变长
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::Mutex s_mutex;
+static std::vector<int> s_tids;
+static std::atomic<int> s_hops{0};
+static std::atomic<int> s_wrong{0};
+static const int kHops = 2000;
+
+static void hop(int expect) {
+    if (sylar::GetThreadId() != expect) {
+        ++s_wrong;
+    }
+    if (++s_hops >= kHops) {
+        return;
+    }
+    int next = s_tids[s_hops % s_tids.size()];
+    sylar::Scheduler::GetThis()->schedule(std::bind(&hop, next), next);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "pinned");
+
+    // 阻塞线程的任务会被其他调度线程窃取执行，借此收集所有调度线程的id
+    std::atomic<int> collected{0};
+    for (int i = 0; i < 16; ++i) {
+        iom.schedule([&collected]() {
+            sylar::set_hook_enable(false);
+            usleep(20 * 1000);
+            sylar::set_hook_enable(true);
+            sylar::Mutex::Lock lock(s_mutex);
+            if (std::find(s_tids.begin(), s_tids.end(), sylar::GetThreadId()) == s_tids.end()) {
+                s_tids.push_back(sylar::GetThreadId());
+            }
+            ++collected;
+        });
+    }
+    while (collected < 16) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "workers=" << s_tids.size();
+
+    uint64_t begin = sylar::GetCurrentMS();
+    iom.schedule(std::bind(&hop, s_tids[0]), s_tids[0]);
+    while (s_hops < kHops) {
+        usleep(1000);
+    }
+    uint64_t used = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "hops=" << s_hops << " wrong_thread=" << s_wrong
+                             << " used=" << used << "ms"
+                             << " pinned_skipped=" << iom.getPinnedSkipped();
+    SYLAR_ASSERT(s_wrong == 0);
+    SYLAR_ASSERT(iom.getPinnedSkipped() == 0);
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "sylar.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/**
+ * @brief 每线程反应器模式
+ * @details 1. fd注册到第一个在它上面等待的线程，之后等待它的协程总是在这个线程上恢复，超时也一样
+ *          2. 非调度线程添加的任务轮流投递到各调度线程的信箱，不会被其他线程窃取
+ *          3. io_uring 后端和每线程反应器一起使用时收发结果正确
+ *          4. 共享栈协程等待别的线程所属的fd时，仍然回到自己所属的线程恢复
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int listen_any(sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    SYLAR_ASSERT(listen(fd, 128) == 0);
+    socklen_t len = sizeof(addr);
+    SYLAR_ASSERT(getsockname(fd, (sockaddr*)&addr, &len) == 0);
+    return fd;
+}
+
+static void test_echo(bool check_thread) {
+    const int kClients = 32;
+    const int kRounds = 200;
+    static std::atomic<int> finished{0};
+    static std::atomic<int> moved{0};
+    static sockaddr_in addr;
+    static int listen_fd = -1;
+    static bool check = false;
+    finished = 0;
+    moved = 0;
+    check = check_thread;
+
+    sylar::IOManager iom(4, false, "reactor_echo");
+    SYLAR_ASSERT(iom.isReactorPerThread());
+    iom.schedule([&iom]() {
+        listen_fd = listen_any(addr);
+        for (int i = 0; i < kClients; ++i) {
+            iom.schedule([]() {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+                // connect 等待过，fd已经注册到了等待它的线程
+                int owner = sylar::GetThreadId();
+                char buf[64];
+                for (int r = 0; r < kRounds; ++r) {
+                    std::string msg = "ping " + std::to_string(r);
+                    SYLAR_ASSERT(write(fd, msg.data(), msg.size()) == (ssize_t)msg.size());
+                    ssize_t n = read(fd, buf, sizeof(buf));
+                    SYLAR_ASSERT(std::string(buf, n) == "echo " + msg);
+                    if (sylar::GetThreadId() != owner) {
+                        ++moved;
+                    }
+                }
+                close(fd);
+                ++finished;
+            });
+        }
+        for (int i = 0; i < kClients; ++i) {
+            int client = accept(listen_fd, nullptr, nullptr);
+            SYLAR_ASSERT(client >= 0);
+            sylar::IOManager::GetThis()->schedule([client]() {
+                // 第一次读之前没有数据的话会在这里等待，之后这个fd的事件都由同一个线程处理
+                timeval tv = {0, 500 * 1000};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                int owner = -1;
+                char buf[64];
+                while (true) {
+                    ssize_t n = recv(client, buf, sizeof(buf), 0);
+                    if (n <= 0) {
+                        break;
+                    }
+                    if (owner == -1) {
+                        owner = sylar::GetThreadId();
+                    } else if (sylar::GetThreadId() != owner) {
+                        ++moved;
+                    }
+                    std::string reply = "echo " + std::string(buf, n);
+                    SYLAR_ASSERT(send(client, reply.data(), reply.size(), 0) == (ssize_t)reply.size());
+                }
+                close(client);
+            });
+        }
+        close(listen_fd);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "echo clients=" << finished << " resumed on another thread=" << moved;
+    SYLAR_ASSERT(finished == kClients);
+    if (check) {
+        SYLAR_ASSERT(moved == 0);
+    }
+}
+
+static void test_timeout() {
+    static bool ok = false;
+    sylar::IOManager iom(4, false, "reactor_timeout");
+    iom.schedule([]() {
+        sockaddr_in addr;
+        int listen_fd = listen_any(addr);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        int owner = sylar::GetThreadId();
+        timeval tv = {0, 20 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char buf[16];
+        for (int i = 0; i < 5; ++i) {
+            // 超时由定时器所在的线程取消，协程仍然回到fd所属的线程
+            SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == -1 && errno == ETIMEDOUT);
+            SYLAR_ASSERT(sylar::GetThreadId() == owner);
+        }
+        close(fd);
+        close(listen_fd);
+        ok = true;
+    });
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "timeout resumed on owner thread";
+}
+
+static void test_inbox() {
+    const int kThreads = 4;
+    const int kTasks = 64;
+    static sylar::Mutex mutex;
+    static std::map<int, int> counts;
+    counts.clear();
+    sylar::IOManager iom(kThreads, false, "reactor_inbox");
+    // 等调度线程都进入run()
+    usleep(100 * 1000);
+    for (int i = 0; i < kTasks; ++i) {
+        iom.schedule([]() {
+            sylar::Mutex::Lock lock(mutex);
+            ++counts[sylar::GetThreadId()];
+        });
+    }
+    iom.stop();
+    // 信箱里的任务不会被窃取，轮流投递之后每个线程执行的数量相同
+    SYLAR_ASSERT((int)counts.size() == kThreads);
+    for (auto& i : counts) {
+        SYLAR_LOG_INFO(g_logger) << "thread " << i.first << " ran " << i.second << " tasks";
+        SYLAR_ASSERT(i.second == kTasks / kThreads);
+    }
+}
+
+static void test_shared_stack() {
+    static std::set<int> workers;
+    static sylar::Mutex mutex;
+    static bool ok = false;
+    workers.clear();
+    sylar::IOManager iom(2, false, "reactor_shared");
+    usleep(100 * 1000);
+    for (int i = 0; i < 8; ++i) {
+        iom.schedule([]() {
+            sylar::Mutex::Lock lock(mutex);
+            workers.insert(sylar::GetThreadId());
+        });
+    }
+    usleep(50 * 1000);
+    SYLAR_ASSERT(workers.size() == 2);
+    int tid_a = *workers.begin();
+    int tid_b = *workers.rbegin();
+
+    // fd先在线程B上等待过，注册到B的反应器
+    iom.schedule([&iom, tid_a]() {
+        sockaddr_in addr;
+        int listen_fd = listen_any(addr);
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        SYLAR_ASSERT(connect(client, (sockaddr*)&addr, sizeof(addr)) == 0);
+        int server = accept(listen_fd, nullptr, nullptr);
+        close(listen_fd);
+        timeval tv = {0, 10 * 1000};
+        setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        SYLAR_ASSERT(read(server, &c, 1) == -1 && errno == ETIMEDOUT);
+
+        // 在线程A上创建的共享栈协程等待这个fd，事件由B处理，协程回到A恢复
+        iom.schedule([&iom, client, server]() {
+            int owner = sylar::GetThreadId();
+            sylar::Fiber::ptr fiber(new sylar::Fiber([client, server, owner]() {
+                timeval tv = {1, 0};
+                setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char c;
+                SYLAR_ASSERT(read(server, &c, 1) == 1 && c == 'x');
+                SYLAR_ASSERT(sylar::GetThreadId() == owner);
+                close(server);
+                close(client);
+                ok = true;
+            }, 0, true, true));
+            iom.schedule(fiber);
+            iom.schedule([client]() {
+                usleep(10 * 1000);
+                SYLAR_ASSERT(write(client, "x", 1) == 1);
+            });
+        }, tid_a);
+    }, tid_b);
+    iom.stop();
+    SYLAR_ASSERT(ok);
+    SYLAR_LOG_INFO(g_logger) << "shared stack fiber resumed on its own thread";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<bool>("iomanager.reactor_per_thread")->setValue(true);
+    test_echo(true);
+    test_timeout();
+    test_inbox();
+    test_shared_stack();
+
+    // io_uring 的完成事件由收割它的线程恢复，只检查结果
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue("io_uring");
+    test_echo(false);
+    SYLAR_LOG_INFO(g_logger) << "reactor per thread ok";
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "sylar.h"
+#include <fcntl.h>
+
+/**
+ * @brief 批量调度
+ * @details 1. 外部线程逐个schedule和scheduleBatch投递同样数量的任务，比较耗时
+ *          2. 同时就绪的多个fd事件由idle协程一次性批量调度
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+static void test_batch_vs_single(sylar::IOManager& iom) {
+    const int kBatch = 256;
+    const int kRounds = 200;
+
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int r = 0; r < kRounds; ++r) {
+        for (int i = 0; i < kBatch; ++i) {
+            iom.schedule([]() { ++s_done; });
+        }
+    }
+    wait_done(kBatch * kRounds);
+    uint64_t single = sylar::GetCurrentUS() - begin;
+
+    s_done = 0;
+    std::vector<std::function<void()>> cbs;
+    begin = sylar::GetCurrentUS();
+    for (int r = 0; r < kRounds; ++r) {
+        for (int i = 0; i < kBatch; ++i) {
+            cbs.push_back([]() { ++s_done; });
+        }
+        iom.scheduleBatch(cbs.begin(), cbs.end());
+        cbs.clear();
+    }
+    wait_done(kBatch * kRounds);
+    uint64_t batch = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << "tasks=" << kBatch * kRounds
+                             << " schedule one by one: " << single << "us"
+                             << " scheduleBatch(" << kBatch << "): " << batch << "us";
+}
+
+static void test_events(sylar::IOManager& iom) {
+    const int kFds = 64;
+    std::vector<int> fds(kFds * 2);
+    for (int i = 0; i < kFds; ++i) {
+        SYLAR_ASSERT(pipe(&fds[i * 2]) == 0);
+        fcntl(fds[i * 2], F_SETFL, O_NONBLOCK);
+    }
+
+    s_done = 0;
+    iom.schedule([&iom, &fds]() {
+        for (int i = 0; i < kFds; ++i) {
+            int fd = fds[i * 2];
+            iom.addEvent(fd, sylar::IOManager::READ, [fd]() {
+                char c;
+                SYLAR_ASSERT(read(fd, &c, 1) == 1);
+                ++s_done;
+            });
+        }
+        // 所有fd同时就绪，在同一次epoll_wait中返回
+        for (int i = 0; i < kFds; ++i) {
+            SYLAR_ASSERT(write(fds[i * 2 + 1], "x", 1) == 1);
+        }
+    });
+    wait_done(kFds);
+    SYLAR_LOG_INFO(g_logger) << "ready fds=" << kFds << " callbacks=" << s_done;
+
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(4, false, "batch");
+    test_batch_vs_single(iom);
+    test_events(iom);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "sylar.h"
+#include "fd_manager.h"
+
+/**
+ * @brief 线程数可以伸缩的调度器
+ * @details 1. 任务排队太久时增加线程，不超过最多的线程数；空闲之后多出来的线程退出，回到最少的线程数
+ *          2. 伸缩之后调度器仍然可以正常执行任务和停止
+ *          3. IOManager 的线程在epoll上空闲太久后同样退出，IO事件由剩下的线程处理
+ *          4. 从没扩容过的调度器和IOManager可以正常停止和析构
+ *          5. 指定给已经退出的线程的任务改由其他线程执行，stop()能正常返回
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static void busy_us(uint64_t us) {
+    uint64_t end = sylar::GetCurrentUS() + us;
+    while (sylar::GetCurrentUS() < end)
+        ;
+}
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+static bool wait_workers(sylar::Scheduler& sc, size_t expect, uint64_t timeout_ms) {
+    uint64_t deadline = sylar::GetCurrentMS() + timeout_ms;
+    while (sc.getWorkerCount() != expect && sylar::GetCurrentMS() < deadline) {
+        usleep(1000);
+    }
+    return sc.getWorkerCount() == expect;
+}
+
+static void flood(sylar::Scheduler& sc, int tasks, size_t& peak) {
+    s_done = 0;
+    for (int i = 0; i < tasks; ++i) {
+        sc.schedule([]() {
+            busy_us(1000);
+            ++s_done;
+        });
+    }
+    while (s_done < tasks) {
+        peak = std::max(peak, sc.getWorkerCount());
+        usleep(1000);
+    }
+}
+
+static void test_scheduler() {
+    sylar::Scheduler sc(1, false, "elastic", 4);
+    SYLAR_ASSERT(sc.getMaxWorkerCount() == 4);
+    sc.start();
+    SYLAR_ASSERT(sc.getWorkerCount() == 1);
+
+    size_t peak = 0;
+    flood(sc, 300, peak);
+    SYLAR_LOG_INFO(g_logger) << "scheduler peak workers=" << peak << " grow=" << sc.getGrowCount();
+    SYLAR_ASSERT(peak > 1 && peak <= 4);
+
+    SYLAR_ASSERT(wait_workers(sc, 1, 2000));
+    SYLAR_LOG_INFO(g_logger) << "scheduler shrink to " << sc.getWorkerCount() << " retire=" << sc.getRetireCount();
+    SYLAR_ASSERT(sc.getRetireCount() == sc.getGrowCount());
+
+    // 退出的槽位可以再次使用
+    uint64_t grown = sc.getGrowCount();
+    peak = 0;
+    flood(sc, 300, peak);
+    SYLAR_ASSERT(peak > 1 && sc.getGrowCount() > grown);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "scheduler stopped grow=" << sc.getGrowCount() << " retire=" << sc.getRetireCount();
+}
+
+static void test_iomanager() {
+    sylar::IOManager iom(1, false, "elastic_io", 3);
+    size_t peak = 0;
+    flood(iom, 300, peak);
+    SYLAR_LOG_INFO(g_logger) << "iomanager peak workers=" << peak;
+    SYLAR_ASSERT(peak > 1 && peak <= 3);
+    SYLAR_ASSERT(wait_workers(iom, 1, 2000));
+
+    // 只剩一个线程时IO事件和定时器仍然正常
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    s_done = 0;
+    iom.schedule([fds]() {
+        char c;
+        SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+        usleep(1000);
+        ++s_done;
+    });
+    usleep(10 * 1000);
+    SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+    wait_done(1);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "iomanager grow=" << iom.getGrowCount() << " retire=" << iom.getRetireCount();
+}
+
+static void test_never_grow() {
+    auto grow_wait = sylar::Config::Lookup<uint64_t>("scheduler.elastic.grow_wait_ms");
+    uint64_t old_wait = grow_wait->getValue();
+    grow_wait->setValue(60 * 1000);
+    {
+        sylar::Scheduler sc(1, false, "never_grow", 4);
+        sc.start();
+        s_done = 0;
+        for (int i = 0; i < 10; ++i) {
+            sc.schedule([]() {
+                ++s_done;
+            });
+        }
+        wait_done(10);
+        SYLAR_ASSERT(sc.getGrowCount() == 0);
+        sc.stop();
+    }
+    {
+        sylar::IOManager iom(1, false, "never_grow_io", 3);
+        s_done = 0;
+        for (int i = 0; i < 10; ++i) {
+            iom.schedule([]() {
+                ++s_done;
+            });
+        }
+        wait_done(10);
+        SYLAR_ASSERT(iom.getGrowCount() == 0);
+    }
+    grow_wait->setValue(old_wait);
+    SYLAR_LOG_INFO(g_logger) << "never grown scheduler and iomanager stopped";
+}
+
+static void test_pin_retired() {
+    sylar::Scheduler sc(1, false, "pin_retired", 2);
+    sc.start();
+
+    // 只有一个线程时记下它的线程号，扩容之后其他的线程号就是会退出的线程
+    static std::atomic<int> base{-1};
+    s_done = 0;
+    sc.schedule([]() {
+        base = sylar::GetThreadId();
+        ++s_done;
+    });
+    wait_done(1);
+
+    static sylar::Mutex mutex;
+    static std::set<int> tids;
+    s_done = 0;
+    for (int i = 0; i < 300; ++i) {
+        sc.schedule([]() {
+            busy_us(1000);
+            {
+                sylar::Mutex::Lock lock(mutex);
+                tids.insert(sylar::GetThreadId());
+            }
+            ++s_done;
+        });
+    }
+    wait_done(300);
+    tids.erase(base);
+    SYLAR_ASSERT(!tids.empty());
+    int extra = *tids.begin();
+
+    uint64_t retired = sc.getRetireCount();
+    uint64_t deadline = sylar::GetCurrentMS() + 2000;
+    while (sc.getRetireCount() == retired && sylar::GetCurrentMS() < deadline) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(sc.getRetireCount() > retired);
+
+    static std::atomic<int> ran_on{-1};
+    sc.schedule([]() {
+        ran_on = sylar::GetThreadId();
+    }, extra);
+    deadline = sylar::GetCurrentMS() + 2000;
+    while (ran_on == -1 && sylar::GetCurrentMS() < deadline) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "task pinned to retired thread " << extra << " ran on " << ran_on;
+    SYLAR_ASSERT(ran_on != -1 && ran_on != extra);
+    sc.stop();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<uint64_t>("scheduler.elastic.grow_wait_ms")->setValue(2);
+    sylar::Config::Lookup<uint64_t>("scheduler.elastic.retire_idle_ms")->setValue(100);
+    test_scheduler();
+    test_iomanager();
+    test_never_grow();
+    test_pin_retired();
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "sylar.h"
+#include <sys/resource.h>
+
+/**
+ * @brief 纯计算调度器的空闲线程应该休眠，而不是空转
+ * @details 调度器空闲一段时间，统计这段时间内进程消耗的CPU时间；之后再投递任务，确认休眠的线程能被唤醒
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static uint64_t cpu_us() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec * 1000000ull + ru.ru_utime.tv_usec
+         + ru.ru_stime.tv_sec * 1000000ull + ru.ru_stime.tv_usec;
+}
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    sylar::Scheduler sc(4, false, "park");
+    sc.start();
+
+    for (int i = 0; i < 1000; ++i) {
+        sc.schedule([]() { ++s_done; });
+    }
+    wait_done(1000);
+
+    // 空闲300ms，4个空转的线程会消耗掉所有的CPU
+    uint64_t cpu0 = cpu_us();
+    usleep(300 * 1000);
+    uint64_t idle_cpu = cpu_us() - cpu0;
+
+    // 休眠的线程能被唤醒，并且任务能分给多个线程
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int i = 0; i < 1000; ++i) {
+        sc.schedule([]() { ++s_done; });
+    }
+    wait_done(1000);
+    uint64_t wake_us = sylar::GetCurrentUS() - begin;
+
+    uint64_t stop_begin = sylar::GetCurrentUS();
+    sc.stop();
+    uint64_t stop_us = sylar::GetCurrentUS() - stop_begin;
+
+    SYLAR_LOG_INFO(g_logger) << "idle 300ms cpu=" << idle_cpu << "us"
+                             << " parks=" << sc.getParkCount()
+                             << " 1000 tasks after idle=" << wake_us << "us"
+                             << " stop=" << stop_us << "us";
+    SYLAR_ASSERT(idle_cpu < 30 * 1000);
+    SYLAR_ASSERT(sc.getParkCount() > 0);
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "sylar.h"
+#include "fd_manager.h"
+
+/**
+ * @brief 调度器的任务优先级
+ * @details 1. 三个优先级都有任务时，按权重8:4:1轮流取任务
+ *          2. 低优先级任务等待超过上限后被提前执行，不会被高优先级任务饿死
+ *          3. IOManager 中IO就绪后恢复的协程按 IO_RESUME 优先级调度
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<bool> s_gate{false};
+static std::atomic<int> s_done{0};
+
+static void busy_us(uint64_t us) {
+    uint64_t end = sylar::GetCurrentUS() + us;
+    while (sylar::GetCurrentUS() < end)
+        ;
+}
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(100);
+    }
+}
+
+static void print_stats(sylar::Scheduler& sc) {
+    const char* names[] = {"io_resume", "normal", "background"};
+    for (int i = 0; i < sylar::Scheduler::PRIORITY_COUNT; ++i) {
+        auto stats = sc.getPriorityStats((sylar::Scheduler::Priority)i);
+        SYLAR_LOG_INFO(g_logger) << names[i] << " depth=" << stats.depth << " dequeued=" << stats.dequeued
+                                 << " avg_wait=" << (stats.dequeued ? stats.totalWaitUs / stats.dequeued : 0)
+                                 << "us max_wait=" << stats.maxWaitUs << "us promoted=" << stats.promoted;
+    }
+}
+
+static void test_weighted() {
+    sylar::Scheduler sc(1, false, "weighted");
+    sc.setPriorityWeight(sylar::Scheduler::IO_RESUME, 8);
+    sc.setPriorityWeight(sylar::Scheduler::NORMAL, 4);
+    sc.setPriorityWeight(sylar::Scheduler::BACKGROUND, 1);
+    sc.setMaxWaitMs(0);
+    sc.start();
+
+    // 先用一个任务占住唯一的调度线程，等所有任务入队后再放行
+    s_gate = false;
+    s_done = 0;
+    // 普通调度器没有定时器，不能用被hook的usleep
+    sc.schedule([]() {
+        while (!s_gate) {
+            sched_yield();
+        }
+    });
+    usleep(10 * 1000);
+
+    static std::vector<int> order;
+    order.clear();
+    const int kEach = 100;
+    for (int p = sylar::Scheduler::PRIORITY_COUNT - 1; p >= 0; --p) {
+        for (int i = 0; i < kEach; ++i) {
+            sc.schedule([p]() {
+                order.push_back(p);
+                ++s_done;
+            }, (sylar::Scheduler::Priority)p);
+        }
+    }
+    s_gate = true;
+    wait_done(kEach * 3);
+
+    // 平滑加权轮询：每13次选择中各优先级分别被选中8、4、1次
+    int count[3] = {0};
+    for (int i = 0; i < 13; ++i) {
+        ++count[order[i]];
+    }
+    SYLAR_LOG_INFO(g_logger) << "first 13 tasks: io=" << count[0] << " normal=" << count[1]
+                             << " background=" << count[2];
+    SYLAR_ASSERT(count[0] == 8 && count[1] == 4 && count[2] == 1);
+    print_stats(sc);
+    sc.stop();
+}
+
+static void test_starvation() {
+    sylar::Scheduler sc(1, false, "starvation");
+    sc.setPriorityWeight(sylar::Scheduler::IO_RESUME, 100000);
+    sc.setMaxWaitMs(5);
+    sc.start();
+
+    static std::atomic<bool> background_done{false};
+    static std::atomic<int> io_before{0};
+    background_done = false;
+    io_before = 0;
+    // 高优先级任务不断地重新调度自己，每次占用100us
+    static std::function<void()> io_task;
+    io_task = []() {
+        busy_us(100);
+        if (!background_done) {
+            ++io_before;
+            sylar::Scheduler::GetThis()->schedule(io_task, sylar::Scheduler::IO_RESUME);
+        }
+    };
+    for (int i = 0; i < 4; ++i) {
+        sc.schedule(io_task, sylar::Scheduler::IO_RESUME);
+    }
+    sc.schedule([]() { background_done = true; }, sylar::Scheduler::BACKGROUND);
+    while (!background_done) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "io tasks before background: " << io_before;
+    auto stats = sc.getPriorityStats(sylar::Scheduler::BACKGROUND);
+    SYLAR_ASSERT(stats.promoted == 1);
+    SYLAR_ASSERT(io_before < 10000);
+    print_stats(sc);
+    sc.stop();
+}
+
+static void test_io_resume() {
+    sylar::IOManager iom(2, false, "io_resume");
+    // hook只接管登记过的socket，管道或者没有登记的fd会直接阻塞线程
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    s_done = 0;
+    iom.schedule([fds]() {
+        char c;
+        // 读端为空，挂起等待可读，写入后由IOManager按IO_RESUME优先级恢复
+        SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+        ++s_done;
+    });
+    usleep(10 * 1000);
+    SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+    wait_done(1);
+    auto stats = iom.getPriorityStats(sylar::Scheduler::IO_RESUME);
+    SYLAR_LOG_INFO(g_logger) << "io_resume dequeued=" << stats.dequeued;
+    SYLAR_ASSERT(stats.dequeued >= 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    test_weighted();
+    test_starvation();
+    test_io_resume();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "sylar.h"
+#include <sys/wait.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+sylar::PooledStackAllocator::Stats print_stats(const char* tag) {
+    auto stats = sylar::PooledStackAllocator::GetStats();
+    SYLAR_LOG_INFO(g_logger) << tag
+                             << " mapped=" << stats.mapped
+                             << " cached=" << stats.cached
+                             << " hits=" << stats.hits
+                             << " misses=" << stats.misses
+                             << " trimmed=" << stats.trimmed;
+    return stats;
+}
+
+/**
+ * @brief 反复创建销毁协程，除第一轮外栈都应该命中线程缓存
+ */
+void test_reuse() {
+    sylar::Fiber::GetThis();
+    for (int i = 0; i < 1000; ++i) {
+        sylar::Fiber::ptr fiber(new sylar::Fiber([](){}, 0, false));
+        fiber->resume();
+    }
+    auto stats = print_stats("test_reuse");
+    SYLAR_ASSERT(stats.hits > 0);
+    SYLAR_ASSERT(stats.hits > stats.misses);
+}
+
+/**
+ * @brief 在子进程里写保护页，应该收到SIGSEGV
+ */
+void test_guard_page() {
+    auto allocator = sylar::PooledStackAllocator::GetInstance();
+    pid_t pid = fork();
+    if (pid == 0) {
+        char* stack = (char*)allocator->alloc(64 * 1024);
+        stack[-1] = 1;
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    SYLAR_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    SYLAR_LOG_INFO(g_logger) << "test_guard_page ok";
+}
+
+/**
+ * @brief 开启回收后，一次归还超过 trim_keep 个的栈，多出来的冷栈应该被释放物理页
+ */
+void test_trim() {
+    sylar::Config::Lookup<bool>("fiber.stack_pool.trim")->setValue(true);
+    sylar::Config::Lookup<uint32_t>("fiber.stack_pool.trim_keep")->setValue(2);
+    uint64_t trimmed = sylar::PooledStackAllocator::GetStats().trimmed;
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 8; ++i) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber([](){}, 0, false)));
+        fibers.back()->resume();
+    }
+    fibers.clear();
+    auto stats = print_stats("test_trim");
+    SYLAR_ASSERT(stats.trimmed > trimmed);
+}
+
+int main(int argc, char** argv) {
+    test_reuse();
+    test_guard_page();
+    test_trim();
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "sylar.h"
+#include <signal.h>
+
+/**
+ * @brief 空闲线程的唤醒
+ * @details 1. 所有线程都在epoll_wait上休眠时，非调度线程添加的任务和指定线程的任务都能及时执行，不会丢失唤醒
+ *          2. 一次添加大量任务时，只唤醒休眠中的线程，多余的唤醒被合并，发出的唤醒数远小于请求数
+ *          3. 共享epoll的唤醒信号SIGURG在创建IOManager时才接管，本进程以外来源的SIGURG仍然交给应用原来的处理函数
+ *          共享epoll和每线程反应器两种模式都检查
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static bool wait_for(std::atomic<int>& counter, int expect, uint64_t timeout_ms) {
+    uint64_t begin = sylar::GetCurrentMS();
+    while (counter < expect) {
+        if (sylar::GetCurrentMS() - begin > timeout_ms) {
+            return false;
+        }
+        usleep(100);
+    }
+    return true;
+}
+
+static void test_no_lost_wakeup(bool per_thread) {
+    const int kThreads = 4;
+    const int kRounds = 200;
+    sylar::Config::Lookup<bool>("iomanager.reactor_per_thread")->setValue(per_thread);
+    sylar::IOManager iom(kThreads, false, "wakeup");
+    static std::atomic<int> done{0};
+    done = 0;
+    usleep(50 * 1000);
+    for (int i = 0; i < kThreads; ++i) {
+        iom.schedule([]() {
+            usleep(10 * 1000);
+        });
+    }
+
+    // 等所有线程都睡下之后再添加，最长的等待时间远小于epoll_wait的默认超时
+    for (int i = 0; i < kRounds; ++i) {
+        usleep(i % 10 == 0 ? 5000 : 200);
+        iom.schedule([]() {
+            ++done;
+        });
+        SYLAR_ASSERT2(wait_for(done, i + 1, 1000), "lost wakeup round=" << i);
+    }
+
+    // 指定线程的任务只唤醒目标线程
+    static std::set<int> workers;
+    static sylar::Mutex mutex;
+    workers.clear();
+    for (int i = 0; i < kThreads * 4; ++i) {
+        iom.schedule([]() {
+            sylar::Mutex::Lock lock(mutex);
+            workers.insert(sylar::GetThreadId());
+        });
+    }
+    usleep(50 * 1000);
+    done = 0;
+    int expect = 0;
+    for (int round = 0; round < 20; ++round) {
+        for (int tid : workers) {
+            usleep(500);
+            iom.schedule([]() {
+                ++done;
+            }, tid);
+            ++expect;
+        }
+        SYLAR_ASSERT2(wait_for(done, expect, 1000), "lost pinned wakeup round=" << round);
+    }
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "reactor_per_thread=" << per_thread << " no lost wakeup, wakeups needed="
+                             << iom.getWakeupsNeeded() << " sent=" << iom.getWakeupsSent();
+    SYLAR_ASSERT(iom.getWakeupsSent() <= iom.getWakeupsNeeded());
+}
+
+static void test_coalesce(bool per_thread) {
+    const int kTasks = 20000;
+    sylar::Config::Lookup<bool>("iomanager.reactor_per_thread")->setValue(per_thread);
+    sylar::IOManager iom(4, false, "coalesce");
+    static std::atomic<int> done{0};
+    done = 0;
+    usleep(50 * 1000);
+    uint64_t needed = iom.getWakeupsNeeded();
+    uint64_t sent = iom.getWakeupsSent();
+    for (int i = 0; i < kTasks; ++i) {
+        iom.schedule([]() {
+            ++done;
+        });
+    }
+    SYLAR_ASSERT(wait_for(done, kTasks, 5000));
+    needed = iom.getWakeupsNeeded() - needed;
+    sent = iom.getWakeupsSent() - sent;
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "reactor_per_thread=" << per_thread << " tasks=" << kTasks
+                             << " wakeups needed=" << needed << " sent=" << sent;
+    SYLAR_ASSERT(sent > 0);
+    SYLAR_ASSERT(sent * 10 < needed);
+}
+
+static std::atomic<int> s_app_sigurg{0};
+
+static void on_app_sigurg(int) {
+    ++s_app_sigurg;
+}
+
+static void test_signal_chain() {
+    // 还没有创建IOManager，SIGURG的处理方式没有被改动
+    struct sigaction old;
+    sigaction(SIGURG, nullptr, &old);
+    SYLAR_ASSERT(!(old.sa_flags & SA_SIGINFO) && old.sa_handler == SIG_DFL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_app_sigurg;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGURG, &sa, nullptr);
+
+    sylar::Config::Lookup<bool>("iomanager.reactor_per_thread")->setValue(false);
+    sylar::IOManager iom(2, false, "sigurg");
+    static std::atomic<int> done{0};
+    usleep(20 * 1000);
+    for (int i = 0; i < 50; ++i) {
+        usleep(500);
+        iom.schedule([]() {
+            ++done;
+        });
+    }
+    SYLAR_ASSERT(wait_for(done, 50, 1000));
+    // 调度器自己的唤醒不会交给应用
+    SYLAR_ASSERT(s_app_sigurg == 0);
+    kill(getpid(), SIGURG);
+    SYLAR_ASSERT(wait_for(s_app_sigurg, 1, 1000));
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "wakeups sent=" << iom.getWakeupsSent() << " app SIGURG handled=" << s_app_sigurg;
+    SYLAR_ASSERT(iom.getWakeupsSent() > 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::ERROR);
+    test_signal_chain();
+    for (bool per_thread : {false, true}) {
+        test_no_lost_wakeup(per_thread);
+        test_coalesce(per_thread);
+    }
+    return 0;
+}
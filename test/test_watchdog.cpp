@@ -0,0 +1,86 @@
+#include "sylar.h"
+
+/**
+ * @brief 协程饥饿看门狗和协作式让出
+ * @details 1. 一个协程连续计算超过 scheduler.watchdog.slice_ms，看门狗报告一次，带协程id和调用栈
+ *          2. 计算循环中调用 maybe_yield()，同一线程上排在后面的任务不用等它算完，看门狗也不再报告
+ *          3. 空闲的线程保留报告记录，已经退出的线程的报告记录会被移除
+ */
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static void wait_done(int expect) {
+    while (s_done < expect) {
+        usleep(1000);
+    }
+}
+
+static void spin_without_yield(uint64_t ms) {
+    uint64_t end = sylar::GetCurrentMS() + ms;
+    while (sylar::GetCurrentMS() < end)
+        ;
+}
+
+static void test_report(sylar::Scheduler& sc) {
+    uint64_t before = sylar::Watchdog::GetInstance()->getReportCount();
+    s_done = 0;
+    sc.schedule([]() {
+        spin_without_yield(150);
+        ++s_done;
+    });
+    wait_done(1);
+    uint64_t reports = sylar::Watchdog::GetInstance()->getReportCount() - before;
+    SYLAR_LOG_INFO(g_logger) << "watchdog reports for one long slice: " << reports;
+    // 同一次运行只报告一次
+    SYLAR_ASSERT(reports == 1);
+}
+
+static void test_maybe_yield(sylar::Scheduler& sc) {
+    SYLAR_ASSERT(!sylar::maybe_yield());
+
+    uint64_t before = sylar::Watchdog::GetInstance()->getReportCount();
+    static std::atomic<uint64_t> long_end{0};
+    static std::atomic<uint64_t> short_ran{0};
+    static std::atomic<int> yields{0};
+    s_done = 0;
+    sc.schedule([]() {
+        uint64_t end = sylar::GetCurrentMS() + 150;
+        while (sylar::GetCurrentMS() < end) {
+            if (sylar::maybe_yield()) {
+                ++yields;
+            }
+        }
+        long_end = sylar::GetCurrentMS();
+        ++s_done;
+    });
+    sc.schedule([]() {
+        short_ran = sylar::GetCurrentMS();
+        ++s_done;
+    });
+    wait_done(2);
+    uint64_t reports = sylar::Watchdog::GetInstance()->getReportCount() - before;
+    SYLAR_LOG_INFO(g_logger) << "yields=" << yields << " short task ran "
+                             << (long_end - short_ran) << "ms before the long one finished, reports=" << reports;
+    SYLAR_ASSERT(yields > 0);
+    SYLAR_ASSERT(short_ran < long_end);
+    SYLAR_ASSERT(reports == 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLoggerLevel(sylar::LogLevel::WARN);
+    sylar::Config::Lookup<uint64_t>("scheduler.watchdog.slice_ms")->setValue(50);
+    sylar::Scheduler sc(1, false, "watchdog");
+    sc.start();
+    test_report(sc);
+    test_maybe_yield(sc);
+    // 线程空闲下来之后记录仍然保留
+    usleep(100 * 1000);
+    SYLAR_ASSERT(sylar::Watchdog::GetInstance()->getReportedThreads() == 1);
+    sc.stop();
+    // 调度器停止之后采样不到它的线程，报告记录随之移除
+    usleep(100 * 1000);
+    SYLAR_ASSERT(sylar::Watchdog::GetInstance()->getReportedThreads() == 0);
+    return 0;
+}